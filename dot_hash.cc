@@ -1,5 +1,4 @@
 #include "hash.h"	// hash
-#include "next_prime.h"	// next_prime()
 #include "open_compressed.h"	// close_compressed(), open_compressed(), pfread()
 #include "version.h"	// VERSION
 #include <getopt.h>	// getopt(), optarg, optind
@@ -10,7 +9,7 @@
 #include <mutex>	// lock_guard<>, mutex
 #include <sstream>	// istringstream
 #include <stdlib.h>	// exit()
-#include <string.h>	// memcmp(), memcpy()
+#include <string.h>	// memset()
 #include <string>	// string
 #include <thread>	// thread
 #include <vector>	// vector<>
@@ -37,13 +36,7 @@ class dhash : public hash {
 // also, resize hash to be 50% full
 
 void dhash::init_from_file2(const int fd) {
-	const std::string s(boilerplate());
-	char t[s.size()];
-	pfread(fd, t, s.size());
-	if (memcmp(s.c_str(), t, s.size())) {
-		std::cerr << "Error: could not read hash from file: header mismatch\n";
-		exit(1);
-	}
+	read_boilerplate(fd);
 	offset_type original_modulus;
 	pfread(fd, &original_modulus, sizeof(original_modulus));
 	pfread(fd, &collision_modulus, sizeof(collision_modulus));
@@ -67,15 +60,8 @@ void dhash::init_from_file2(const int fd) {
 	} else {
 		skip_next_chars(fd, sizeof(small_value_type) * modulus);
 	}
-	size_t size_asked(2 * used_elements);
+	probe.set_size(2 * used_elements, modulus, collision_modulus);
 	used_elements = 1;	// to account for minimum of one INVALID_KEYs
-	if (size_asked < 3) {	// to avoid collision_modulus == modulus
-		size_asked = 3;
-	}
-	modulus = next_prime(size_asked);
-	// collision_modulus just needs to be relatively prime with modulus;
-	// since modulus is prime, any value will do - I made it prime for fun
-	collision_modulus = next_prime(size_asked / 2);
 	key_list = new key_type[modulus];
 	value_list = new small_value_type[modulus];
 	// initialize keys; values are initialized as keys are entered
@@ -62,15 +62,10 @@ dhash::value_type dhash::value(const key_type_base &key) const {
 // like init_from_file(), but no alt values, and value is always 1 if key is present
 // if file_type is 0, it's a reference file, 1 is a fastq file
 void dhash::init_from_file2(const int fd, const int file_type) {
-	const std::string s(boilerplate());
-	char t[s.size()];
-	pfread(fd, t, s.size());
-	if (memcmp(t, s.c_str(), s.size()) != 0) {
-		std::cerr << "Error: could not read hash from file: header mismatch\n" << s << "\n" << t << "\n";
-		exit(1);
-	}
+	read_boilerplate(fd);
 	pfread(fd, &modulus, sizeof(modulus));
 	pfread(fd, &collision_modulus, sizeof(collision_modulus));
+	probe.set_modulus(modulus);
 	pfread(fd, &used_elements, sizeof(used_elements));
 	pfread(fd, &alt_size, sizeof(alt_size));
 	pfread(fd, &bit_width, sizeof(bit_width));
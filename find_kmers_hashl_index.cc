@@ -1,32 +1,41 @@
 #include "hashl.h"	// hashl
 #include "hashl_index.h"	// hashl_index
-#include "hashl_metadata.h"	// hashl_metadata
+#include "hashl_key_type.h"	// hashl_key_dispatch()
+#include "hashl_metadata.h"	// hashl_metadata, hashl_metadata_view
 #include "open_compressed.h"	// close_compressed(), get_suffix(), open_compressed()
 #include "version.h"	// VERSION
 #include "write_fork.h"	// close_fork(), write_fork()
+#include <algorithm>	// remove(), sort()
 #include <fstream>	// ofstream
+#include <functional>	// cref(), ref()
 #include <getopt.h>	// getopt(), optarg, optind
 #include <iostream>	// cerr, cout, ostream
-#include <iterator>	// next(), prev()
-#include <map>		// map<>
+#include <sstream>	// istringstream
 #include <stdlib.h>	// exit()
 #include <string>	// string
-#include <utility>	// make_pair(), pair<>
+#include <thread>	// thread
+#include <type_traits>	// remove_pointer<>
 #include <vector>	// vector<>
 
 // given a set of reference hashes and a hash of kmers to search for,
 // create a file of the matched ranges (exclusive end)
 
+static bool opt_bulk_lookup;
 static bool opt_fasta_format;
 static bool opt_merge_ranges;
+static int opt_threads;
 static std::string opt_reference_files;
 
 static void print_usage() {
 	std::cerr << "usage: find_kmers_hashl_index <kmer_list_hash> <reference_index1> [reference_index2 [...] ]\n"
+		"    -b    bulk lookup: sort the kmers and sweep through each index once\n"
+		"          (faster for large kmer lists, especially if an index won't\n"
+		"          fit in memory)\n"
 		"    -f    fasta format output\n"
 		"    -h    print this help\n"
 		"    -m    merge overlapping ranges*\n"
 		"    -o ## output file for base reference file names [stderr]\n"
+		"    -t ## number of lookup threads [1]\n"
 		"    -V    print version\n"
 		"\n"
 		"* Normally, found positions are merged into ranges when adjacent to each\n"
@@ -39,10 +48,15 @@ static void print_usage() {
 }
 
 static void get_opts(const int argc, char * const * const argv) {
+	opt_bulk_lookup = 0;
 	opt_fasta_format = 0;
+	opt_threads = 1;
 	int c;
-	while ((c = getopt(argc, argv, "fhmo:V")) != EOF) {
+	while ((c = getopt(argc, argv, "bfhmo:t:V")) != EOF) {
 		switch (c) {
+		    case 'b':
+			opt_bulk_lookup = 1;
+			break;
 		    case 'f':
 			opt_fasta_format = 1;
 			break;
@@ -55,6 +69,13 @@ static void get_opts(const int argc, char * const * const argv) {
 		    case 'o':
 			opt_reference_files = optarg;
 			break;
+		    case 't':
+			std::istringstream(optarg) >> opt_threads;
+			if (opt_threads < 1) {
+				std::cerr << "Error: -t requires positive value\n";
+				exit(1);
+			}
+			break;
 		    case 'V':
 			std::cerr << "find_kmers_hashl_index version " << VERSION << '\n';
 			exit(0);
@@ -68,131 +89,167 @@ static void get_opts(const int argc, char * const * const argv) {
 	}
 }
 
-struct hit_info {
-	uint64_t end;			// the map key to hit_info gives the start position
+struct hit_range {
+	hashl_index::size_type file, read;
+	uint64_t start, end;		// read positions of first and last kmer
 	hashl_index::size_type offset;	// to pull out sequence later
 };
 
-// add range, either as itself or extending an existing one
-// (possibly merging two)
-
-static void add_range(const std::map<hashl_index::size_type, hashl_metadata::position> &lookup_map, const hashl_index::size_type x, std::vector<std::vector<std::map<uint64_t, hit_info> > > &hits) {
-	// convert data offset into file/read/read_start
-	// (lower_bound() doesn't return <= position, but >=; upper_bound() is simply >)
-	// (divide x by 2 to convert to basepair position)
-	std::map<hashl_index::size_type, hashl_metadata::position>::const_iterator pos(lookup_map.upper_bound(x / 2));
-	--pos;								// now pos is <=
-	// add range, or extend overlapping one
-	std::map<uint64_t, hit_info> &ranges(hits[pos->second.file][pos->second.read]);
-	const uint64_t start(pos->second.read_start + x / 2 - pos->first);
-	// see if we should extend an existing range
-	if (!ranges.empty()) {
-		std::map<uint64_t, hit_info>::iterator a(ranges.upper_bound(start));
-		// see if we follow an existing range
-		if (a != ranges.begin()) {
-			std::map<uint64_t, hit_info>::iterator b = std::prev(a);
-			if (b->second.end + 1 == start) {
-				// also merge with following entry?
-				if (a != ranges.end() && start + 1 == a->first) {
-					b->second.end = a->second.end;
-					ranges.erase(a);
-				} else {
-					b->second.end = start;
-				}
-				return;
-			}
-		}
-		// see if existing range follows us
-		if (a != ranges.end() && start + 1 == a->first) {
-			ranges[start] = {a->second.end, x};
-			ranges.erase(a);
-			return;
-		}
+// output format is F#/read_name/start_end
+// (F# is 0-offset, end is exclusive)
+
+static void print_range(const hit_range &a, const hashl_metadata_view &md, const size_t file_offset, const hashl_index &reference) {
+	const size_t mer_length(reference.bits() / 2);
+	if (opt_fasta_format) {
+		std::cout << ">F" << file_offset + a.file << '/' << md.read(a.file, a.read) << '/' << a.start << '_' << a.end + mer_length << '\n';
+		std::string s;
+		reference.get_sequence(a.offset, (a.end + mer_length - a.start) * 2, s);
+		std::cout << s << '\n';
+	} else {
+		std::cout << 'F' << file_offset + a.file << '/' << md.read(a.file, a.read) << '/' << a.start << '_' << a.end + mer_length << '\n';
 	}
-	ranges[start] = {start, x};
 }
 
-// output format is F#/read_name/start_end
-// (F# is 0-offset, end is exclusive)
+// turn the data offsets of the hits into ranges of adjacent kmers, and
+// print them; the data is laid out in file/read/position order, so
+// once the offsets are sorted, each range is a run of consecutive
+// offsets, and they come out in the order they're printed in
 
-static void print_hits(const std::vector<std::vector<std::map<uint64_t, hit_info> > > &hits, const hashl_metadata &md, std::vector<std::string> &file_list, const hashl_index &reference) {
+static void print_hits(std::vector<hashl_index::size_type> &offsets, const hashl_metadata_view &md, const hashl_metadata::position_list &lookup_list, std::vector<std::string> &file_list, const hashl_index &reference) {
 	const size_t mer_length(reference.bits() / 2);
 	const size_t file_offset(file_list.size());
-	std::string s;
-	for (size_t i(0); i < hits.size(); ++i) {
+	for (size_t i(0); i < md.file_count(); ++i) {
 		file_list.push_back(md.file(i));
-		const std::vector<std::map<uint64_t, hit_info> > &reads(hits[i]);
-		for (size_t j(0); j < reads.size(); ++j) {
-			for (const auto &a : reads[j]) {
-				if (opt_fasta_format) {
-					std::cout << ">F" << file_offset + i << '/' << md.read(i, j) << '/' << a.first << '_' << a.second.end + mer_length << '\n';
-					reference.get_sequence(a.second.offset, (a.second.end + mer_length - a.first) * 2, s);
-					std::cout << s << '\n';
-				} else {
-					std::cout << 'F' << file_offset + i << '/' << md.read(i, j) << '/' << a.first << '_' << a.second.end + mer_length << '\n';
-				}
+	}
+	std::sort(offsets.begin(), offsets.end());
+	hit_range last;
+	bool have_last(0);
+	for (size_t i(0); i < offsets.size();) {
+		// convert data offset into file/read/read_start
+		// (divide by 2 to convert to basepair position)
+		const size_t first(i);
+		const hashl_index::size_type x(offsets[i] / 2);
+		hashl_index::size_type range_start, range_end;
+		const hashl_metadata::position &pos(lookup_list.find(x, range_start, range_end));
+		// find the end of the run (which can't go past the read range)
+		hashl_index::size_type y(x);
+		for (++i; i < offsets.size() && offsets[i] / 2 == y + 1 && y + 1 + mer_length <= range_end; ++i, ++y) { }
+		const hit_range next = { pos.file, pos.read, pos.read_start + x - range_start, pos.read_start + y - range_start, offsets[first] };
+		// merge nearby ranges with overlapping (but non-adjacent) kmers
+		if (have_last && opt_merge_ranges && last.file == next.file && last.read == next.read && last.end + mer_length >= next.start) {
+			last.end = next.end;
+		} else {
+			if (have_last) {
+				print_range(last, md, file_offset, reference);
 			}
+			last = next;
+			have_last = 1;
 		}
 	}
+	if (have_last) {
+		print_range(last, md, file_offset, reference);
+	}
 }
 
-// merge non-adjacent, overlapping ranges
-static void merge_ranges(std::map<uint64_t, hit_info> &list, const hashl_index::size_type mer_length) {
-	for (auto a = list.begin();;) {
-		auto b = std::next(a);
-		if (b == list.end()) {
-			return;
-		}
-		while (a->second.end + mer_length >= b->first) {
-			a->second.end = b->second.end;
-			b = list.erase(b);
-			if (b == list.end()) {
-				return;
+// collect the data offsets of the kmers from lookup slots [start, end)
+// that are also in reference
+
+static void find_hits_thread(const hashl &lookup, const hashl_index &reference, const hashl::size_type start, const hashl::size_type end, std::vector<hashl_index::size_type> &offsets) {
+	hashl::const_iterator a(lookup, start);
+	const hashl::const_iterator end_a(lookup, end);
+	hashl::key_type key(lookup.bits(), lookup.words());
+	for (; a != end_a; ++a) {
+		if (*a && *a != hashl::invalid_value) {
+			a.key(key);
+			const hashl_index::size_type x = reference.position(key);
+			if (x != hashl_index::size_type(-1)) {
+				offsets.push_back(x);
 			}
 		}
-		a = b;
 	}
 }
 
-// go through all kmers in lookup and find positions in reference,
-// then map and combine them to form a list of ranges over reads in the
-// reference file(s), then print out those ranges as a fasta file
+// look up kmers with the lookup slots split between threads
 
-static void check_reference(const hashl &lookup, const hashl_index &reference, std::vector<std::string> &file_list) {
-	// collect positions of all matches
-	// to convert data positions into file/read/range_start
-	hashl_metadata md;
-	md.unpack(reference.get_metadata());
-	std::map<hashl_index::size_type, hashl_metadata::position> lookup_map;
-	md.create_lookup_map(lookup_map);
-	// [file][read][range_start] = (range_end, if kmer is non-unique)
-	std::vector<std::vector<std::map<uint64_t, hit_info> > > hits(md.file_count());
-	for (size_t i(0); i < hits.size(); ++i) {
-		hits[i].assign(md.read_count(i), std::map<uint64_t, hit_info>());
+static void find_hits_threaded(const hashl &lookup, const hashl_index &reference, std::vector<hashl_index::size_type> &offsets) {
+	std::vector<std::vector<hashl_index::size_type> > thread_offsets(opt_threads);
+	std::thread threads[opt_threads];
+	const hashl::size_type n(lookup.capacity());
+	for (int i(0); i < opt_threads; ++i) {
+		threads[i] = std::thread(find_hits_thread, std::cref(lookup), std::cref(reference), n * i / opt_threads, n * (i + 1) / opt_threads, std::ref(thread_offsets[i]));
 	}
+	for (int i(0); i < opt_threads; ++i) {
+		threads[i].join();
+	}
+	for (int i(0); i < opt_threads; ++i) {
+		offsets.insert(offsets.end(), thread_offsets[i].begin(), thread_offsets[i].end());
+		std::vector<hashl_index::size_type>().swap(thread_offsets[i]);
+	}
+}
+
+// same as looking up each kmer in lookup with reference.position(), but
+// with all the kmers (and their reverse complements) sorted and then
+// found in a single pass through reference; as reference only has one
+// of a kmer and its reverse complement, at most one of them will be found
+
+template<class K>
+static void bulk_positions(const hashl &lookup, const hashl_index &reference, std::vector<hashl_index::size_type> &offsets) {
+	std::vector<K> keys;
+	keys.reserve(2 * lookup.size());
+	K key(lookup.bits(), lookup.words()), comp_key(lookup.bits(), lookup.words());
 	hashl::const_iterator a(lookup.cbegin());
 	const hashl::const_iterator end_a(lookup.cend());
-	hashl::key_type key(lookup.bits(), lookup.words());
 	for (; a != end_a; ++a) {
 		if (*a && *a != hashl::invalid_value) {
 			a.key(key);
-			hashl_index::size_type x = reference.position(key);
-			if (x != hashl_index::size_type(-1)) {
-				add_range(lookup_map, x, hits);
+			keys.push_back(key);
+			comp_key.make_complement(key);
+			if (comp_key != key) {
+				keys.push_back(comp_key);
 			}
 		}
 	}
-	// merge nearby ranges with overlapping (but non-adjacent) kmers
-	if (opt_merge_ranges) {
-		for (auto &b : hits) {			// loop over files
-			for (auto &c : b) {		// loop over reads
-				if (!c.empty()) {	// merge ranges on same read
-					merge_ranges(c, lookup.bits() / 2);
-				}
-			}
-		}
+	std::sort(keys.begin(), keys.end());
+	// with threads, each sweeps through its own part of the index
+	offsets.assign(keys.size(), 0);
+	std::thread threads[opt_threads];
+	const size_t n(keys.size());
+	for (int i(0); i < opt_threads; ++i) {
+		const size_t start(n * i / opt_threads), end(n * (i + 1) / opt_threads);
+		threads[i] = std::thread([&reference, &keys, &offsets, start, end]() {
+			reference.positions(keys.data() + start, end - start, offsets.data() + start);
+		});
 	}
-	print_hits(hits, md, file_list, reference);
+	for (int i(0); i < opt_threads; ++i) {
+		threads[i].join();
+	}
+	std::vector<K>().swap(keys);
+	// drop the kmers that weren't found
+	offsets.erase(std::remove(offsets.begin(), offsets.end(), hashl_index::size_type(-1)), offsets.end());
+}
+
+// go through all kmers in lookup and find positions in reference,
+// then map and combine them to form a list of ranges over reads in the
+// reference file(s), then print out those ranges as a fasta file
+
+static void check_reference(const hashl &lookup, const hashl_index &reference, std::vector<std::string> &file_list) {
+	// collect positions of all matches
+	std::vector<hashl_index::size_type> offsets;
+	if (opt_bulk_lookup) {
+		hashl_key_dispatch<hashl::base_type>(lookup.words(), [&](auto key_ptr) {
+			typedef typename std::remove_pointer<decltype(key_ptr)>::type key_type;
+			bulk_positions<key_type>(lookup, reference, offsets);
+		});
+	} else if (opt_threads > 1) {
+		find_hits_threaded(lookup, reference, offsets);
+	} else {
+		find_hits_thread(lookup, reference, 0, lookup.capacity(), offsets);
+	}
+	// to convert data positions into file/read/range_start
+	const hashl_metadata_view md(reference.get_metadata());
+	hashl_metadata::position_list lookup_list;
+	md.create_position_list(lookup_list);
+	print_hits(offsets, md, lookup_list, file_list, reference);
 }
 
 static void print_reference_file_list(const std::vector<std::string> &files) {
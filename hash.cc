@@ -1,26 +1,155 @@
 #include "hash.h"
 #include "itoa.h"	// itoa()
 #include "local_endian.h"	// big_endian
-#include "next_prime.h"	// next_prime()
-#include "open_compressed.h"	// close_compressed(), open_compressed(), pfread()
-#include "write_fork.h"	// close_fork(), close_fork_wait(), pfwrite(), write_fork()
-#include <algorithm>	// swap()
+#include "open_compressed.h"	// close_compressed(), open_compressed(), pfgets(), pfread()
+#include "write_fork.h"	// pfwrite_buffer, write_fork()
+#include <algorithm>	// pop_heap(), push_heap(), swap()
 #include <cassert>	// assert()
 #include <errno.h>	// errno
 #include <limits.h>	// UINT64_MAX
 #include <list>		// list<>
-#include <map>		// map<>
 #include <new>		// new
 #include <sstream>	// ostringstream
 #include <stdio.h>	// fprintf(), stderr
 #include <stdlib.h>	// exit()
-#include <string.h>	// memcmp(), strerror()
+#include <string.h>	// memcpy(), strerror()
 #include <string>	// string
 #include <sys/stat.h>	// S_ISDIR(), stat(), struct stat
-#include <unistd.h>	// unlink()
-#include <utility>	// make_pair(), pair<>
+#include <thread>	// thread
+#include <unistd.h>	// close(), unlink()
+#include <vector>	// vector<>
+
+// merges the sorted tmp files and the (sorted) in-memory entries of a hash
+// a key at a time, with a heap of the runs ordered by their current keys;
+// tmp files are plain (key, value) records, read back a block at a time
+
+class hash::spill_merge {
+    private:
+	class run {
+	    public:
+		int fd;			// -1 for the in-memory entries
+		std::vector<char> buffer;
+		size_t buffer_start, buffer_end;
+		key_type key;
+		value_type value;
+		explicit run(const int fd_in) : fd(fd_in), buffer_start(0), buffer_end(0), key(INVALID_KEY), value(0) { }
+	};
+	enum { record_size = sizeof(key_type) + sizeof(value_type) };
+	const hash * const list;
+	offset_type memory_offset;
+	std::vector<run> runs;
+	std::vector<size_t> heap;	// runs that aren't used up
+	// for making heap a min heap
+	class run_later {
+	    private:
+		const std::vector<run> &runs;
+	    public:
+		explicit run_later(const std::vector<run> &runs_in) : runs(runs_in) { }
+		bool operator()(const size_t i, const size_t j) const {
+			return runs[j].key < runs[i].key;
+		}
+	};
+	bool advance(run &);
+    public:
+	explicit spill_merge(const hash *);
+	~spill_merge();
+	bool next(key_type &, value_type &);
+};
+
+// open each tmp file and get everything's first entry
+
+hash::spill_merge::spill_merge(const hash * const list_in) : list(list_in), memory_offset(0) {
+	runs.reserve(list->state_files.size() + 1);
+	runs.push_back(run(-1));
+	std::list<std::string>::const_iterator a(list->state_files.begin());
+	const std::list<std::string>::const_iterator end_a(list->state_files.end());
+	for (; a != end_a; ++a) {
+		const int fd(open_compressed(*a));
+		if (fd == -1) {
+			exit(1);
+		}
+		runs.push_back(run(fd));
+		// enough for 64k worth of whole records
+		runs.back().buffer.assign(((1 << 16) / record_size + 1) * record_size, 0);
+	}
+	for (size_t i(0); i != runs.size(); ++i) {
+		if (advance(runs[i])) {
+			heap.push_back(i);
+			std::push_heap(heap.begin(), heap.end(), run_later(runs));
+		}
+	}
+}
+
+hash::spill_merge::~spill_merge() {
+	for (size_t i(0); i != runs.size(); ++i) {
+		if (runs[i].fd != -1) {
+			close_compressed(runs[i].fd);
+		}
+	}
+}
+
+// move a run to its next entry; returns false once it's used up
+
+bool hash::spill_merge::advance(run &a) {
+	if (a.fd == -1) {
+		// the in-memory entries are squashed into the first
+		// used_elements - 1 slots
+		if (memory_offset == list->used_elements - 1) {
+			return 0;
+		}
+		a.key = list->key_list[memory_offset];
+		a.value = list->value_list[memory_offset];
+		if (a.value == max_small_value) {
+			a.value += list->value_map.find(&a.key);
+		}
+		++memory_offset;
+		return 1;
+	}
+	if (a.buffer_start == a.buffer_end) {
+		const ssize_t n(pfread(a.fd, &a.buffer[0], a.buffer.size()));
+		if (n <= 0) {
+			return 0;
+		} else if (n % record_size) {
+			fprintf(stderr, "Error: short read on state file %d\n", a.fd);
+			exit(1);
+		}
+		a.buffer_start = 0;
+		a.buffer_end = n;
+	}
+	memcpy(&a.key, &a.buffer[a.buffer_start], sizeof(key_type));
+	memcpy(&a.value, &a.buffer[a.buffer_start + sizeof(key_type)], sizeof(value_type));
+	a.buffer_start += record_size;
+	return 1;
+}
+
+// get the next key, with its value summed over all the runs it's in;
+// returns false at the end
+
+bool hash::spill_merge::next(key_type &key, value_type &value) {
+	if (heap.empty()) {
+		return 0;
+	}
+	const run_later later(runs);
+	key = runs[heap.front()].key;
+	value = 0;
+	while (!heap.empty() && runs[heap.front()].key == key) {
+		std::pop_heap(heap.begin(), heap.end(), later);
+		run &a(runs[heap.back()]);
+		value += a.value;
+		if (advance(a)) {
+			std::push_heap(heap.begin(), heap.end(), later);
+		} else {
+			heap.pop_back();
+		}
+	}
+	return 1;
+}
 
 hash::~hash() {
+	finish_spill();
+	delete readback;
+	delete[] spill_key_list;
+	delete[] spill_value_list;
 	delete[] key_list;
 	delete[] value_list;
 	delete[] alt_list;
@@ -36,6 +165,7 @@ hash::~hash() {
 
 std::string hash::boilerplate() const {
 	std::string s("hash\n");
+	s += probe.header_line();
 	s += itoa(sizeof(key_type));
 	s += " bytes\n";
 #ifdef big_endian
@@ -46,6 +176,28 @@ std::string hash::boilerplate() const {
 	return s;
 }
 
+// read and check the beginning of a saved file; the probe line is optional
+
+void hash::read_boilerplate(const int fd) {
+	std::string t, line;
+	probe.set_type(hash_probe::PRIME);
+	for (int i(0); i < 3; ++i) {
+		if (pfgets(fd, line) == -1) {
+			fprintf(stderr, "Error: could not read hash from file: short header\n");
+			exit(1);
+		}
+		if (i == 1 && probe.parse_header_line(line)) {
+			--i;
+		}
+		t += line;
+		t += '\n';
+	}
+	if (t != boilerplate()) {
+		fprintf(stderr, "Error: could not read hash from file: header mismatch\n");
+		exit(1);
+	}
+}
+
 void hash::init(offset_type size_asked, offset_type alt_size_in) {
 	if (alt_size_in > 8 * sizeof(offset_type)) {
 		fprintf(stderr, "Error: hash alt size too large: %lu > %lu\n", alt_size_in, 8 * sizeof(offset_type));
@@ -53,14 +205,7 @@ void hash::init(offset_type size_asked, offset_type alt_size_in) {
 	}
 	alt_size = alt_size_in;
 	used_elements = 1;	// to account for minimum of one INVALID_KEYs
-	++size_asked;
-	if (size_asked < 3) {	// to avoid collision_modulus == modulus
-		size_asked = 3;
-	}
-	modulus = next_prime(size_asked);
-	// collision_modulus just needs to be relatively prime with modulus;
-	// since modulus is prime, any value will do - I made it prime for fun
-	collision_modulus = next_prime(size_asked / 2);
+	probe.set_size(size_asked + 1, modulus, collision_modulus);
 	key_list = new key_type[modulus];
 	value_list = new small_value_type[modulus];
 	if (alt_size == 0) {
@@ -68,7 +213,7 @@ void hash::init(offset_type size_asked, offset_type alt_size_in) {
 		alt_map = NULL;
 	} else {
 		alt_list = new small_value_type[modulus * alt_size];
-		alt_map = new std::map<key_type, value_type>[alt_size];
+		alt_map = new hash_overflow[alt_size];
 	}
 	// initialize keys; values are initialized as keys are entered
 	for (offset_type i = 0; i != modulus; ++i) {
@@ -77,15 +222,10 @@ void hash::init(offset_type size_asked, offset_type alt_size_in) {
 }
 
 void hash::init_from_file(const int fd) {
-	const std::string s(boilerplate());
-	char t[s.size()];
-	pfread(fd, t, s.size());
-	if (memcmp(s.c_str(), t, s.size()) != 0) {
-		fprintf(stderr, "Error: could not read hash from file: header mismatch\n");
-		exit(1);
-	}
+	read_boilerplate(fd);
 	pfread(fd, &modulus, sizeof(modulus));
 	pfread(fd, &collision_modulus, sizeof(collision_modulus));
+	probe.set_modulus(modulus);
 	pfread(fd, &used_elements, sizeof(used_elements));
 	pfread(fd, &alt_size, sizeof(alt_size));
 	key_list = new key_type[modulus];
@@ -95,7 +235,7 @@ void hash::init_from_file(const int fd) {
 		alt_map = NULL;
 	} else {
 		alt_list = new small_value_type[modulus * alt_size];
-		alt_map = new std::map<key_type, value_type>[alt_size];
+		alt_map = new hash_overflow[alt_size];
 	}
 	// read in values (they're the smallest size)
 	pfread(fd, &value_list[0], sizeof(small_value_type) * modulus);
@@ -115,7 +255,7 @@ void hash::init_from_file(const int fd) {
 		value_type j;
 		pfread(fd, &i, sizeof(i));
 		pfread(fd, &j, sizeof(j));
-		value_map[i] = j;
+		value_map.set(&i, j);
 	}
 	if (alt_size != 0) {
 		for (offset_type i(0), j(0); i != modulus; ++i) {
@@ -131,14 +271,14 @@ void hash::init_from_file(const int fd) {
 		}
 		// alt map overflows
 		for (offset_type k(0); k != alt_size; ++k) {
-			std::map<key_type, value_type> &z = alt_map[k];
+			hash_overflow &z = alt_map[k];
 			pfread(fd, &x, sizeof(x));
 			for (; x != 0; --x) {
 				key_type i;
 				value_type j;
 				pfread(fd, &i, sizeof(i));
 				pfread(fd, &j, sizeof(j));
-				z[i] = j;
+				z.set(&i, j);
 			}
 		}
 	}
@@ -147,15 +287,15 @@ void hash::init_from_file(const int fd) {
 // returns next empty spot found, or modulus if it spots the key first
 
 hash::offset_type hash::find_empty_offset(key_type key) const {
-	offset_type i(key % modulus);
+	offset_type i(probe.start(key, modulus));
 	if (key_list[i] == INVALID_KEY) {
 		return i;
 	} else if (key_list[i] == key) {
 		return modulus;
 	}
-	const offset_type j(collision_modulus - (key % collision_modulus));
+	offset_type j(probe.step(key, collision_modulus));
 	for (;;) {	// search over all elements
-		i = (i + j) % modulus;
+		probe.next(i, j, modulus);
 		if (key_list[i] == INVALID_KEY) {
 			return i;
 		} else if (key_list[i] == key) {
@@ -168,9 +308,9 @@ void hash::rehash() {
 	// first pass, fill all non-collision slots
 	for (offset_type i(0); i != modulus; ++i) {
 		if (key_list[i] != INVALID_KEY) {
-			const offset_type j(key_list[i] % modulus);
+			const offset_type j(probe.start(key_list[i], modulus));
 			// swap if non-collision slot has a collision fill
-			if (i != j && (key_list[j] == INVALID_KEY || key_list[j] % modulus != j)) {
+			if (i != j && (key_list[j] == INVALID_KEY || probe.start(key_list[j], modulus) != j)) {
 				std::swap(key_list[j], key_list[i]);
 				std::swap(value_list[j], value_list[i]);
 				--i;
@@ -204,9 +344,9 @@ void hash::rehash_alt() {
 	offset_type i(0);
 	for (; i != modulus; ++i) {
 		if (key_list[i] != INVALID_KEY) {
-			const offset_type j(key_list[i] % modulus);
+			const offset_type j(probe.start(key_list[i], modulus));
 			// swap if non-collision slot has a collision fill
-			if (i != j && (key_list[j] == INVALID_KEY || key_list[j] % modulus != j)) {
+			if (i != j && (key_list[j] == INVALID_KEY || probe.start(key_list[j], modulus) != j)) {
 				std::swap(key_list[j], key_list[i]);
 				std::swap(value_list[j], value_list[i]);
 				offset_type x(j * alt_size);
@@ -304,12 +444,9 @@ void hash::clean_hash(value_type min, value_type max) {
 			key_list[i] = INVALID_KEY;
 			--used_elements;
 		} else {
-			const std::map<key_type, value_type>::iterator a(value_map.find(key_list[i]));
-			const value_type big_value(a == value_map.end() ? 0 : a->second);
+			const value_type big_value(value_map.find(&key_list[i]));
 			if (big_value < min || (big_max && max < big_value)) {
-				if (a != value_map.end()) {
-					value_map.erase(a);
-				}
+				value_map.erase(&key_list[i]);
 				key_list[i] = INVALID_KEY;
 				--used_elements;
 			}
@@ -332,10 +469,8 @@ hash::offset_type hash::insert_key(const offset_type i, const key_type key) {
 			// have to redo positioning after clean_hash()
 			return insert_offset(key);
 		} else if (no_space_response & TMP_FILE) {
-			radix_sort(modulus);
-			save_state();
-			clear(1);
-			// have to redo positioning after clear()
+			start_spill();
+			// have to redo positioning in the new arrays
 			return insert_offset(key);
 		} else {
 			return modulus;		// hash table is full
@@ -355,15 +490,15 @@ hash::offset_type hash::insert_key(const offset_type i, const key_type key) {
 // find a key, or insert it if it doesn't exist; return modulus if hash is full
 
 hash::offset_type hash::insert_offset(key_type key) {
-	offset_type i(key % modulus);
+	offset_type i(probe.start(key, modulus));
 	if (key_list[i] == INVALID_KEY) {
 		return insert_key(i, key);
 	} else if (key_list[i] == key) {
 		return i;
 	}
-	const offset_type j(collision_modulus - (key % collision_modulus));
+	offset_type j(probe.step(key, collision_modulus));
 	for (;;) {	// search over all elements
-		i = (i + j) % modulus;
+		probe.next(i, j, modulus);
 		if (key_list[i] == INVALID_KEY) {
 			return insert_key(i, key);
 		} else if (key_list[i] == key) {
@@ -375,15 +510,15 @@ hash::offset_type hash::insert_offset(key_type key) {
 // find a key; return modulus if not found
 
 hash::offset_type hash::find_offset(const key_type key) const {
-	offset_type i(key % modulus);
+	offset_type i(probe.start(key, modulus));
 	if (key_list[i] == key) {
 		return i;
 	} else if (key_list[i] == INVALID_KEY) {
 		return modulus;
 	}
-	const offset_type j(collision_modulus - (key % collision_modulus));
+	offset_type j(probe.step(key, collision_modulus));
 	for (;;) {	// search over all elements
-		i = (i + j) % modulus;
+		probe.next(i, j, modulus);
 		if (key_list[i] == key) {
 			return i;
 		} else if (key_list[i] == INVALID_KEY) {
@@ -402,7 +537,7 @@ bool hash::increment(key_type key) {
 	if (value_list[i] != max_small_value) {
 		++value_list[i];
 	} else if (can_overflow) {
-		++value_map[key];
+		value_map.add(&key, 1);
 	}
 	return 1;
 }
@@ -421,7 +556,7 @@ bool hash::increment_alt(key_type key, offset_type x) {
 			if (alt_list[j] != max_small_value) {
 				++alt_list[j];
 			} else if (can_overflow) {
-				++alt_map[j - start_j][key];
+				alt_map[j - start_j].add(&key, 1);
 			}
 		}
 	}
@@ -437,13 +572,7 @@ hash::value_type hash::value(key_type key) const {
 	} else if (value_list[i] != max_small_value) {
 		return value_list[i];
 	} else {
-		// use find() to avoid inserting a value into value_map
-		const std::map<key_type, value_type>::const_iterator a(value_map.find(key));
-		if (a == value_map.end()) {
-			return max_small_value;
-		} else {
-			return a->second + max_small_value;
-		}
+		return value_map.find(&key) + max_small_value;
 	}
 }
 
@@ -458,32 +587,22 @@ hash::value_type hash::value(key_type key, value_type x[]) const {
 		if (alt_list[j + alt_offset] != max_small_value) {
 			x[j] = alt_list[j + alt_offset];
 		} else {
-			const std::map<key_type, value_type> &b(alt_map[j]);
-			// use find() to avoid inserting a value into alt_map
-			const std::map<key_type, value_type>::const_iterator a(b.find(key));
-			if (a == b.end()) {
-				x[j] = max_small_value;
-			} else {
-				x[j] = a->second + max_small_value;
-			}
+			x[j] = alt_map[j].find(&key) + max_small_value;
 		}
 	}
 	if (value_list[i] != max_small_value) {
 		return value_list[i];
 	} else {
-		// use find() to avoid inserting a value into value_map
-		const std::map<key_type, value_type>::const_iterator a(value_map.find(key));
-		if (a == value_map.end()) {
-			return max_small_value;
-		} else {
-			return a->second + max_small_value;
-		}
+		return value_map.find(&key) + max_small_value;
 	}
 }
 
 // reset hash to empty state
 
 void hash::clear(const bool mostly_clear) {
+	finish_spill();
+	delete readback;
+	readback = 0;
 	used_elements = 1;	// to account for minimum of one INVALID_KEYs
 	// initialize keys
 	for (offset_type i(0); i != modulus; ++i) {
@@ -500,6 +619,10 @@ void hash::clear(const bool mostly_clear) {
 			unlink(a->c_str());
 		}
 		state_files.clear();
+		delete[] spill_key_list;
+		spill_key_list = 0;
+		delete[] spill_value_list;
+		spill_value_list = 0;
 	}
 }
 
@@ -514,14 +637,17 @@ hash::const_iterator hash::begin() {
 		}
 		return a;
 	} else {			// set up readback from tmp files
-		offset_type index(static_cast<offset_type>(-1));
-		std::map<key_type, std::pair<value_type, int> > next_keys;
-		prep_for_readback(index, next_keys);
-		return const_iterator(this, index, next_keys);
+		finish_spill();
+		// get the in-memory values into an ordered form
+		squash_hash(key_list, value_list, used_elements - 1);
+		radix_sort(key_list, value_list, used_elements - 1);
+		delete readback;
+		readback = new spill_merge(this);
+		return const_iterator(this, *readback);
 	}
 }
 
-hash::const_iterator::const_iterator(const hash * const b, const offset_type i) : list(b), offset(i) {
+hash::const_iterator::const_iterator(const hash * const b, const offset_type i) : list(b), offset(i), merge(0) {
 	if (list == NULL || offset == list->modulus) {
 		key = INVALID_KEY;
 		value = 0;
@@ -530,24 +656,18 @@ hash::const_iterator::const_iterator(const hash * const b, const offset_type i)
 		if (list->value_list[offset] != max_small_value) {
 			value = list->value_list[offset];
 		} else {
-			const std::map<key_type, value_type>::const_iterator a(list->value_map.find(key));
-			if (a == list->value_map.end()) {
-				value = max_small_value;
-			} else {
-				value = a->second + max_small_value;
-			}
+			value = list->value_map.find(&key) + max_small_value;
 		}
 	}
 }
 
-hash::const_iterator::const_iterator(const hash * const b, const offset_type i, const std::map<key_type, std::pair<value_type, int> > &c) : list(b), offset(i), next_keys(c) {
-	if (list == NULL || next_keys.empty()) {
+// the offset is only used to mark the end of iteration
+
+hash::const_iterator::const_iterator(const hash * const b, spill_merge &c) : list(b), offset(0), merge(&c) {
+	if (!merge->next(key, value)) {
 		key = INVALID_KEY;
 		value = 0;
-	} else {
-		const std::map<key_type, std::pair<value_type, int> >::iterator a(next_keys.begin());
-		key = a->first;
-		value = a->second.first;
+		offset = list->modulus;
 	}
 }
 
@@ -556,7 +676,7 @@ hash::const_iterator &hash::const_iterator::operator=(const const_iterator &a) {
 	offset = a.offset;
 	key = a.key;
 	value = a.value;
-	next_keys = a.next_keys;
+	merge = a.merge;
 	return *this;
 }
 
@@ -566,55 +686,24 @@ void hash::const_iterator::increment() {
 	if (offset == list->modulus) {
 		return;
 	}
-	if (next_keys.empty()) {
-		for (++offset; offset != list->modulus && list->key_list[offset] == INVALID_KEY; ++offset) { }
-		if (offset < list->modulus) {
-			key = list->key_list[offset];
-			value = list->value_list[offset];
-			if (value == max_small_value) {
-				const std::map<key_type, value_type>::const_iterator a(list->value_map.find(key));
-				if (a != list->value_map.end()) {
-					value += a->second;
-				}
-			}
-		} else {
+	if (merge) {
+		if (!merge->next(key, value)) {
 			key = INVALID_KEY;
 			value = 0;
-		}
-	} else {
-		const int fd(next_keys.begin()->second.second);
-		next_keys.erase(next_keys.begin());
-		// get next unique entry from that file
-		for (;;) {
-			// check if file is out of entries
-			if (!list->get_next_entry(fd, key, value, offset)) {
-				if (fd != -1) {
-					close_compressed(fd);
-				}
-				break;
-			}
-			std::map<key_type, std::pair<value_type, int> >::iterator c(next_keys.find(key));
-			if (c == next_keys.end()) {
-				next_keys[key] = std::make_pair(value, fd);
-				break;
-			} else { // keep going until we get a unique entry
-				c->second.first += value;
-			}
-		}
-		if (!next_keys.empty()) {
-			const std::map<key_type, std::pair<value_type, int> >::iterator a(next_keys.begin());
-			key = a->first;
-			value = a->second.first;
-		} else {
-			key = INVALID_KEY;
-			value = 0;
-			// mark end of iteration; can't happen through
-			// get_next_entry() because that maxes offset out
-			// at list->used_elements, which is guaranteed to
-			// be at least one less than list->modulus, thanks
-			// to squash_hash()
 			offset = list->modulus;
 		}
+		return;
+	}
+	for (++offset; offset != list->modulus && list->key_list[offset] == INVALID_KEY; ++offset) { }
+	if (offset < list->modulus) {
+		key = list->key_list[offset];
+		value = list->value_list[offset];
+		if (value == max_small_value) {
+			value += list->value_map.find(&key);
+		}
+	} else {
+		key = INVALID_KEY;
+		value = 0;
 	}
 }
 
@@ -626,61 +715,58 @@ void hash::const_iterator::get_alt_values(value_type x[]) const {
 		if (list->alt_list[alt_offset + i] != max_small_value) {
 			x[i] = list->alt_list[alt_offset + i];
 		} else {
-			// use find() to avoid inserting a value into alt_map
-			const std::map<key_type, value_type>::const_iterator a(list->alt_map[i].find(key));
-			if (a == list->alt_map[i].end()) {
-				x[i] = max_small_value;
-			} else {
-				x[i] = a->second + max_small_value;
-			}
+			x[i] = list->alt_map[i].find(&key) + max_small_value;
 		}
 	}
 }
 
 void hash::save(const int fd) const {
+	pfwrite_buffer out(fd);
 	const std::string s(boilerplate());
-	pfwrite(fd, s.c_str(), s.size());
-	pfwrite(fd, &modulus, sizeof(modulus));
-	pfwrite(fd, &collision_modulus, sizeof(collision_modulus));
-	pfwrite(fd, &used_elements, sizeof(used_elements));
-	pfwrite(fd, &alt_size, sizeof(alt_size));
+	out.write(s.c_str(), s.size());
+	out.write(&modulus, sizeof(modulus));
+	out.write(&collision_modulus, sizeof(collision_modulus));
+	out.write(&used_elements, sizeof(used_elements));
+	out.write(&alt_size, sizeof(alt_size));
 	// normally, unused entries have uninitialized data, but here we
 	// store them with zero values so we can use them to mark entries
 	// in the other arrays that we don't bother to write to file
 	const small_value_type zero(0);
 	for (offset_type i(0); i != modulus; ++i) {
-		pfwrite(fd, key_list[i] == INVALID_KEY ? &zero : &value_list[i], sizeof(small_value_type));
+		out.write(key_list[i] == INVALID_KEY ? &zero : &value_list[i], sizeof(small_value_type));
 	}
 	for (offset_type i(0); i != modulus; ++i) {
 		if (key_list[i] != INVALID_KEY) {
-			pfwrite(fd, &key_list[i], sizeof(key_type));
+			out.write(&key_list[i], sizeof(key_type));
 		}
 	}
 	offset_type x;
 	x = value_map.size();
-	pfwrite(fd, &x, sizeof(x));
-	std::map<key_type, value_type>::const_iterator a(value_map.begin());
-	const std::map<key_type, value_type>::const_iterator end_a(value_map.end());
-	for (; a != end_a; ++a) {
-		pfwrite(fd, &a->first, sizeof(key_type));
-		pfwrite(fd, &a->second, sizeof(value_type));
+	out.write(&x, sizeof(x));
+	for (offset_type i(0); i != value_map.slots(); ++i) {
+		if (value_map.value(i) != 0) {
+			const value_type y(value_map.value(i));
+			out.write(value_map.key(i), sizeof(key_type));
+			out.write(&y, sizeof(value_type));
+		}
 	}
 	if (alt_size != 0) {
 		for (offset_type i(0); i != modulus; ++i) {
 			if (key_list[i] != INVALID_KEY) {
-				pfwrite(fd, &alt_list[i * alt_size], sizeof(small_value_type) * alt_size);
+				out.write(&alt_list[i * alt_size], sizeof(small_value_type) * alt_size);
 			}
 		}
 		// alt map overflows
 		for (offset_type j(0); j != alt_size; ++j) {
-			std::map<key_type, value_type> &z = alt_map[j];
+			const hash_overflow &z = alt_map[j];
 			x = z.size();
-			pfwrite(fd, &x, sizeof(x));
-			std::map<key_type, value_type>::const_iterator b(z.begin());
-			const std::map<key_type, value_type>::const_iterator end_b(z.end());
-			for (; b != end_b; ++b) {
-				pfwrite(fd, &b->first, sizeof(key_type));
-				pfwrite(fd, &b->second, sizeof(value_type));
+			out.write(&x, sizeof(x));
+			for (offset_type i(0); i != z.slots(); ++i) {
+				if (z.value(i) != 0) {
+					const value_type y(z.value(i));
+					out.write(z.key(i), sizeof(key_type));
+					out.write(&y, sizeof(value_type));
+				}
 			}
 		}
 	}
@@ -698,10 +784,10 @@ bool hash::add(const key_type key, const value_type new_value) {
 	} else if (!can_overflow) {
 		value_list[i] = max_small_value;
 	} else if (value_list[i] != max_small_value) {
-		value_map[key] = value_list[i] + new_value - max_small_value;
+		value_map.set(&key, value_list[i] + new_value - max_small_value);
 		value_list[i] = max_small_value;
 	} else {
-		value_map[key] += new_value;
+		value_map.add(&key, new_value);
 	}
 	return 1;
 }
@@ -718,10 +804,10 @@ bool hash::add_alt(const key_type key, const value_type new_value, const value_t
 	} else if (!can_overflow) {
 		value_list[i] = max_small_value;
 	} else if (value_list[i] != max_small_value) {
-		value_map[key] = value_list[i] + new_value - max_small_value;
+		value_map.set(&key, value_list[i] + new_value - max_small_value);
 		value_list[i] = max_small_value;
 	} else {
-		value_map[key] += new_value;
+		value_map.add(&key, new_value);
 	}
 	const offset_type start_j(i * alt_size);
 	const offset_type end_j(start_j + alt_size);
@@ -731,10 +817,10 @@ bool hash::add_alt(const key_type key, const value_type new_value, const value_t
 		} else if (!can_overflow) {
 			alt_list[j] = max_small_value;
 		} else if (alt_list[j] != max_small_value) {
-			alt_map[j - start_j][key] = alt_list[j] + alt_values[j - start_j] - max_small_value;
+			alt_map[j - start_j].set(&key, alt_list[j] + alt_values[j - start_j] - max_small_value);
 			alt_list[j] = max_small_value;
 		} else {
-			alt_map[j - start_j][key] += alt_values[j - start_j];
+			alt_map[j - start_j].add(&key, alt_values[j - start_j]);
 		}
 	}
 	return 1;
@@ -779,7 +865,7 @@ bool hash::add_hash(hash &h) {
 
 // optimized (-O2) shell_sort() beats qsort() for n < ~32k (on random data)
 
-void hash::shell_sort(const offset_type start_index, const offset_type stop_index) {
+void hash::shell_sort(key_type * const key_list, small_value_type * const value_list, const offset_type start_index, const offset_type stop_index) {
 	// if you plan to only use arrays shorter than 701 (or some
 	// smaller value), reduce the array to only the ones that cover
 	// your size range (701, 301, 132)
@@ -806,7 +892,7 @@ void hash::shell_sort(const offset_type start_index, const offset_type stop_inde
 	}
 }
 
-void hash::calculate_offsets(const offset_type start_index, const offset_type stop_index, offset_type * offsets, const int shift) const {
+void hash::calculate_offsets(const key_type * const key_list, const offset_type start_index, const offset_type stop_index, offset_type * offsets, const int shift) {
 	// we actually count in offsets[1-256], but we don't care about
 	// the value in offsets[256], so don't bother initializing it
 	offsets[0] = start_index;
@@ -828,14 +914,14 @@ void hash::calculate_offsets(const offset_type start_index, const offset_type st
 	}
 }
 
-void hash::radix_sort_internal(const offset_type start_index, const offset_type stop_index, offset_type * offsets, const int shift) {
+void hash::radix_sort_internal(key_type * const key_list, small_value_type * const value_list, const offset_type start_index, const offset_type stop_index, offset_type * offsets, const int shift) {
 	// use shell sort for terminal sorting;
 	// this seems to give very similar results when set between 128 and 4k
 	if (stop_index - start_index < 512) {
-		shell_sort(start_index, stop_index);
+		shell_sort(key_list, value_list, start_index, stop_index);
 		return;
 	}
-	calculate_offsets(start_index, stop_index, offsets, shift);
+	calculate_offsets(key_list, start_index, stop_index, offsets, shift);
 	// swap unbinned elements into bins, growing sorted bins as we go
 	offset_type * const unbinned_start(offsets + 256);
 	for (int i(0); i != 256; ++i) {
@@ -867,11 +953,11 @@ void hash::radix_sort_internal(const offset_type start_index, const offset_type
 	// recurse down to the next set of bins
 	for (int i(0); i != 255; ++i) {
 		if (offsets[i] != offsets[i + 1]) {
-			radix_sort_internal(offsets[i], offsets[i + 1], offsets + 256, shift - 8);
+			radix_sort_internal(key_list, value_list, offsets[i], offsets[i + 1], offsets + 256, shift - 8);
 		}
 	}
 	if (offsets[255] != stop_index) {
-		radix_sort_internal(offsets[255], stop_index, offsets + 256, shift - 8);
+		radix_sort_internal(key_list, value_list, offsets[255], stop_index, offsets + 256, shift - 8);
 	}
 }
 
@@ -880,14 +966,14 @@ void hash::radix_sort_internal(const offset_type start_index, const offset_type
 // was for just the key_value array, not with the small_values_array as well);
 // of course, the hash is unusable as a hash after this operation
 
-void hash::radix_sort(const offset_type elements) {
+void hash::radix_sort(key_type * const keys, small_value_type * const values, const offset_type elements) const {
 	// this does not permute alt values,
 	// so don't use it for hashes with alts
 	assert(alt_size == 0);
 	// 256 entries for each pass, max_key_size / 8 passes, with 256
 	// extra for holding the unbinned positions of bins while swapping
 	offset_type offsets[max_key_size * 32 + 256];
-	radix_sort_internal(0, elements, offsets, max_key_size - 8);
+	radix_sort_internal(keys, values, 0, elements, offsets, max_key_size - 8);
 }
 
 void hash::set_no_space_response(int i, const std::string &s) {
@@ -908,121 +994,97 @@ void hash::set_no_space_response(int i, const std::string &s) {
 	}
 }
 
-// save sorted hash to disk for later processing
-void hash::save_state(void) {
+// swap the full arrays for the spare ones (waiting for them to be written
+// out first, if need be), and start writing the full ones to a new tmp
+// file in the background
+
+void hash::start_spill(void) {
+	finish_spill();
+	if (spill_key_list == NULL) {
+		spill_key_list = new key_type[modulus];
+		spill_value_list = new small_value_type[modulus];
+		for (offset_type i(0); i != modulus; ++i) {
+			spill_key_list[i] = INVALID_KEY;
+		}
+	}
 	static int count(-1);
 	std::ostringstream s;
-	s << tmp_file_prefix << "hash." << ++count << ".gz";
+	s << tmp_file_prefix << "hash." << ++count;
 	const std::string file(s.str());
-	std::list<std::string> args;
-	args.push_back("gzip");
-	args.push_back("-c");
-	const int fd(write_fork(args, file));
+	// plain file, as compression would slow the writes down
+	const int fd(write_fork(std::list<std::string>(), file));
 	if (fd == -1) {
 		exit(1);
 	}
 	state_files.push_back(file);
-	for (offset_type i(0); i != modulus; ++i) {
-		if (key_list[i] != INVALID_KEY) {
-			pfwrite(fd, &key_list[i], sizeof(key_type));
-			value_type x(value_list[i]);
-			if (x == max_small_value) {
-				const std::map<key_type, value_type>::const_iterator a(value_map.find(key_list[i]));
-				if (a != value_map.end()) {
-					x += a->second;
-				}
-			}
-			pfwrite(fd, &x, sizeof(value_type));
-		}
-	}
-	close_fork(fd);
+	std::swap(key_list, spill_key_list);
+	std::swap(value_list, spill_value_list);
+	value_map.swap(spill_value_map);
+	const offset_type elements(used_elements - 1);
+	used_elements = 1;	// to account for minimum of one INVALID_KEYs
+	spill_thread = new std::thread(&hash::save_state, this, fd, elements);
 }
 
-// move all non-INVALID_KEY entries to front of hash table;
-// the hash table is, of course, broken as a hash after this operation
-void hash::squash_hash(void) {
-	// used_elements will get reset at next clear()
-	if (--used_elements == 0) {	// don't count INVALID_KEY
-		return;
-	}
-	offset_type i(static_cast<offset_type>(-1));
-	offset_type j(modulus);
-	for (;;) {
-		for (++i; i != used_elements && key_list[i] != INVALID_KEY; ++i) { }
-		if (i == used_elements) {
-			break;
+void hash::finish_spill(void) {
+	if (spill_thread) {
+		spill_thread->join();
+		delete spill_thread;
+		spill_thread = 0;
+		// exit here, rather than in the spill thread, so nothing is
+		// torn down while another thread is using it
+		if (spill_failed) {
+			fprintf(stderr, "Error: could not write state file\n");
+			exit(1);
 		}
-		for (--j; key_list[j] == INVALID_KEY; --j) { }
-		key_list[i] = key_list[j];
-		value_list[i] = value_list[j];
 	}
 }
 
-bool hash::get_next_entry(const int fd, key_type &i, value_type &j, offset_type &offset) const {
-	if (fd != -1) {	
-		if (pfread(fd, &i, sizeof(key_type)) == -1) {
-			return 0;
-		}
-		if (pfread(fd, &j, sizeof(value_type)) == -1) {
-			fprintf(stderr, "Error: short read on state file %d\n", fd);
-			exit(1);
-		}
-	} else {		// fd == -1 for in-memory values
-		// by construction, this routine will not be called with
-		// fd == -1 after it returns zero for it once, so you don't
-		// have to worry about incrementing past used_elements
-		if (++offset == used_elements) {
-			return 0;
-		}
-		i = key_list[offset];
-		j = value_list[offset];
-		if (j == max_small_value) {
-			const std::map<key_type, value_type>::const_iterator a(value_map.find(i));
-			if (a != value_map.end()) {
-				j += a->second;
-			}
+// sort the spill arrays and write them out as (key, value) records, then
+// empty them so they're ready to be swapped back in; this runs in the
+// spill thread, so a write error is left for finish_spill() to report
+
+void hash::save_state(const int fd, const offset_type elements) {
+	squash_hash(spill_key_list, spill_value_list, elements);
+	radix_sort(spill_key_list, spill_value_list, elements);
+	pfwrite_buffer out(fd);
+	for (offset_type i(0); i != elements; ++i) {
+		out.write(&spill_key_list[i], sizeof(key_type));
+		value_type x(spill_value_list[i]);
+		if (x == max_small_value) {
+			x += spill_value_map.find(&spill_key_list[i]);
 		}
+		out.write(&x, sizeof(value_type));
 	}
-	return 1;
+	if (out.flush() == -1) {
+		spill_failed = 1;
+	}
+	close(fd);
+	for (offset_type i(0); i != modulus; ++i) {
+		spill_key_list[i] = INVALID_KEY;
+	}
+	spill_value_map.clear();
 }
 
-// set up for reading back values from saved state files
-void hash::prep_for_readback(offset_type &offset, std::map<key_type, std::pair<value_type, int> > &next_keys) {
-	// make sure all state files are finished being written to
-	close_fork_wait(-1);
-	// get the in-memory values into an ordered form
-	squash_hash();	// so we don't have to sort INVALID_KEY entries
-	radix_sort(used_elements);
-	// open the files and read in the first values
-	key_type i;
-	value_type j;
-	if (get_next_entry(-1, i, j, offset)) {	// in-memory first, though
-		next_keys[i] = std::make_pair(j, -1);
+// move the given number of non-INVALID_KEY entries to the front of the
+// arrays; the hash table is, of course, broken as a hash after this
+// operation (and the slots after them aren't cleared)
+
+void hash::squash_hash(key_type * const keys, small_value_type * const values, const offset_type elements) const {
+	if (elements == 0) {
+		return;
 	}
-	std::list<std::string>::const_iterator a(state_files.begin());
-	const std::list<std::string>::const_iterator end_a(state_files.end());
-	for (; a != end_a; ++a) {
-		const int fd(open_compressed(*a));
-		if (fd == -1) {
-			exit(1);
-		}
-		for (;;) {	// keep going until we get a unique entry
-			// check if file is out of entries
-			if (!get_next_entry(fd, i, j, offset)) {
-				close_compressed(fd);
-				break;
-			}
-			std::map<key_type, std::pair<value_type, int> >::iterator c(next_keys.find(i));
-			if (c == next_keys.end()) {
-				next_keys[i] = std::make_pair(j, fd);
-				break;
-			} else { // keep going until we get a unique entry
-				c->second.first += j;
-			}
+	offset_type i(static_cast<offset_type>(-1));
+	offset_type j(modulus);
+	for (;;) {
+		for (++i; i != elements && keys[i] != INVALID_KEY; ++i) { }
+		if (i == elements) {
+			break;
 		}
+		for (--j; keys[j] == INVALID_KEY; --j) { }
+		keys[i] = keys[j];
+		values[i] = values[j];
+		keys[j] = INVALID_KEY;
 	}
-	// by here, next_keys will have a key-sorted list of exactly
-	// one key per file
 }
 
 bool hash::set_value(const key_type key, const value_type value) {
@@ -1032,11 +1094,11 @@ bool hash::set_value(const key_type key, const value_type value) {
 	}
 	if (value <= max_small_value) {
 		value_list[i] = value;
-		value_map.erase(key);
+		value_map.erase(&key);
 	} else {
 		value_list[i] = max_small_value;
 		if (can_overflow) {
-			value_map[key] = value - max_small_value;
+			value_map.set(&key, value - max_small_value);
 		}
 	}
 	return 1;
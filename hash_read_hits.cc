@@ -17,6 +17,7 @@
 #include <stdlib.h>	// exit()
 #include <string.h>	// memcmp()
 #include <string>	// string
+#include <utility>	// make_pair(), pair<>
 
 // description beginning of saved file
 
@@ -137,9 +138,16 @@ void hash_read_hits::add_read(const key_type key, const read_type read) {
 // add reads associated with kmer (if any) to list
 
 void hash_read_hits::get_reads(const key_type key, std::map<read_type, int> &reads, const value_type max_hits) const {
+	std::pair<const read_type *, const read_type *> x(get_read_range(key, max_hits));
+	for (; x.first != x.second; ++x.first) {
+		++reads[*x.first];
+	}
+}
+
+std::pair<const hash_read_hits::read_type *, const hash_read_hits::read_type *> hash_read_hits::get_read_range(const key_type key, const value_type max_hits) const {
 	const offset_type i(find_offset(key));
 	if (i == modulus) {	// key not found
-		return;
+		return std::make_pair(read_list, read_list);
 	}
 	value_type n(value_list[i]);
 	if (n == max_small_value) {
@@ -149,13 +157,11 @@ void hash_read_hits::get_reads(const key_type key, std::map<read_type, int> &rea
 			n += a->second;
 		}
 	}
-	if (n <= max_hits) {
-		size_t j(read_offset_list[i]);
-		const size_t end_j(j + n);
-		for (; j != end_j; ++j) {
-			++reads[read_list[j]];
-		}
+	if (n > max_hits) {
+		return std::make_pair(read_list, read_list);
 	}
+	const read_type * const start(read_list + read_offset_list[i]);
+	return std::make_pair(start, start + n);
 }
 
 void hash_read_hits::save(const int fd) const {
@@ -4,25 +4,33 @@
 #include "hashl_metadata.h"	// hashl_metadata
 #include "itoa.h"	// itoa()
 #include "local_endian.h"	// big_endian
-#include "next_prime.h"	// next_prime()
-#include "open_compressed.h"	// pfread()
-#include "write_fork.h"	// pfwrite()
+#include "open_compressed.h"	// pfgets(), pfread(), skip_next_chars()
+#include "write_fork.h"	// pfwrite_buffer
+#include <errno.h>	// errno
 #include <algorithm>	// lower_bound(), sort(), swap()
 #include <iomanip>	// setw()
 #include <iostream>	// cerr, cout
 #include <iterator>	// distance()
 #include <map>		// map<>
 #include <stdint.h>	// uint64_t
-#include <stdlib.h>	// exit()
-#include <string.h>	// memcmp(), memcpy()
+#include <stdlib.h>	// atoi(), exit()
+#include <string.h>	// memcmp(), memcpy(), strerror()
 #include <string>	// string
+#include <sys/stat.h>	// fstat(), S_ISREG(), stat
+#include <unistd.h>	// sysconf(), _SC_PAGE_SIZE
 #include <utility>	// make_pair(), pair<>
 #include <vector>	// vector<>
 
 // description beginning of saved file
 
-std::string hashl::boilerplate(void) const {
+std::string hashl::boilerplate(const int version) const {
 	std::string s("hashl\n");
+	if (version > 1) {
+		s += "version ";
+		s += itoa(version);
+		s += "\n";
+	}
+	s += probe.header_line();
 	s += itoa(sizeof(base_type));
 	s += " bytes\n";
 #ifdef big_endian
@@ -40,16 +48,38 @@ void hashl::init(const hash_offset_type size_asked, const size_type bits_in, std
 	resize(size_asked);
 }
 
-void hashl::init_from_file(const int fd) {
-	const std::string s(boilerplate());
-	char t[s.size()];
-	pfread(fd, t, s.size());
-	if (memcmp(t, s.c_str(), s.size()) != 0) {
+// version 3 files pad each array out to start on a multiple of alignment
+
+static uint64_t padding(const uint64_t offset, const uint64_t alignment) {
+	return (alignment - offset % alignment) % alignment;
+}
+
+void hashl::init_from_file(const int fd, const int load_mode) {
+	// read header line by line, as the version and probe lines are optional
+	std::string t, line;
+	int version(1);
+	probe.set_type(hash_probe::PRIME);
+	for (int i(0); i < 3; ++i) {
+		if (pfgets(fd, line) == -1) {
+			std::cerr << "Error: could not read hash from file: short header\n";
+			exit(1);
+		}
+		if (i == 1 && line.compare(0, 8, "version ") == 0) {
+			version = atoi(line.c_str() + 8);
+			--i;
+		} else if (i == 1 && probe.parse_header_line(line)) {
+			--i;
+		}
+		t += line;
+		t += '\n';
+	}
+	if (version < 1 || mappable_file_version < version || t != boilerplate(version)) {
 		std::cerr << "Error: could not read hash from file: header mismatch\n";
 		exit(1);
 	}
 	pfread(fd, &modulus, sizeof(modulus));
 	pfread(fd, &collision_modulus, sizeof(collision_modulus));
+	probe.set_modulus(modulus);
 	// this value is no longer used, read in here for backward compatibility
 	pfread(fd, &used_elements, sizeof(used_elements));
 	pfread(fd, &bit_width, sizeof(bit_width));
@@ -60,6 +90,10 @@ void hashl::init_from_file(const int fd) {
 	pfread(fd, &metadata[0], metadata_size);
 	uint64_t data_size;
 	pfread(fd, &data_size, sizeof(data_size));
+	if (version == mappable_file_version) {
+		init_arrays_from_file(fd, t.size() + sizeof(modulus) + sizeof(collision_modulus) + sizeof(used_elements) + sizeof(bit_width) + sizeof(metadata_size) + metadata_size + sizeof(data_size), data_size, load_mode);
+		return;
+	}
 	data.assign(data_size, 0);
 	pfread(fd, &data[0], sizeof(base_type) * data_size);
 	value_list.assign(modulus, 0);
@@ -73,70 +107,177 @@ void hashl::init_from_file(const int fd) {
 			++used_elements;
 		}
 	}
+	tag_list.assign(modulus, 0);
+	if (version > 1) {
+		for (hash_offset_type i(0); i < modulus; ++i) {
+			if (value_list[i]) {
+				pfread(fd, &tag_list[i], sizeof(tag_type));
+			}
+		}
+	} else {	// older files have to have tags generated
+		key_type key(bit_width, word_width), comp_key(bit_width, word_width);
+		for (hash_offset_type i(0); i < modulus; ++i) {
+			if (value_list[i]) {
+				key.copy_in(data, key_list[i]);
+				comp_key.make_complement(key);
+				tag_list[i] = key_tag(key < comp_key ? key.hash() : comp_key.hash());
+			}
+		}
+	}
+}
+
+// the rest of a version 3 file; file_offset is how much has been read so
+// far; used_elements is taken from the file, as all of key_list is saved
+
+void hashl::init_arrays_from_file(const int fd, uint64_t file_offset, const uint64_t data_size, const int load_mode) {
+	uint64_t alignment;
+	pfread(fd, &alignment, sizeof(alignment));
+	file_offset += sizeof(alignment);
+	const uint64_t data_offset(file_offset + padding(file_offset, alignment));
+	const uint64_t value_list_offset(data_offset + sizeof(base_type) * data_size + padding(data_offset + sizeof(base_type) * data_size, alignment));
+	const uint64_t key_list_offset(value_list_offset + sizeof(small_value_type) * modulus + padding(value_list_offset + sizeof(small_value_type) * modulus, alignment));
+	const uint64_t tag_list_offset(key_list_offset + sizeof(size_type) * modulus + padding(key_list_offset + sizeof(size_type) * modulus, alignment));
+	struct stat buf;
+	// compressed files come through a pipe, and have to be read
+	if (load_mode != load_read && fstat(fd, &buf) == 0 && S_ISREG(buf.st_mode)) {
+		const bool writable(load_mode == load_map_copy_on_write);
+		if (!data.map(fd, data_offset, data_size, writable) || !value_list.map(fd, value_list_offset, modulus, writable) || !key_list.map(fd, key_list_offset, modulus, writable) || !tag_list.map(fd, tag_list_offset, modulus, writable)) {
+			std::cerr << "Error: mmap(" << errno << "): " << strerror(errno) << '\n';
+			exit(1);
+		}
+		return;
+	}
+	data.assign(data_size, 0);
+	skip_next_chars(fd, data_offset - file_offset);
+	pfread(fd, &data[0], sizeof(base_type) * data_size);
+	value_list.assign(modulus, 0);
+	skip_next_chars(fd, value_list_offset - data_offset - sizeof(base_type) * data_size);
+	pfread(fd, &value_list[0], sizeof(small_value_type) * modulus);
+	key_list.assign(modulus, invalid_key);
+	skip_next_chars(fd, key_list_offset - value_list_offset - sizeof(small_value_type) * modulus);
+	pfread(fd, &key_list[0], sizeof(size_type) * modulus);
+	tag_list.assign(modulus, 0);
+	skip_next_chars(fd, tag_list_offset - key_list_offset - sizeof(size_type) * modulus);
+	pfread(fd, &tag_list[0], sizeof(tag_type) * modulus);
 }
 
 // insert a key at a particular location
 
-hashl::hash_offset_type hashl::insert_key(const hash_offset_type i, const size_type offset) {
+hashl::hash_offset_type hashl::insert_key(const hash_offset_type i, const size_type offset, const tag_type tag) {
 	if (++used_elements == modulus) {	// hash table is full
 		return used_elements--;		// (always leave one empty value to mark end)
 	}
 	key_list[i] = offset;
 	value_list[i] = 0;
+	tag_list[i] = tag;
 	return i;
 }
 
 // find a key, or insert it if it doesn't exist; return modulus if hash is full
 
-hashl::hash_offset_type hashl::insert_offset(const key_type &key, const key_type &comp_key, const size_type offset) {
-	const base_type key_hash(key < comp_key ? key.hash() : comp_key.hash());
-	hash_offset_type i(key_hash % modulus);
+template<class K>
+hashl::hash_offset_type hashl::insert_offset(const K &key, const K &comp_key, const size_type offset) {
+	return insert_offset(key, comp_key, offset, canonical_hash(key, comp_key));
+}
+
+// same, with the hash already calculated
+
+template<class K>
+hashl::hash_offset_type hashl::insert_offset(const K &key, const K &comp_key, const size_type offset, const base_type key_hash) {
+	const tag_type tag(key_tag(key_hash));
+	hash_offset_type i(probe.start(key_hash, modulus));
 	if (key_list[i] == invalid_key) {		// insert
-		return insert_key(i, offset);
-	} else if (key.equal_to(data, key_list[i]) || comp_key.equal_to(data, key_list[i])) {
+		return insert_key(i, offset, tag);
+	} else if (tag_list[i] == tag && (key.equal_to(data, key_list[i]) || comp_key.equal_to(data, key_list[i]))) {
 		return i;				// already present
 	}
-	const hash_offset_type j(collision_modulus - key_hash % collision_modulus);
+	hash_offset_type j(probe.step(key_hash, collision_modulus));
 	for (;;) {	// search over all elements
-		i = (i + j) % modulus;
+		probe.next(i, j, modulus);
 		if (key_list[i] == invalid_key) {
-			return insert_key(i, offset);
-		} else if (key.equal_to(data, key_list[i]) || comp_key.equal_to(data, key_list[i])) {
+			return insert_key(i, offset, tag);
+		} else if (tag_list[i] == tag && (key.equal_to(data, key_list[i]) || comp_key.equal_to(data, key_list[i]))) {
 			return i;
 		}
 	}
 }
 
+// same as insert_offset(), but safe to call from multiple threads at once;
+// empty entries are claimed with a compare-and-swap, and if we lose the
+// race we just compare against whatever key won it; the tag is set after
+// the key, so a zero tag means we have to do the full comparison
+
+template<class K>
+hashl::hash_offset_type hashl::insert_offset_atomic(const K &key, const K &comp_key, const size_type offset) {
+	return insert_offset_atomic(key, comp_key, offset, canonical_hash(key, comp_key));
+}
+
+template<class K>
+hashl::hash_offset_type hashl::insert_offset_atomic(const K &key, const K &comp_key, const size_type offset, const base_type key_hash) {
+	const tag_type tag(key_tag(key_hash));
+	hash_offset_type i(probe.start(key_hash, modulus));
+	hash_offset_type j(probe.step(key_hash, collision_modulus));
+	for (;;) {	// search over all elements
+		size_type x(__atomic_load_n(&key_list[i], __ATOMIC_ACQUIRE));
+		if (x == invalid_key) {
+			// reserve space first (always leave one empty value to mark end)
+			if (__atomic_add_fetch(&used_elements, 1, __ATOMIC_RELAXED) >= modulus) {
+				__atomic_sub_fetch(&used_elements, 1, __ATOMIC_RELAXED);
+				return modulus;
+			}
+			if (__atomic_compare_exchange_n(&key_list[i], &x, offset, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+				__atomic_store_n(&tag_list[i], tag, __ATOMIC_RELEASE);
+				return i;
+			}
+			// someone else got it first; x now has their offset
+			__atomic_sub_fetch(&used_elements, 1, __ATOMIC_RELAXED);
+		}
+		const tag_type y(__atomic_load_n(&tag_list[i], __ATOMIC_ACQUIRE));
+		if ((y == 0 || y == tag) && (key.equal_to(data, x) || comp_key.equal_to(data, x))) {
+			return i;
+		}
+		probe.next(i, j, modulus);
+	}
+}
+
 // find a key; returns modulus if not found
 
-hashl::hash_offset_type hashl::find_offset(const key_type &key, const key_type &comp_key) const {
-	const base_type key_hash(key < comp_key ? key.hash() : comp_key.hash());
-	hash_offset_type i(key_hash % modulus);
+template<class K>
+hashl::hash_offset_type hashl::find_offset(const K &key, const K &comp_key) const {
+	return find_offset(key, comp_key, canonical_hash(key, comp_key));
+}
+
+template<class K>
+hashl::hash_offset_type hashl::find_offset(const K &key, const K &comp_key, const base_type key_hash) const {
+	const tag_type tag(key_tag(key_hash));
+	hash_offset_type i(probe.start(key_hash, modulus));
 	if (key_list[i] == invalid_key) {
 		return modulus;
-	} else if (key.equal_to(data, key_list[i]) || comp_key.equal_to(data, key_list[i])) {
+	} else if (tag_list[i] == tag && (key.equal_to(data, key_list[i]) || comp_key.equal_to(data, key_list[i]))) {
 		return i;
 	}
-	const hash_offset_type j(collision_modulus - key_hash % collision_modulus);
+	hash_offset_type j(probe.step(key_hash, collision_modulus));
 	for (;;) {	// search over all elements
-		i = (i + j) % modulus;
+		probe.next(i, j, modulus);
 		if (key_list[i] == invalid_key) {
 			return modulus;
-		} else if (key.equal_to(data, key_list[i]) || comp_key.equal_to(data, key_list[i])) {
+		} else if (tag_list[i] == tag && (key.equal_to(data, key_list[i]) || comp_key.equal_to(data, key_list[i]))) {
 			return i;
 		}
 	}
 }
 
-hashl::hash_offset_type hashl::find_offset(const key_type &key) const {
-	key_type comp_key(bit_width, word_width);
+template<class K>
+hashl::hash_offset_type hashl::find_offset(const K &key) const {
+	K comp_key(bit_width, word_width);
 	comp_key.make_complement(key);
 	return find_offset(key, comp_key);
 }
 
 // increment the count for a key (but don't create a new entry if it doesn't exist)
 
-void hashl::increment(const key_type &key, const key_type &comp_key) {
+template<class K>
+void hashl::increment(const K &key, const K &comp_key) {
 	const hash_offset_type i(find_offset(key, comp_key));
 	if (i == modulus) {	// couldn't find it
 		return;
@@ -146,7 +287,8 @@ void hashl::increment(const key_type &key, const key_type &comp_key) {
 	}
 }
 
-bool hashl::increment(const key_type &key, const key_type &comp_key, const size_type offset) {
+template<class K>
+bool hashl::increment(const K &key, const K &comp_key, const size_type offset) {
 	const hash_offset_type i(insert_offset(key, comp_key, offset));
 	if (i == modulus) {	// insert failed
 		return 0;
@@ -158,7 +300,8 @@ bool hashl::increment(const key_type &key, const key_type &comp_key, const size_
 }
 
 // insert key, but if it already exists, mark it as invalid
-bool hashl::insert_unique(const key_type &key, const key_type &comp_key, const size_type offset) {
+template<class K>
+bool hashl::insert_unique(const K &key, const K &comp_key, const size_type offset) {
 	const hash_offset_type i(insert_offset(key, comp_key, offset));
 	if (i == modulus) {	// insert failed
 		return 0;
@@ -171,7 +314,8 @@ bool hashl::insert_unique(const key_type &key, const key_type &comp_key, const s
 	return 1;
 }
 
-bool hashl::insert_invalid(const key_type &key, const key_type &comp_key, const size_type offset) {
+template<class K>
+bool hashl::insert_invalid(const K &key, const K &comp_key, const size_type offset) {
 	const hash_offset_type i(insert_offset(key, comp_key, offset));
 	if (i == modulus) {	// insert failed
 		return 0;
@@ -180,16 +324,56 @@ bool hashl::insert_invalid(const key_type &key, const key_type &comp_key, const
 	return 1;
 }
 
+// saturating increment; invalid_value is above max_small_value, so it stays put
+
+void hashl::increment_value_atomic(small_value_type &value) {
+	small_value_type x(__atomic_load_n(&value, __ATOMIC_RELAXED));
+	while (x < max_small_value && !__atomic_compare_exchange_n(&value, &x, x + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) { }
+}
+
+template<class K>
+bool hashl::increment_atomic(const K &key, const K &comp_key, const size_type offset) {
+	const hash_offset_type i(insert_offset_atomic(key, comp_key, offset));
+	if (i == modulus) {	// insert failed
+		return 0;
+	}
+	increment_value_atomic(value_list[i]);
+	return 1;
+}
+
+template<class K>
+bool hashl::insert_unique_atomic(const K &key, const K &comp_key, const size_type offset) {
+	const hash_offset_type i(insert_offset_atomic(key, comp_key, offset));
+	if (i == modulus) {	// insert failed
+		return 0;
+	}
+	small_value_type x(__atomic_load_n(&value_list[i], __ATOMIC_RELAXED));
+	while (x != invalid_value && !__atomic_compare_exchange_n(&value_list[i], &x, x ? static_cast<small_value_type>(invalid_value) : 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) { }
+	return 1;
+}
+
+template<class K>
+bool hashl::insert_invalid_atomic(const K &key, const K &comp_key, const size_type offset) {
+	const hash_offset_type i(insert_offset_atomic(key, comp_key, offset));
+	if (i == modulus) {	// insert failed
+		return 0;
+	}
+	__atomic_store_n(&value_list[i], invalid_value, __ATOMIC_RELAXED);
+	return 1;
+}
+
 // return the value associated with a key (or zero if key not found)
 
-hashl::small_value_type hashl::value(const key_type &key) const {
+template<class K>
+hashl::small_value_type hashl::value(const K &key) const {
 	const hash_offset_type i(find_offset(key));
 	return i < modulus ? value_list[i] : 0;
 }
 
 // same as above, but also return the data offset
 
-std::pair<hashl::size_type, hashl::small_value_type> hashl::entry(const key_type &key) const {
+template<class K>
+std::pair<hashl::size_type, hashl::small_value_type> hashl::entry(const K &key) const {
 	const hash_offset_type i(find_offset(key));
 	if (i < modulus) {
 		return std::make_pair(key_list[i], value_list[i]);
@@ -198,64 +382,255 @@ std::pair<hashl::size_type, hashl::small_value_type> hashl::entry(const key_type
 	}
 }
 
-void hashl::save(const int fd) const {
-	const std::string s(boilerplate());
-	pfwrite(fd, s.c_str(), s.size());
-	pfwrite(fd, &modulus, sizeof(modulus));
-	pfwrite(fd, &collision_modulus, sizeof(collision_modulus));
-	pfwrite(fd, &used_elements, sizeof(used_elements));
-	pfwrite(fd, &bit_width, sizeof(bit_width));
+// hash n (<= batch_size) keys into key_hashes, and prefetch the starting
+// slot of each; then, once those have (hopefully) arrived, prefetch the
+// sequence for any slot whose tag matches, as that'll be compared next;
+// key_list is read atomically in case other threads are inserting
+
+template<class K>
+void hashl::prefetch_batch(const K * const keys, const K * const comp_keys, const size_type n, base_type * const key_hashes) const {
+	hash_offset_type starts[batch_size];
+	for (size_type i(0); i < n; ++i) {
+		key_hashes[i] = canonical_hash(keys[i], comp_keys[i]);
+		starts[i] = probe.start(key_hashes[i], modulus);
+		__builtin_prefetch(&key_list[starts[i]]);
+		__builtin_prefetch(&tag_list[starts[i]]);
+		__builtin_prefetch(&value_list[starts[i]]);
+	}
+	for (size_type i(0); i < n; ++i) {
+		const size_type x(__atomic_load_n(&key_list[starts[i]], __ATOMIC_RELAXED));
+		if (x != invalid_key && tag_list[starts[i]] == key_tag(key_hashes[i])) {
+			__builtin_prefetch(&data[x / (sizeof(base_type) * 8)]);
+		}
+	}
+}
+
+template<class K>
+void hashl::increment_batch(const K * const keys, const K * const comp_keys, const size_type n) {
+	base_type key_hashes[batch_size];
+	for (size_type i(0); i < n; i += batch_size) {
+		const size_type m(n - i < batch_size ? n - i : static_cast<size_type>(batch_size));
+		prefetch_batch(keys + i, comp_keys + i, m, key_hashes);
+		for (size_type j(0); j < m; ++j) {
+			const hash_offset_type k(find_offset(keys[i + j], comp_keys[i + j], key_hashes[j]));
+			if (k != modulus && value_list[k] < max_small_value) {
+				++value_list[k];
+			}
+		}
+	}
+}
+
+// returns false if the hash filled up (keys before that were counted)
+
+template<class K>
+bool hashl::increment_batch(const K * const keys, const K * const comp_keys, const size_type * const offsets, const size_type n) {
+	base_type key_hashes[batch_size];
+	for (size_type i(0); i < n; i += batch_size) {
+		const size_type m(n - i < batch_size ? n - i : static_cast<size_type>(batch_size));
+		prefetch_batch(keys + i, comp_keys + i, m, key_hashes);
+		for (size_type j(0); j < m; ++j) {
+			const hash_offset_type k(insert_offset(keys[i + j], comp_keys[i + j], offsets[i + j], key_hashes[j]));
+			if (k == modulus) {	// insert failed
+				return 0;
+			} else if (value_list[k] < max_small_value) {
+				++value_list[k];
+			}
+		}
+	}
+	return 1;
+}
+
+template<class K>
+bool hashl::increment_atomic_batch(const K * const keys, const K * const comp_keys, const size_type * const offsets, const size_type n) {
+	base_type key_hashes[batch_size];
+	for (size_type i(0); i < n; i += batch_size) {
+		const size_type m(n - i < batch_size ? n - i : static_cast<size_type>(batch_size));
+		prefetch_batch(keys + i, comp_keys + i, m, key_hashes);
+		for (size_type j(0); j < m; ++j) {
+			const hash_offset_type k(insert_offset_atomic(keys[i + j], comp_keys[i + j], offsets[i + j], key_hashes[j]));
+			if (k == modulus) {	// insert failed
+				return 0;
+			}
+			increment_value_atomic(value_list[k]);
+		}
+	}
+	return 1;
+}
+
+template<class K>
+void hashl::find_batch(const K * const keys, const K * const comp_keys, const size_type n, std::pair<size_type, small_value_type> * const entries_out) const {
+	base_type key_hashes[batch_size];
+	for (size_type i(0); i < n; i += batch_size) {
+		const size_type m(n - i < batch_size ? n - i : static_cast<size_type>(batch_size));
+		prefetch_batch(keys + i, comp_keys + i, m, key_hashes);
+		for (size_type j(0); j < m; ++j) {
+			const hash_offset_type k(find_offset(keys[i + j], comp_keys[i + j], key_hashes[j]));
+			if (k < modulus) {
+				entries_out[i + j] = std::make_pair(key_list[k], value_list[k]);
+			} else {
+				entries_out[i + j] = std::make_pair(0, 0);
+			}
+		}
+	}
+}
+
+// instantiate the templated calls for the dynamic (Words == 0) and the
+// fixed width key types
+
+#define HASHL_KEY_CALLS(W) \
+	template hashl::hash_offset_type hashl::find_offset(const hashl_key_type<hashl::base_type, W> &) const; \
+	template hashl::hash_offset_type hashl::find_offset(const hashl_key_type<hashl::base_type, W> &, const hashl_key_type<hashl::base_type, W> &) const; \
+	template hashl::hash_offset_type hashl::insert_offset(const hashl_key_type<hashl::base_type, W> &, const hashl_key_type<hashl::base_type, W> &, hashl::size_type); \
+	template hashl::hash_offset_type hashl::insert_offset_atomic(const hashl_key_type<hashl::base_type, W> &, const hashl_key_type<hashl::base_type, W> &, hashl::size_type); \
+	template void hashl::increment(const hashl_key_type<hashl::base_type, W> &, const hashl_key_type<hashl::base_type, W> &); \
+	template bool hashl::increment(const hashl_key_type<hashl::base_type, W> &, const hashl_key_type<hashl::base_type, W> &, hashl::size_type); \
+	template bool hashl::insert_unique(const hashl_key_type<hashl::base_type, W> &, const hashl_key_type<hashl::base_type, W> &, hashl::size_type); \
+	template bool hashl::insert_invalid(const hashl_key_type<hashl::base_type, W> &, const hashl_key_type<hashl::base_type, W> &, hashl::size_type); \
+	template bool hashl::increment_atomic(const hashl_key_type<hashl::base_type, W> &, const hashl_key_type<hashl::base_type, W> &, hashl::size_type); \
+	template bool hashl::insert_unique_atomic(const hashl_key_type<hashl::base_type, W> &, const hashl_key_type<hashl::base_type, W> &, hashl::size_type); \
+	template bool hashl::insert_invalid_atomic(const hashl_key_type<hashl::base_type, W> &, const hashl_key_type<hashl::base_type, W> &, hashl::size_type); \
+	template hashl::small_value_type hashl::value(const hashl_key_type<hashl::base_type, W> &) const; \
+	template std::pair<hashl::size_type, hashl::small_value_type> hashl::entry(const hashl_key_type<hashl::base_type, W> &) const; \
+	template void hashl::increment_batch(const hashl_key_type<hashl::base_type, W> *, const hashl_key_type<hashl::base_type, W> *, hashl::size_type); \
+	template bool hashl::increment_batch(const hashl_key_type<hashl::base_type, W> *, const hashl_key_type<hashl::base_type, W> *, const hashl::size_type *, hashl::size_type); \
+	template bool hashl::increment_atomic_batch(const hashl_key_type<hashl::base_type, W> *, const hashl_key_type<hashl::base_type, W> *, const hashl::size_type *, hashl::size_type); \
+	template void hashl::find_batch(const hashl_key_type<hashl::base_type, W> *, const hashl_key_type<hashl::base_type, W> *, hashl::size_type, std::pair<hashl::size_type, hashl::small_value_type> *) const;
+
+HASHL_KEY_CALLS(0)
+HASHL_KEY_CALLS(1)
+HASHL_KEY_CALLS(2)
+HASHL_KEY_CALLS(3)
+
+#undef HASHL_KEY_CALLS
+
+void hashl::save(const int fd, const bool mappable) const {
+	pfwrite_buffer out(fd);
+	const std::string s(boilerplate(mappable ? mappable_file_version : file_version));
+	out.write(s.c_str(), s.size());
+	out.write(&modulus, sizeof(modulus));
+	out.write(&collision_modulus, sizeof(collision_modulus));
+	if (mappable) {		// only keys with non-zero values are kept
+		hash_offset_type x(0);
+		for (hash_offset_type i(0); i < modulus; ++i) {
+			if (value_list[i] && key_list[i] != invalid_key) {
+				++x;
+			}
+		}
+		out.write(&x, sizeof(x));
+	} else {
+		out.write(&used_elements, sizeof(used_elements));
+	}
+	out.write(&bit_width, sizeof(bit_width));
 	uint64_t tmp;
-	pfwrite(fd, &(tmp = metadata.size()), sizeof(tmp));
-	pfwrite(fd, &metadata[0], metadata.size());
-	pfwrite(fd, &(tmp = data.size()), sizeof(tmp));
-	pfwrite(fd, &data[0], sizeof(base_type) * data.size());
-	pfwrite(fd, &value_list[0], sizeof(small_value_type) * modulus);
+	out.write(&(tmp = metadata.size()), sizeof(tmp));
+	out.write(&metadata[0], metadata.size());
+	out.write(&(tmp = data.size()), sizeof(tmp));
+	if (mappable) {
+		save_arrays(out, s.size() + sizeof(modulus) + sizeof(collision_modulus) + sizeof(used_elements) + sizeof(bit_width) + 2 * sizeof(tmp) + metadata.size());
+		return;
+	}
+	out.write(&data[0], sizeof(base_type) * data.size());
+	out.write(&value_list[0], sizeof(small_value_type) * modulus);
 	for (hash_offset_type i(0); i < modulus; ++i) {
 		// have to remove keys with zero values as they don't get read in
 		if (value_list[i] && key_list[i] != invalid_key) {
-			pfwrite(fd, &key_list[i], sizeof(size_type));
+			out.write(&key_list[i], sizeof(size_type));
 		}
 	}
+	for (hash_offset_type i(0); i < modulus; ++i) {
+		if (value_list[i] && key_list[i] != invalid_key) {
+			out.write(&tag_list[i], sizeof(tag_type));
+		}
+	}
+}
+
+// the rest of a version 3 file: the four arrays, each padded to start on
+// a page boundary; file_offset is how much has been written so far
+
+void hashl::save_arrays(pfwrite_buffer &out, uint64_t file_offset) const {
+	const uint64_t alignment(sysconf(_SC_PAGE_SIZE));
+	out.write(&alignment, sizeof(alignment));
+	file_offset += sizeof(alignment);
+	const std::vector<char> zeros(alignment, 0);
+	uint64_t x(padding(file_offset, alignment));
+	out.write(&zeros[0], x);
+	out.write(&data[0], sizeof(base_type) * data.size());
+	file_offset += x + sizeof(base_type) * data.size();
+	// empty entries are written with zero values and invalid keys
+	const small_value_type zero(0);
+	out.write(&zeros[0], x = padding(file_offset, alignment));
+	for (hash_offset_type i(0); i < modulus; ++i) {
+		out.write(key_list[i] == invalid_key ? &zero : &value_list[i], sizeof(small_value_type));
+	}
+	file_offset += x + sizeof(small_value_type) * modulus;
+	const size_type no_key(invalid_key);
+	out.write(&zeros[0], x = padding(file_offset, alignment));
+	for (hash_offset_type i(0); i < modulus; ++i) {
+		out.write(value_list[i] ? &key_list[i] : &no_key, sizeof(size_type));
+	}
+	file_offset += x + sizeof(size_type) * modulus;
+	out.write(&zeros[0], padding(file_offset, alignment));
+	out.write(&tag_list[0], sizeof(tag_type) * modulus);
 }
 
-// regenerate key and values tables with new size - holds both new and
-// old key and value lists in memory while copying
+// regenerate key and values tables with new size; to keep the peak memory
+// down, the old entries are first packed into the front of key_list and
+// value_list and the rest of the old arrays given back, then the packed
+// entries are moved over a slice at a time, each slice being given back
+// once it's done, so the old table costs at most 9 bytes per used entry
+// (rather than 10 per slot) on top of the new one
 
 void hashl::resize(hash_offset_type size_asked) {
 	if (size_asked < used_elements) {
 		return;
 	}
-	const size_type old_modulus(modulus);
-	if (size_asked < 3) {	// to avoid collision_modulus == modulus
-		size_asked = 3;
-	}
-	modulus = next_prime(size_asked);
-	// collision_modulus just needs to be relatively prime with modulus;
-	// since modulus is prime, any value will do - I made it prime for fun
-	collision_modulus = next_prime(size_asked / 2);
-	// initialize keys and values (and save old ones)
-	std::vector<size_type> old_key_list(modulus, invalid_key);
-	key_list.swap(old_key_list);
-	std::vector<small_value_type> old_value_list(modulus, 0);
-	value_list.swap(old_value_list);
+	hash_offset_type old_size(modulus);
+	// a read only mapping can't be packed, but costs nothing to leave
+	if (key_list.writable() && value_list.writable()) {
+		old_size = 0;
+		for (hash_offset_type i(0); i < modulus; ++i) {
+			if (key_list[i] != invalid_key && value_list[i]) {
+				key_list[old_size] = key_list[i];
+				value_list[old_size] = value_list[i];
+				++old_size;
+			}
+		}
+		key_list.release(old_size, modulus);
+		value_list.release(old_size, modulus);
+	}
+	tag_list.clear();	// regenerated as entries are moved
+	hashl_vector<size_type> old_key_list;
+	old_key_list.swap(key_list);
+	hashl_vector<small_value_type> old_value_list;
+	old_value_list.swap(value_list);
+	probe.set_size(size_asked, modulus, collision_modulus);
+	key_list.assign(modulus, invalid_key);
+	value_list.assign(modulus, 0);
+	tag_list.assign(modulus, 0);
 	// copy over old hash keys and values
+	const hash_offset_type slice_size(old_size / 16 + 1);
 	key_type key(bit_width, word_width), comp_key(bit_width, word_width);
-	for (hash_offset_type i(0); i < old_modulus; ++i) {
-		if (old_key_list[i] != invalid_key && old_value_list[i]) {
-			key.copy_in(data, old_key_list[i]);
-			comp_key.make_complement(key);
-			const base_type key_hash(key < comp_key ? key.hash() : comp_key.hash());
-			hash_offset_type new_i(key_hash % modulus);
-			if (key_list[new_i] != invalid_key) {
-				const hash_offset_type j(collision_modulus - key_hash % collision_modulus);
-				do {
-					new_i = (new_i + j) % modulus;
-				} while (key_list[new_i] != invalid_key);
+	for (hash_offset_type slice_start(0); slice_start < old_size; slice_start += slice_size) {
+		const hash_offset_type slice_end(old_size - slice_start > slice_size ? slice_start + slice_size : old_size);
+		for (hash_offset_type i(slice_start); i < slice_end; ++i) {
+			if (old_key_list[i] != invalid_key && old_value_list[i]) {
+				key.copy_in(data, old_key_list[i]);
+				comp_key.make_complement(key);
+				const base_type key_hash(key < comp_key ? key.hash() : comp_key.hash());
+				hash_offset_type new_i(probe.start(key_hash, modulus));
+				if (key_list[new_i] != invalid_key) {
+					hash_offset_type j(probe.step(key_hash, collision_modulus));
+					do {
+						probe.next(new_i, j, modulus);
+					} while (key_list[new_i] != invalid_key);
+				}
+				key_list[new_i] = old_key_list[i];
+				value_list[new_i] = old_value_list[i];
+				tag_list[new_i] = key_tag(key_hash);
 			}
-			key_list[new_i] = old_key_list[i];
-			value_list[new_i] = old_value_list[i];
 		}
+		old_key_list.release(slice_start, slice_end);
+		old_value_list.release(slice_start, slice_end);
 	}
 }
 
@@ -287,7 +662,7 @@ bool hashl::add(const hashl &a, const small_value_type min_cutoff, const small_v
 	// TODO: see if shifting would actually slow things down much
 	//       and change metadata to remove padding there, as well
 	data.reserve(data.size() + a.data.size());
-	data.insert(data.end(), a.data.begin(), a.data.end());
+	data.append(a.data.begin(), a.data.end());
 	// loop over incoming hash and increment or invalidate entries as needed
 	key_type key(a.bits(), a.words()), comp_key(a.bits(), a.words());
 	for (size_type i(0); i < a.modulus; ++i) {
@@ -346,6 +721,7 @@ void hashl::print(const int flags) const {
 	if (flags & print_hash_header) {
 		std::cout << "modulus: " << modulus << "\n"
 			<< "collision modulus: " << collision_modulus << "\n"
+			<< "probe: " << hash_probe::name(probe.type()) << "\n"
 			<< "used elements: " << used_elements << "\n"
 			<< "bit width: " << bit_width << "\n"
 			<< "metadata size: " << metadata.size() << "\n"
@@ -459,7 +835,7 @@ void hashl::filtering_finish(const hashl::small_value_type min, const hashl::sma
 				}
 			}
 		}
-		value_list_backup = std::vector<small_value_type>();
+		value_list_backup.clear();
 		resize(2 * used_elements);
 	}
 }
@@ -473,7 +849,8 @@ void hashl::save_index(const int fd) {
 		}
 	}
 	// we no longer need the values, so free memory
-	value_list = std::vector<small_value_type>();
+	value_list.clear();
+	tag_list.clear();
 	// shift valid key_list entries to bottom of array
 	auto a = key_list.begin();
 	auto end_a = a + used_elements;
@@ -495,10 +872,10 @@ void hashl::save_index(const int fd) {
 	// sort key_list by *kmer* (not kmer position ;)
 	std::sort(key_list.begin(), key_list.end(), [this](const hash_offset_type __a, const hash_offset_type __b) {return hashl_less<hashl>()(*this, __a, __b);});
 	// save everything to an index
-	hashl_index::save(key_list, data, metadata, bit_width, fd);
+	hashl_index::save(key_list.begin(), key_list.size(), data.begin(), data.size(), metadata, bit_width, fd);
 	// finish resetting this to pre-initted state
-	key_list = std::vector<size_type>();
-	data = std::vector<base_type>();
+	key_list.clear();
+	data.clear();
 	metadata = std::vector<char>();
 	used_elements = 0;
 	modulus = 0;
@@ -1,8 +1,9 @@
 #include "hashl_index.h"
 #include "itoa.h"	// itoa()
 #include "local_endian.h"	// big_endian
-#include "open_compressed.h"	// pfread()
+#include "open_compressed.h"	// pfread(), skip_next_chars()
 #include "write_fork.h"	// pfwrite()
+#include <algorithm>	// lower_bound(), upper_bound()
 #include <errno.h>	// errno
 #include <fcntl.h>	// posix_fadvise(), POSIX_FADV_RANDOM
 #include <iomanip>	// setw()
@@ -10,14 +11,20 @@
 #include <stdlib.h>	// exit()
 #include <string.h>	// memcmp(), strerror()
 #include <string>	// string
-#include <sys/mman.h>	// mmap(), munmap(), MAP_FAILED, MAP_PRIVATE, PROT_READ
-#include <unistd.h>	// sysconf(), _SC_PAGE_SIZE
+#include <sys/mman.h>	// madvise(), MADV_RANDOM, MADV_SEQUENTIAL, mmap(), munmap(), MAP_FAILED, MAP_PRIVATE, PROT_READ
+#include <unistd.h>	// pread(), sysconf(), _SC_PAGE_SIZE
 #include <vector>	// vector<>
 
-// description beginning of saved file
+// description beginning of saved file; version 1 files have no version
+// number, and their data isn't page aligned, so it has to be read in
 
-std::string hashl_index::boilerplate() {
-	std::string s("hashl_index\n");
+std::string hashl_index::boilerplate(const int version) {
+	std::string s("hashl_index");
+	if (version > 1) {
+		s += ' ';
+		s += itoa(version);
+	}
+	s += "\n";
 	s += itoa(sizeof(base_type));
 	s += " bytes\n";
 #ifdef big_endian
@@ -29,29 +36,60 @@ std::string hashl_index::boilerplate() {
 }
 
 // need to initialize key_list up front to prep destructor
-hashl_index::hashl_index(const int fd) : key_list(0) {
-	const std::string s(boilerplate());
+hashl_index::hashl_index(const int fd) : key_list(0), prefix_bits(0), node_size(0) {
+	// the version 1 boilerplate is shorter, so check for it first
+	const std::string s(boilerplate()), s1(boilerplate(1));
 	char t[s.size()];
-	size_type key_list_offset = pfread(fd, t, s.size());
-	if (memcmp(t, s.c_str(), s.size()) != 0) {
-		std::cerr << "Error: could not read index from file: header mismatch\n";
-		exit(1);
+	size_type key_list_offset = pfread(fd, t, s1.size());
+	int version = 1;
+	if (memcmp(t, s1.c_str(), s1.size()) != 0) {
+		key_list_offset += pfread(fd, t + s1.size(), s.size() - s1.size());
+		if (memcmp(t, s.c_str(), s.size()) != 0) {
+			std::cerr << "Error: could not read index from file: header mismatch\n";
+			exit(1);
+		}
+		version = file_version;
 	}
 	key_list_offset += pfread(fd, &bit_width, sizeof(bit_width));
 	word_width = (bit_width + 8 * sizeof(base_type) - 1) / (8 * sizeof(base_type));
 	size_type metadata_size;
 	key_list_offset += pfread(fd, &metadata_size, sizeof(metadata_size));
-	metadata.assign(metadata_size, 0);
-	key_list_offset += pfread(fd, &metadata[0], metadata_size);
-	size_type data_size;
+	if (version == 1) {
+		metadata.assign(metadata_size, 0);
+		key_list_offset += pfread(fd, &metadata[0], metadata_size);
+	} else {
+		// metadata is used in place, so it can be mapped in like data
+		if (!metadata.map(fd, key_list_offset, metadata_size, 0)) {
+			std::cerr << "Error: mmap(" << errno << "): " << std::string(strerror(errno)) << '\n';
+			exit(1);
+		}
+		key_list_offset += skip_next_chars(fd, metadata_size);
+	}
+	size_type data_size, key_list_padding = 0, padding_size;
 	key_list_offset += pfread(fd, &data_size, sizeof(data_size));
-	data.assign(data_size, 0);
-	key_list_offset += pfread(fd, &data[0], sizeof(base_type) * data_size);
+	if (version == 1) {
+		data.resize(data_size);
+		key_list_offset += pfread(fd, &data[0], sizeof(base_type) * data_size);
+	}
 	key_list_offset += pfread(fd, &key_list_size, sizeof(key_list_size));
-	size_type padding_size;
+	if (version != 1) {
+		key_list_offset += pfread(fd, &key_list_padding, sizeof(key_list_padding));
+	}
 	key_list_offset += pfread(fd, &padding_size, sizeof(padding_size));
-	// we don't have to actually read in the padding ;)
+	read_tables(fd, key_list_offset, padding_size);
+	// we don't have to actually read in the rest of the padding ;)
 	key_list_offset += padding_size;
+	// inform system we'll be accessing randomly, so don't be clever about reading ahead;
+	// this is only advisory anyway, so don't worry about it failing
+	posix_fadvise(fd, key_list_offset, 0, POSIX_FADV_RANDOM);
+	if (version != 1) {
+		// data is page aligned, so it can be mapped in as well
+		if (!data.map(fd, key_list_offset, data_size, 0)) {
+			std::cerr << "Error: mmap(" << errno << "): " << std::string(strerror(errno)) << '\n';
+			exit(1);
+		}
+		key_list_offset += sizeof(base_type) * data_size + key_list_padding;
+	}
 	// key_list needs to start on a page boundary, and as created it will, but if
 	// it's read on a machine with a different page size we might need to offset
 	page_offset = key_list_offset % sysconf(_SC_PAGE_SIZE);
@@ -61,9 +99,6 @@ hashl_index::hashl_index(const int fd) : key_list(0) {
 		std::cerr << "Error: could not align to start of key_list: " << page_offset << " not a multiple of " << sizeof(size_type) << '\n';
 		exit(1);
 	}
-	// inform system we'll be accessing randomly, so don't be clever about reading ahead;
-	// this is only advisory anyway, so don't worry about it failing
-	posix_fadvise(fd, key_list_offset, 0, POSIX_FADV_RANDOM);
 	key_list = static_cast<const size_type *>(mmap(0, key_list_size * sizeof(size_type) + page_offset, PROT_READ, MAP_PRIVATE, fd, key_list_offset - page_offset));
 	if (key_list == MAP_FAILED) {
 		std::cerr << "Error: mmap(" << errno << "): " << std::string(strerror(errno)) << '\n';
@@ -73,6 +108,56 @@ hashl_index::hashl_index(const int fd) : key_list(0) {
 	key_list += page_offset / sizeof(size_type);
 }
 
+// the padding before data (or before key_list, for version 1 files) starts
+// with the prefix table and node keys, if any (files without them have all
+// zero padding, or none at all); they start on a size_type boundary, so
+// they're mapped in rather than read, and the words around them are read
+// with pread(), so fd never has to be read through them
+
+void hashl_index::read_tables(const int fd, const size_type offset, const size_type padding_size) {
+	size_type padding_read = (sizeof(size_type) - offset % sizeof(size_type)) % sizeof(size_type);
+	if (padding_size >= padding_read + sizeof(prefix_bits)) {
+		read_word(fd, offset + padding_read, prefix_bits);
+		padding_read += sizeof(prefix_bits);
+		if (prefix_bits) {
+			const size_type n = (size_type(1) << prefix_bits) + 1;
+			if (padding_read + sizeof(size_type) * n > padding_size) {
+				std::cerr << "Error: could not read index from file: prefix table too large\n";
+				exit(1);
+			}
+			if (!prefix_table.map(fd, offset + padding_read, n, 0)) {
+				std::cerr << "Error: mmap(" << errno << "): " << std::string(strerror(errno)) << '\n';
+				exit(1);
+			}
+			padding_read += sizeof(size_type) * n;
+		}
+	}
+	if (padding_size >= padding_read + sizeof(node_size)) {
+		read_word(fd, offset + padding_read, node_size);
+		padding_read += sizeof(node_size);
+		if (node_size) {
+			const size_type n = (key_list_size + node_size - 1) / node_size;
+			if (padding_read + sizeof(base_type) * n > padding_size) {
+				std::cerr << "Error: could not read index from file: node keys too large\n";
+				exit(1);
+			}
+			if (!node_keys.map(fd, offset + padding_read, n, 0)) {
+				std::cerr << "Error: mmap(" << errno << "): " << std::string(strerror(errno)) << '\n';
+				exit(1);
+			}
+		}
+	}
+}
+
+// read a size_type from the given offset of fd, leaving its position alone
+
+void hashl_index::read_word(const int fd, const size_type offset, size_type &x) {
+	if (pread(fd, &x, sizeof(x), offset) != sizeof(x)) {
+		std::cerr << "Error: could not read index from file: short read\n";
+		exit(1);
+	}
+}
+
 hashl_index::~hashl_index() {
 	if (key_list) {
 		// yay for munmap not allowing a pointer to a const type
@@ -87,26 +172,85 @@ hashl_index::~hashl_index() {
 
 // returns -1 if kmer is not found
 
+hashl_index::size_type hashl_index::position(const key_type &key) const {
+	const size_type x = search(key);
+	if (x != size_type(-1)) {
+		return x;
+	}
+	// and now check the reverse complement
+	key_type comp_key(bit_width, word_width);
+	comp_key.make_complement(key);
+	return search(comp_key);
+}
+
+// first bits (at most one word's worth) of the kmer at the given (bit)
+// offset into data
+
+hashl_index::size_type hashl_index::data_prefix(const base_type * const data_in, const size_type offset, const size_type bits) {
+	const size_type word_bits = sizeof(base_type) * 8;
+	const size_type i = offset / word_bits;
+	const size_type bit_offset = offset % word_bits;
+	base_type x = data_in[i] << bit_offset;
+	if (bit_offset + bits > word_bits) {
+		x |= data_in[i + 1] >> (word_bits - bit_offset);
+	}
+	return x >> (word_bits - bits);
+}
+
+// first prefix_bits of key
+
+hashl_index::size_type hashl_index::key_prefix(const key_type &key) const {
+	size_type x = 0;
+	for (size_type i = 0; i < prefix_bits; i += 2) {
+		x = (x << 2) | key.basepair(bit_width - 2 - i);
+	}
+	return x;
+}
+
+// returns data offset of key (just key, not the reverse complement), or -1
+
 // note: might be faster with a tri-value comparison (-1, 0, 1)?
 
-hashl_index::size_type hashl_index::position(const key_type &key) const {
-	// do a binary search, comparing key to kmers at data offsets given by array values
+hashl_index::size_type hashl_index::search(const key_type &key) const {
 	size_type i = 0, j = key_list_size;
+	if (prefix_bits) {
+		const size_type x = key_prefix(key);
+		i = prefix_table[x];
+		j = prefix_table[x + 1];
+	}
+	// narrow the range down to the pages the key could be on: after the
+	// start of the last page with a lower first word, and before the start
+	// of the first page with a higher one
+	if (node_size && j - i > node_size) {
+		const base_type x = key.value()[0];
+		const size_type a = i / node_size + 1, b = (j - 1) / node_size + 1;
+		const size_type high = std::upper_bound(node_keys.begin() + a, node_keys.begin() + b, x) - node_keys.begin();
+		const size_type low = std::lower_bound(node_keys.begin() + a, node_keys.begin() + high, x) - node_keys.begin() - 1;
+		if (i < low * node_size) {
+			i = low * node_size;
+		}
+		if (j > high * node_size) {
+			j = high * node_size;
+		}
+	}
+	if (i == j) {
+		return -1;
+	}
+	// do a binary search, comparing key to kmers at data offsets given by array values
 	while (i + 1 < j) {
 		const size_type m = (i + j) / 2;
 		(key.less_than(data, key_list[m]) ? j : i) = m;
 	}
-	if (key.equal_to(data, key_list[i])) {
-		return key_list[i];
-	}
-	// and now check the reverse complement
-	key_type comp_key(bit_width, word_width);
-	comp_key.make_complement(key);
-	for (i = 0, j = key_list_size; i + 1 < j;) {
-		const size_type m = (i + j) / 2;
-		(comp_key.less_than(data, key_list[m]) ? j : i) = m;
+	return key.equal_to(data, key_list[i]) ? key_list[i] : -1;
+}
+
+// tell the system whether the next accesses of key_list will be in
+// order (so it should read ahead), or back to random
+
+void hashl_index::sequential_access(const bool sequential) const {
+	if (key_list_size) {
+		madvise(const_cast<size_type *>(key_list - page_offset / sizeof(size_type)), key_list_size * sizeof(size_type) + page_offset, sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
 	}
-	return comp_key.equal_to(data, key_list[i]) ? key_list[i] : -1;
 }
 
 void hashl_index::get_sequence(const size_type start, const size_type length, std::string &seq) const {
@@ -143,22 +287,73 @@ void hashl_index::print() const {
 	}
 }
 
-void hashl_index::save(const std::vector<size_type> &key_list_in, const std::vector<base_type> &data_in, const std::vector<char> &metadata_in, const size_type bit_width_in, const int fd) {
+void hashl_index::save(const size_type * const key_list_in, const size_type key_list_size_in, const base_type * const data_in, const size_type data_size_in, const std::vector<char> &metadata_in, const size_type bit_width_in, const int fd) {
 	const std::string s(boilerplate());
 	size_type written = pfwrite(fd, s.c_str(), s.size());
 	written += pfwrite(fd, &bit_width_in, sizeof(bit_width_in));
 	size_type tmp;
 	written += pfwrite(fd, &(tmp = metadata_in.size()), sizeof(tmp));
 	written += pfwrite(fd, &metadata_in[0], metadata_in.size());
-	written += pfwrite(fd, &(tmp = data_in.size()), sizeof(tmp));
-	written += pfwrite(fd, &data_in[0], sizeof(base_type) * data_in.size());
-	written += pfwrite(fd, &(tmp = key_list_in.size()), sizeof(tmp));
-	// now page align the start of key_list
-	written += sizeof(tmp);
-	// calculate amount of padding we need
-	tmp = (sysconf(_SC_PAGE_SIZE) - written % sysconf(_SC_PAGE_SIZE)) % sysconf(_SC_PAGE_SIZE);
-	pfwrite(fd, &tmp, sizeof(tmp));
-	char buf[tmp] = {0};
-	pfwrite(fd, buf, tmp);
-	pfwrite(fd, &key_list_in[0], sizeof(size_type) * key_list_in.size());
+	written += pfwrite(fd, &(tmp = data_size_in), sizeof(tmp));
+	written += pfwrite(fd, &(tmp = key_list_size_in), sizeof(tmp));
+	// pick a prefix length that averages at least 16 kmers per prefix,
+	// up to 12 basepairs (a 128 MB table)
+	size_type bits = 0;
+	while (bits < 24 && bits + 2 < bit_width_in && (size_type(16) << (bits + 2)) <= key_list_size_in) {
+		bits += 2;
+	}
+	// table[x] = number of kmers with a prefix < x (key_list is sorted)
+	std::vector<size_type> table;
+	if (bits) {
+		table.assign((size_type(1) << bits) + 1, 0);
+		for (size_type i = 0; i < key_list_size_in; ++i) {
+			++table[data_prefix(data_in, key_list_in[i], bits) + 1];
+		}
+		for (size_type i = 1; i < table.size(); ++i) {
+			table[i] += table[i - 1];
+		}
+	}
+	// first word of the first kmer on each page of key_list
+	const size_type node_size = sysconf(_SC_PAGE_SIZE) / sizeof(size_type);
+	std::vector<base_type> node_keys;
+	if (key_list_size_in > node_size) {
+		const size_type high_bits = (bit_width_in - 1) % (sizeof(base_type) * 8) + 1;
+		node_keys.reserve((key_list_size_in + node_size - 1) / node_size);
+		for (size_type i = 0; i < key_list_size_in; i += node_size) {
+			node_keys.push_back(data_prefix(data_in, key_list_in[i], high_bits));
+		}
+	}
+	// the prefix table and node keys go at the start of the padding
+	// before data, from the first size_type boundary on, so they can be
+	// mapped in
+	const size_type table_offset = (sizeof(size_type) - (written + 2 * sizeof(tmp)) % sizeof(size_type)) % sizeof(size_type);
+	size_type table_size = 0;
+	if (bits || !node_keys.empty()) {
+		table_size += table_offset + sizeof(bits) + sizeof(size_type) * table.size();
+		table_size += sizeof(node_size) + sizeof(base_type) * node_keys.size();
+	}
+	// now page align the start of data and of key_list
+	const size_type page_size = sysconf(_SC_PAGE_SIZE);
+	written += 2 * sizeof(tmp) + table_size;
+	const size_type padding_size = (page_size - written % page_size) % page_size;
+	written += padding_size + sizeof(base_type) * data_size_in;
+	const size_type key_list_padding = (page_size - written % page_size) % page_size;
+	pfwrite(fd, &(tmp = key_list_padding), sizeof(tmp));
+	pfwrite(fd, &(tmp = table_size + padding_size), sizeof(tmp));
+	const std::vector<char> zeros(page_size, 0);
+	if (table_size) {
+		pfwrite(fd, &zeros[0], table_offset);
+		pfwrite(fd, &bits, sizeof(bits));
+		if (bits) {
+			pfwrite(fd, &table[0], sizeof(size_type) * table.size());
+		}
+		pfwrite(fd, &(tmp = node_keys.empty() ? 0 : node_size), sizeof(tmp));
+		if (!node_keys.empty()) {
+			pfwrite(fd, &node_keys[0], sizeof(base_type) * node_keys.size());
+		}
+	}
+	pfwrite(fd, &zeros[0], padding_size);
+	pfwrite(fd, data_in, sizeof(base_type) * data_size_in);
+	pfwrite(fd, &zeros[0], key_list_padding);
+	pfwrite(fd, key_list_in, sizeof(size_type) * key_list_size_in);
 }
@@ -1,8 +1,6 @@
 #include "hashl.h"	// hashl
 #include "hashl_metadata.h"
-#include "open_compressed.h"	// close_compressed(), open_compressed(), pfgets()
 #include <iostream>	// cerr, cout
-#include <map>		// map<>
 #include <stdlib.h>	// exit()
 #include <string.h>	// memcpy()
 #include <string>	// string
@@ -44,91 +42,106 @@ static hashl::base_type convert_char(const char c) {
 	}
 }
 
-void hashl_metadata::get_subreads(const std::string &seq, const std::vector<std::pair<size_type, size_type> > &ranges) {
-	for (const auto &a : ranges) {
-		for (size_type i = a.first; i < a.second; ++i) {
-			if (bit_offset) {
-				bit_offset -= 2;
-				data[byte_offset] |= convert_char(seq[i]) << bit_offset;
-			} else {
-				bit_offset = sizeof(hashl::base_type) * 8 - 2;
-				data[++byte_offset] = convert_char(seq[i]) << bit_offset;
-			}
+// sequence is packed in as it's read in, so each input is only read once
+// (and can be a pipe); it goes into a list of chunks, rather than one
+// growing array, so the final copy into a single array only needs one
+// chunk of extra space
+
+void hashl_metadata::start_data() {
+	std::vector<std::vector<hashl::base_type> >().swap(full_chunks);
+	data.assign(1024, 0);
+	byte_offset = 0;
+	bit_offset = sizeof(hashl::base_type) * 8;
+}
+
+// move on to the next (empty) word of data
+
+void hashl_metadata::next_word() {
+	bit_offset = sizeof(hashl::base_type) * 8;
+	if (++byte_offset == data.size()) {
+		// next chunk is the size of everything so far, up to 64 MB
+		size_type n = 0;
+		for (const auto &a : full_chunks) {
+			n += a.size();
 		}
+		n += data.size();
+		full_chunks.push_back(std::vector<hashl::base_type>());
+		full_chunks.back().swap(data);
+		data.assign(n < (1 << 23) ? n : (1 << 23), 0);
+		byte_offset = 0;
 	}
 }
 
-void hashl_metadata::read_file(const size_type i) {
-	const int fd = open_compressed(files[i]);
-	if (fd == -1) {
-		std::cerr << "Error: open: " << files[i] << "\n";
-		exit(1);
+// add the top n bits of x (n > 0) to data
+
+void hashl_metadata::append_bits(const hashl::base_type x, const int n) {
+	if (!bit_offset) {
+		next_word();
 	}
-	size_type j = 0;	// which read we're on (but only incremented for reads we use)
-	std::string line, seq;
-	if (pfgets(fd, line) == -1) {		// empty file
-		std::cerr << "Error: File is empty: " << files[i] << "\n";
-		exit(1);
-	} else if (line[0] == '>') {		// fasta file
-		std::string header;
-		do {
-			const std::string &read_name(reads[i][j]);
-			if (!read_name.compare(0, read_name.size(), line, 1, read_name.size()) && (line.size() == read_name.size() + 1 || isspace(line[read_name.size() + 1]))) {
-				seq.clear();
-				while (pfgets(fd, line) != -1 && line[0] != '>') {
-					seq += line;
-				}
-				get_subreads(seq, read_ranges[i][j]);
-				++j;
-			} else {
-				while (pfgets(fd, line) != -1 && line[0] != '>') { }
-			}
-		} while (j < reads[i].size() && line[0] == '>');
-	} else if (line[0] == '@') {		// fastq file
-		do {
-			if (pfgets(fd, seq) == -1) {		// sequence
-				std::cerr << "Error: truncated fastq file: " << files[i] << "\n";
-				exit(1);
-			}
-			const std::string &read_name(reads[i][j]);
-			if (!read_name.compare(0, read_name.size(), line, 1, read_name.size()) && (line.size() == read_name.size() + 1 || isspace(line[read_name.size() + 1]))) {
-				get_subreads(seq, read_ranges[i][j]);
-				++j;
-			}
-			// skip quality header and quality
-			// (use seq because it'll be the same length as quality)
-			if (pfgets(fd, line) == -1 || pfgets(fd, seq) == -1) {
-				std::cerr << "Error: truncated fastq file: " << files[i] << "\n";
-				exit(1);
+	const int word_bits = sizeof(hashl::base_type) * 8;
+	data[byte_offset] |= x >> (word_bits - bit_offset);
+	if (n <= bit_offset) {
+		bit_offset -= n;
+	} else {		// spills into the next word
+		const int spill = n - bit_offset;
+		const hashl::base_type rest = x << bit_offset;
+		next_word();
+		data[byte_offset] = rest;
+		bit_offset -= spill;
+	}
+}
+
+// pack the ranges of the most recently added read; seq is the whole read
+
+void hashl_metadata::add_read_data(const std::string &seq) {
+	for (const auto &a : read_ranges.back().back()) {
+		for (size_type i = a.first; i < a.second; ++i) {
+			if (!bit_offset) {
+				next_word();
 			}
-		} while (j < reads[i].size() && pfgets(fd, line) != -1);
-	} else {
-		std::cerr << "Error: unknown file format: " << files[i] << "\n";
-		exit(1);
+			bit_offset -= 2;
+			data[byte_offset] |= convert_char(seq[i]) << bit_offset;
+		}
 	}
-	if (j < reads[i].size()) {
-		std::cerr << "Error: File is shorter than before: " << files[i] << "\n";
-		exit(1);
+}
+
+void hashl_metadata::finish_data(std::vector<hashl::base_type> &data_out) {
+	const size_type last_size = byte_offset + (bit_offset != sizeof(hashl::base_type) * 8 ? 1 : 0);
+	size_type data_size = last_size;
+	for (const auto &a : full_chunks) {
+		data_size += a.size();
 	}
-	close_compressed(fd);
+	data_out.clear();
+	data_out.reserve(data_size);
+	for (auto &a : full_chunks) {
+		data_out.insert(data_out.end(), a.begin(), a.end());
+		std::vector<hashl::base_type>().swap(a);
+	}
+	data_out.insert(data_out.end(), data.begin(), data.begin() + last_size);
+	std::vector<std::vector<hashl::base_type> >().swap(full_chunks);
+	std::vector<hashl::base_type>().swap(data);
 }
 
-// mostly const - only the convenience variables get modified
+// add metadata and packed sequence from another hashl_metadata (which must
+// have had start_data() called) to ours; a's sequence is freed as it's copied
 
-void hashl_metadata::read_data(std::vector<hashl::base_type> &data_out, const bool feedback) {
-	// convert size from basepairs to length of hashl::base_type array
-	const size_type data_size = (2 * sequence_length() + sizeof(hashl::base_type) * 8 - 1) / (sizeof(hashl::base_type) * 8);
-	data.assign(data_size, 0);
-	byte_offset = 0;
-	bit_offset = sizeof(hashl::base_type) * 8;
-	for (size_type i = 0; i < files.size(); ++i) {
-		if (feedback) {
-			std::cerr << time(0) << ": Reading in " << files[i] << "\n";
+void hashl_metadata::add_data(hashl_metadata &a) {
+	const int word_bits = sizeof(hashl::base_type) * 8;
+	for (auto &b : a.full_chunks) {
+		for (const auto x : b) {
+			append_bits(x, word_bits);
 		}
-		read_file(i);
+		std::vector<hashl::base_type>().swap(b);
+	}
+	for (size_type i = 0; i < a.byte_offset; ++i) {
+		append_bits(a.data[i], word_bits);
 	}
-	data_out.swap(data);
-	data = std::vector<hashl::base_type>();		// just in case data_out wasn't empty
+	if (a.bit_offset != word_bits) {
+		append_bits(a.data[a.byte_offset], word_bits - a.bit_offset);
+	}
+	std::vector<std::vector<hashl::base_type> >().swap(a.full_chunks);
+	std::vector<hashl::base_type>().swap(a.data);
+	add(a);
 }
 
 std::pair<hashl_metadata::size_type, hashl_metadata::size_type> hashl_metadata::total_reads() const {
@@ -211,49 +224,126 @@ void hashl_metadata::finalize_file() {
 	}
 }
 
+// the blob is laid out so it can be used in place (see hashl_metadata_view):
+//	indexed_layout, file count, read count, range count
+//	index of the first read of each file, plus the read count
+//	index of the first range of each read, plus the range count
+//	start and end of each range
+//	offset of each file name, then of each read name, in the names
+//	the names, null terminated
+// all but the names are size_type words; read and range indices run over
+// all files
+
 void hashl_metadata::pack(std::vector<char> &d) const {
 	// count space needed
-	size_type metadata_size = sizeof(size_type);			// number of files
+	const std::pair<size_type, size_type> counts = total_reads();
+	size_type names_size = 0;
 	for (size_type i = 0; i < files.size(); ++i) {
-		metadata_size += files[i].size() + 1;			// file name and null
-		metadata_size += sizeof(size_type);			// number of reads
+		names_size += files[i].size() + 1;
 		for (size_type j = 0; j < reads[i].size(); ++j) {
-			metadata_size += reads[i][j].size() + 1;	// read name and null
-			metadata_size += sizeof(size_type);		// number of ranges
-			metadata_size += read_ranges[i][j].size() * sizeof(size_type) * 2;
+			names_size += reads[i][j].size() + 1;
 		}
 	}
+	const size_type words = 4 + (files.size() + 1) + (counts.first + 1) + 2 * counts.second + files.size() + counts.first;
 	// allocate space
-	d.assign(metadata_size, 0);
+	d.assign(words * sizeof(size_type) + names_size, 0);
 	// fill space with metadata
-	size_type offset = 0, tmp;
-	memcpy(&d[offset], &(tmp = files.size()), sizeof(tmp));
-	offset += sizeof(tmp);
+	size_type offset = 0;
+	auto put = [&d, &offset](const size_type x) {
+		memcpy(&d[offset], &x, sizeof(x));
+		offset += sizeof(x);
+	};
+	put(indexed_layout);
+	put(files.size());
+	put(counts.first);
+	put(counts.second);
+	size_type x = 0;
 	for (size_type i = 0; i < files.size(); ++i) {
-		memcpy(&d[offset], files[i].c_str(), files[i].size() + 1);
-		offset += files[i].size() + 1;
-		memcpy(&d[offset], &(tmp = reads[i].size()), sizeof(tmp));
-		offset += sizeof(tmp);
-		for (size_type j = 0; j < reads[i].size(); ++j) {
-			memcpy(&d[offset], reads[i][j].c_str(), reads[i][j].size() + 1);
-			offset += reads[i][j].size() + 1;
-			memcpy(&d[offset], &(tmp = read_ranges[i][j].size()), sizeof(tmp));
-			offset += sizeof(tmp);
-			for (size_type k = 0; k < read_ranges[i][j].size(); ++k) {
-				memcpy(&d[offset], &read_ranges[i][j][k].first, sizeof(size_type));
-				offset += sizeof(size_type);
-				memcpy(&d[offset], &read_ranges[i][j][k].second, sizeof(size_type));
-				offset += sizeof(size_type);
+		put(x);
+		x += reads[i].size();
+	}
+	put(x);
+	x = 0;
+	for (const auto &a : read_ranges) {
+		for (const auto &b : a) {
+			put(x);
+			x += b.size();
+		}
+	}
+	put(x);
+	for (const auto &a : read_ranges) {
+		for (const auto &b : a) {
+			for (const auto &c : b) {
+				put(c.first);
+				put(c.second);
+			}
+		}
+	}
+	x = 0;
+	for (const auto &a : files) {
+		put(x);
+		x += a.size() + 1;
+	}
+	for (const auto &a : reads) {
+		for (const auto &b : a) {
+			put(x);
+			x += b.size() + 1;
+		}
+	}
+	for (const auto &a : files) {
+		memcpy(&d[offset], a.c_str(), a.size() + 1);
+		offset += a.size() + 1;
+	}
+	for (const auto &a : reads) {
+		for (const auto &b : a) {
+			memcpy(&d[offset], b.c_str(), b.size() + 1);
+			offset += b.size() + 1;
+		}
+	}
+}
+
+void hashl_metadata::unpack(const char * const d, const size_type size) {
+	size_type layout = 0;
+	if (size >= sizeof(layout)) {
+		memcpy(&layout, d, sizeof(layout));
+	}
+	if (layout != indexed_layout) {
+		unpack_nested(d, size);
+		return;
+	}
+	const hashl_metadata_view md(d, size);
+	files.clear();
+	files.reserve(md.file_count());
+	reads.assign(md.file_count(), std::vector<std::string>());
+	read_ranges.assign(md.file_count(), std::vector<std::vector<std::pair<size_type, size_type> > >());
+	for (size_type i = 0; i < md.file_count(); ++i) {
+		files.push_back(md.file(i));
+		reads[i].reserve(md.read_count(i));
+		read_ranges[i].assign(md.read_count(i), std::vector<std::pair<size_type, size_type> >());
+		for (size_type j = 0; j < md.read_count(i); ++j) {
+			reads[i].push_back(md.read(i, j));
+			read_ranges[i][j].reserve(md.range_count(i, j));
+			for (size_type k = 0; k < md.range_count(i, j); ++k) {
+				read_ranges[i][j].push_back(md.range(i, j, k));
 			}
 		}
 	}
 }
 
-void hashl_metadata::unpack(const std::vector<char> &d) {
+// older blobs nest everything by file, then read:
+//	file count, then for each file: name, read count, then for each read:
+//	name, range count, and start and end of each range
+
+void hashl_metadata::unpack_nested(const char * const d, const size_type size) {
+	files.clear();
+	reads.clear();
+	read_ranges.clear();
+	if (size == 0) {
+		return;
+	}
 	size_type offset = 0, file_count;
 	memcpy(&file_count, &d[offset], sizeof(file_count));
 	offset += sizeof(file_count);
-	files.clear();
 	files.reserve(file_count);
 	reads.assign(file_count, std::vector<std::string>());
 	read_ranges.assign(file_count, std::vector<std::vector<std::pair<size_type, size_type> > >());
@@ -282,40 +372,76 @@ void hashl_metadata::unpack(const std::vector<char> &d) {
 			}
 		}
 	}
-	if (d.size() != offset) {
-		std::cerr << "Error: metadata size mismatch: " << d.size() << " != " << offset << "\n";
+	if (size != offset) {
+		std::cerr << "Error: metadata size mismatch: " << size << " != " << offset << "\n";
 		exit(1);
 	}
 }
 
-void hashl_metadata::print() const {
-	for (size_type i = 0; i < files.size(); ++i) {
-		std::cout << files[i].c_str() << "\n";
-		for (size_type j = 0; j < reads[i].size(); ++j) {
-			std::cout << "\t" << reads[i][j].c_str() << "\n";
-			for (size_type k = 0; k < read_ranges[i][j].size(); ++k) {
-				std::cout << "\t\t" << read_ranges[i][j][k].first << ' ' << read_ranges[i][j][k].second << "\n";
+hashl_metadata_view::hashl_metadata_view(const char * const d, size_type size) : blob(d), files(0), reads(0), ranges(0), file_reads_at(0), read_ranges_at(0), ranges_at(0), file_names_at(0), read_names_at(0), names(0) {
+	if (size == 0) {
+		return;
+	}
+	if (size < sizeof(size_type) || word(0) != hashl_metadata::indexed_layout) {
+		hashl_metadata md;
+		md.unpack(d, size);
+		md.pack(converted);
+		blob = &converted[0];
+		size = converted.size();
+	}
+	if (size < 4 * sizeof(size_type)) {
+		std::cerr << "Error: metadata size mismatch: " << size << " < " << 4 * sizeof(size_type) << "\n";
+		exit(1);
+	}
+	files = word(1);
+	reads = word(2);
+	ranges = word(3);
+	file_reads_at = 4;
+	read_ranges_at = file_reads_at + files + 1;
+	ranges_at = read_ranges_at + reads + 1;
+	file_names_at = ranges_at + 2 * ranges;
+	read_names_at = file_names_at + files;
+	const size_type names_offset = (read_names_at + reads) * sizeof(size_type);
+	if (size < names_offset || (files && blob[size - 1] != 0)) {
+		std::cerr << "Error: metadata size mismatch: " << size << " < " << names_offset << "\n";
+		exit(1);
+	}
+	names = blob + names_offset;
+}
+
+void hashl_metadata_view::print() const {
+	for (size_type i = 0; i < files; ++i) {
+		std::cout << file(i) << "\n";
+		for (size_type j = 0; j < read_count(i); ++j) {
+			std::cout << "\t" << read(i, j) << "\n";
+			for (size_type k = 0; k < range_count(i, j); ++k) {
+				const std::pair<size_type, size_type> x = range(i, j, k);
+				std::cout << "\t\t" << x.first << ' ' << x.second << "\n";
 			}
 		}
 	}
 }
 
-// create a map allowing translation of a data position to a file/read/read_start triplet
-void hashl_metadata::create_lookup_map(std::map<size_type, hashl_metadata::position> &lookup) const {
-	lookup.clear();
-	size_type offset = 0;
-	position x;
-	for (x.file = 0; x.file < read_ranges.size(); ++x.file) {
-		const std::vector<std::vector<std::pair<size_type, size_type> > > &read_list = read_ranges[x.file];
-		for (x.read = 0; x.read < read_list.size(); ++x.read) {
-			const std::vector<std::pair<size_type, size_type> > &range_list = read_list[x.read];
-			for (size_type k = 0; k < range_list.size(); ++k) {
-				x.read_start = range_list[k].first;
-				lookup[offset] = x;
-				offset += range_list[k].second - range_list[k].first;
+// create a list allowing translation of a data position to a file/read/read_start triplet
+void hashl_metadata_view::create_position_list(hashl_metadata::position_list &lookup) const {
+	lookup.starts.clear();
+	lookup.starts.reserve(ranges + 1);
+	lookup.positions.clear();
+	lookup.positions.reserve(ranges);
+	size_type offset = 0, k = 0;
+	hashl_metadata::position x;
+	for (x.file = 0; x.file < files; ++x.file) {
+		const size_type r = first_read(x.file);
+		for (x.read = 0; x.read < read_count(x.file); ++x.read) {
+			for (const size_type end = first_range(r + x.read + 1); k < end; ++k) {
+				x.read_start = word(ranges_at + 2 * k);
+				lookup.starts.push_back(offset);
+				lookup.positions.push_back(x);
+				offset += word(ranges_at + 2 * k + 1) - x.read_start;
 			}
 		}
 	}
+	lookup.starts.push_back(offset);
 }
 
 // update read_ranges to just the subset included in kept_offsets
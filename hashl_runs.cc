@@ -0,0 +1,252 @@
+#include "hashl.h"	// hashl
+#include "hashl_key_type.h"	// hashl_key_dispatch()
+#include "hashl_runs.h"
+#include "itoa.h"	// itoa()
+#include "local_endian.h"	// big_endian
+#include "open_compressed.h"	// pfpeek(), pfread()
+#include "write_fork.h"	// pfwrite_buffer
+#include <algorithm>	// copy()
+#include <functional>	// cref()
+#include <iostream>	// cerr
+#include <mutex>	// lock_guard<>, mutex
+#include <stdlib.h>	// exit()
+#include <string.h>	// memcpy()
+#include <string>	// string
+#include <thread>	// thread
+#include <type_traits>	// remove_pointer<>
+#include <utility>	// swap()
+#include <vector>	// vector<>
+
+std::string hashl_runs::boilerplate() {
+	std::string s("hashl_runs\n");
+	s += itoa(sizeof(base_type));
+	s += " bytes\n";
+#ifdef big_endian
+	s += "big endian\n";
+#else
+	s += "little endian\n";
+#endif
+	return s;
+}
+
+bool hashl_runs::is_runs(const int fd) {
+	const std::string s(boilerplate());
+	char t[s.size()];
+	return pfpeek(fd, t, s.size()) == static_cast<ssize_t>(s.size()) && s.compare(0, s.size(), t, s.size()) == 0;
+}
+
+hashl_runs::hashl_runs(const int fd_in) : fd(fd_in), buffer_start(0), buffer_end(0), value_(0) {
+	const std::string s(boilerplate());
+	char t[s.size()];
+	if (pfread(fd, t, s.size()) != static_cast<ssize_t>(s.size()) || s.compare(0, s.size(), t, s.size()) != 0) {
+		std::cerr << "Error: could not read runs from file: header mismatch\n";
+		exit(1);
+	}
+	if (pfread(fd, &bit_width, sizeof(bit_width)) != sizeof(bit_width)) {
+		std::cerr << "Error: could not read runs from file: short header\n";
+		exit(1);
+	}
+	word_width = (bit_width + 8 * sizeof(base_type) - 1) / (8 * sizeof(base_type));
+	record_size = sizeof(base_type) * word_width + sizeof(small_value_type);
+	// enough for 64k worth of whole records
+	buffer.assign(((1 << 16) / record_size + 1) * record_size, 0);
+	key_.assign(word_width, 0);
+}
+
+bool hashl_runs::next() {
+	if (buffer_start == buffer_end) {
+		const ssize_t n = pfread(fd, &buffer[0], buffer.size());
+		if (n <= 0) {
+			return 0;
+		} else if (n % record_size) {
+			std::cerr << "Error: could not read runs from file: truncated record\n";
+			exit(1);
+		}
+		buffer_start = 0;
+		buffer_end = n;
+	}
+	memcpy(&key_[0], &buffer[buffer_start], sizeof(base_type) * word_width);
+	value_ = buffer[buffer_start + sizeof(base_type) * word_width];
+	buffer_start += record_size;
+	return 1;
+}
+
+hashl_runs::writer::writer(const int fd_in, const size_type bit_width_in) : out(fd_in), word_width((bit_width_in + 8 * sizeof(base_type) - 1) / (8 * sizeof(base_type))) {
+	const std::string s(boilerplate());
+	out.write(s.c_str(), s.size());
+	out.write(&bit_width_in, sizeof(bit_width_in));
+}
+
+// eight bits of a kmer (of the given number of words, high word first),
+// starting shift bits up from the bottom
+
+static unsigned int key_digit(const hashl_runs::base_type * const key, const hashl_runs::size_type words, const hashl_runs::size_type shift) {
+	const hashl_runs::size_type word_bits = sizeof(hashl_runs::base_type) * 8;
+	const hashl_runs::size_type i = words - 1 - shift / word_bits, bit = shift % word_bits;
+	hashl_runs::base_type x = key[i] >> bit;
+	if (bit > word_bits - 8 && i > 0) {	// runs into the next word up
+		x |= key[i - 1] << (word_bits - bit);
+	}
+	return x & 0xff;
+}
+
+// copy out (canonicalized) the kmers with non-zero values from hash slots
+// [start, end)
+
+template<class K>
+static void extract_runs_thread(const hashl &mer_list, const hashl::size_type start, const hashl::size_type end, hashl_runs::base_type *keys, hashl_runs::small_value_type *values) {
+	const hashl_runs::size_type words = mer_list.words();
+	K key(mer_list.bits(), words), comp_key(mer_list.bits(), words);
+	hashl::const_iterator a(mer_list, start);
+	const hashl::const_iterator end_a(mer_list, end);
+	for (; a != end_a; ++a) {
+		if (*a) {
+			a.key(key);
+			comp_key.make_complement(key);
+			const K &x = comp_key < key ? comp_key : key;
+			for (hashl_runs::size_type i = 0; i < words; ++i) {
+				*keys++ = x.value()[i];
+			}
+			*values++ = *a;
+		}
+	}
+}
+
+// LSD radix sort records [start, end) on their bits below end_shift, eight
+// bits at a time, going back and forth between the two sets of arrays
+// (starting in the second); the sorted records end up in the first set
+// if there's an odd number of passes
+
+static void sort_runs_bucket(hashl_runs::base_type *keys, hashl_runs::small_value_type *values, hashl_runs::base_type *keys2, hashl_runs::small_value_type *values2, const hashl_runs::size_type start, const hashl_runs::size_type end, const hashl_runs::size_type words, const hashl_runs::size_type end_shift) {
+	for (hashl_runs::size_type shift = 0; shift < end_shift; shift += 8) {
+		hashl_runs::size_type counts[256] = { 0 };
+		for (hashl_runs::size_type i = start; i < end; ++i) {
+			++counts[key_digit(keys2 + i * words, words, shift)];
+		}
+		hashl_runs::size_type x = start;
+		for (int i = 0; i < 256; ++i) {
+			const hashl_runs::size_type n = counts[i];
+			counts[i] = x;
+			x += n;
+		}
+		for (hashl_runs::size_type i = start; i < end; ++i) {
+			const hashl_runs::size_type j = counts[key_digit(keys2 + i * words, words, shift)]++;
+			std::copy(keys2 + i * words, keys2 + (i + 1) * words, keys + j * words);
+			values[j] = values2[i];
+		}
+		std::swap(keys, keys2);
+		std::swap(values, values2);
+	}
+}
+
+// the kmers are copied out into one array, with each thread taking a part
+// of the hash, then radix sorted: the threads first split the kmers into
+// 256 buckets by their top eight bits, then take turns LSD sorting the
+// buckets on the rest of their bits
+
+void hashl_runs::save(const hashl &mer_list, const int fd, const int threads) {
+	const size_type bits = mer_list.bits(), words = mer_list.words();
+	const hashl::size_type capacity = mer_list.capacity();
+	std::vector<std::thread> thread_list(threads);
+	// where each thread's kmers go
+	std::vector<size_type> starts(threads + 1, 0);
+	for (int i = 0; i < threads; ++i) {
+		thread_list[i] = std::thread([&mer_list, &starts, capacity, threads, i]() {
+			hashl::const_iterator a(mer_list, capacity * i / threads);
+			const hashl::const_iterator end_a(mer_list, capacity * (i + 1) / threads);
+			for (; a != end_a; ++a) {
+				if (*a) {
+					++starts[i + 1];
+				}
+			}
+		});
+	}
+	for (auto &a : thread_list) {
+		a.join();
+	}
+	for (int i = 0; i < threads; ++i) {
+		starts[i + 1] += starts[i];
+	}
+	const size_type n = starts[threads];
+	std::vector<base_type> keys(n * words), keys2(n * words);
+	std::vector<small_value_type> values(n), values2(n);
+	hashl_key_dispatch<base_type>(words, [&](auto key_ptr) {
+		typedef typename std::remove_pointer<decltype(key_ptr)>::type key_type;
+		for (int i = 0; i < threads; ++i) {
+			thread_list[i] = std::thread(extract_runs_thread<key_type>, std::cref(mer_list), capacity * i / threads, capacity * (i + 1) / threads, keys.data() + starts[i] * words, values.data() + starts[i]);
+		}
+		for (auto &a : thread_list) {
+			a.join();
+		}
+	});
+	// split into buckets (into the second arrays) by the top eight bits
+	const size_type top_shift = bits > 8 ? bits - 8 : 0;
+	std::vector<std::vector<size_type> > offsets(threads, std::vector<size_type>(256, 0));
+	for (int i = 0; i < threads; ++i) {
+		thread_list[i] = std::thread([&keys, &offsets, n, words, top_shift, threads, i]() {
+			for (size_type j = n * i / threads; j < n * (i + 1) / threads; ++j) {
+				++offsets[i][key_digit(&keys[j * words], words, top_shift)];
+			}
+		});
+	}
+	for (auto &a : thread_list) {
+		a.join();
+	}
+	// each thread's part of a bucket follows the previous thread's part
+	std::vector<size_type> bucket_starts(257, 0);
+	size_type x = 0;
+	for (int j = 0; j < 256; ++j) {
+		bucket_starts[j] = x;
+		for (int i = 0; i < threads; ++i) {
+			const size_type count = offsets[i][j];
+			offsets[i][j] = x;
+			x += count;
+		}
+	}
+	bucket_starts[256] = x;
+	for (int i = 0; i < threads; ++i) {
+		thread_list[i] = std::thread([&keys, &values, &keys2, &values2, &offsets, n, words, top_shift, threads, i]() {
+			std::vector<size_type> &next = offsets[i];
+			for (size_type j = n * i / threads; j < n * (i + 1) / threads; ++j) {
+				const size_type k = next[key_digit(&keys[j * words], words, top_shift)]++;
+				std::copy(&keys[j * words], &keys[(j + 1) * words], &keys2[k * words]);
+				values2[k] = values[j];
+			}
+		});
+	}
+	for (auto &a : thread_list) {
+		a.join();
+	}
+	// sort the buckets
+	std::mutex mutex;
+	int next_bucket = 0;
+	for (int i = 0; i < threads; ++i) {
+		thread_list[i] = std::thread([&]() {
+			for (;;) {
+				int j;
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					j = next_bucket++;
+				}
+				if (j >= 256) {
+					return;
+				}
+				sort_runs_bucket(keys.data(), values.data(), keys2.data(), values2.data(), bucket_starts[j], bucket_starts[j + 1], words, top_shift);
+			}
+		});
+	}
+	for (auto &a : thread_list) {
+		a.join();
+	}
+	const bool in_first = ((top_shift + 7) / 8) % 2;
+	const base_type * const k = in_first ? keys.data() : keys2.data();
+	const small_value_type * const v = in_first ? values.data() : values2.data();
+	writer out(fd, bits);
+	for (size_type i = 0; i < n; ++i) {
+		out.add(k + i * words, v[i]);
+	}
+	if (out.flush() == -1) {
+		std::cerr << "Error: could not write runs\n";
+		exit(1);
+	}
+}
@@ -2,9 +2,8 @@
 #include "hist_lib_hashn.h"	// convert_key()
 #include "itoa.h"	// itoa()
 #include "local_endian.h"	// big_endian
-#include "next_prime.h"	// next_prime()
-#include "open_compressed.h"	// close_compressed(), open_compressed(), pfread()
-#include "write_fork.h"	// close_fork(), close_fork_wait(), pfwrite(), write_fork()
+#include "open_compressed.h"	// close_compressed(), open_compressed(), pfgets(), pfread()
+#include "write_fork.h"	// close_fork(), close_fork_wait(), pfwrite_buffer, write_fork()
 #include <algorithm>	// swap()
 #include <cassert>	// assert()
 #include <iomanip>	// setw()
@@ -15,7 +14,7 @@
 #include <sstream>	// ostringstream
 #include <stdio.h>	// fprintf(), stderr
 #include <stdlib.h>	// exit()
-#include <string.h>	// memcmp(), memcpy()
+#include <string.h>	// memcpy()
 #include <string>	// string
 #include <sys/stat.h>	// S_ISDIR(), stat(), struct stat
 #include <unistd.h>	// unlink()
@@ -38,6 +37,7 @@ hashn::~hashn() {
 
 std::string hashn::boilerplate() const {
 	std::string s("hashn\n");
+	s += probe.header_line();
 	s += itoa(sizeof(base_type));
 	s += " bytes\n";
 #ifdef big_endian
@@ -48,6 +48,28 @@ std::string hashn::boilerplate() const {
 	return s;
 }
 
+// read and check the beginning of a saved file; the probe line is optional
+
+void hashn::read_boilerplate(const int fd) {
+	std::string t, line;
+	probe.set_type(hash_probe::PRIME);
+	for (int i(0); i < 3; ++i) {
+		if (pfgets(fd, line) == -1) {
+			fprintf(stderr, "Error: could not read hash from file: short header\n");
+			exit(1);
+		}
+		if (i == 1 && probe.parse_header_line(line)) {
+			--i;
+		}
+		t += line;
+		t += '\n';
+	}
+	if (t != boilerplate()) {
+		fprintf(stderr, "Error: could not read hash from file: header mismatch\n");
+		exit(1);
+	}
+}
+
 void hashn::init(offset_type size_asked, const unsigned long bits_in, const offset_type alt_size_in) {
 	if (alt_size_in > 8 * sizeof(offset_type)) {
 		fprintf(stderr, "Error: hash alt size too large: %lu > %lu\n", alt_size_in, 8 * sizeof(offset_type));
@@ -55,16 +77,10 @@ void hashn::init(offset_type size_asked, const unsigned long bits_in, const offs
 	}
 	bit_width = bits_in;
 	word_width = (bit_width + 8 * sizeof(base_type) - 1) / (8 * sizeof(base_type));
+	value_map.set_words(word_width);
 	alt_size = alt_size_in;
 	used_elements = 1;	// to account for minimum of one INVALID_KEYs
-	++size_asked;
-	if (size_asked < 3) {	// to avoid collision_modulus == modulus
-		size_asked = 3;
-	}
-	modulus = next_prime(size_asked);
-	// collision_modulus just needs to be relatively prime with modulus;
-	// since modulus is prime, any value will do - I made it prime for fun
-	collision_modulus = next_prime(size_asked / 2);
+	probe.set_size(size_asked + 1, modulus, collision_modulus);
 	// array is modulus + 1 because invalid_key lives at [modulus]
 	const offset_type n((modulus + 1) * word_width);
 	key_list = new base_type[n];
@@ -74,7 +90,10 @@ void hashn::init(offset_type size_asked, const unsigned long bits_in, const offs
 		alt_map = NULL;
 	} else {
 		alt_list = new small_value_type[modulus * alt_size];
-		alt_map = new std::map<std::string, value_type>[alt_size];
+		alt_map = new hash_overflow[alt_size];
+		for (offset_type i(0); i != alt_size; ++i) {
+			alt_map[i].set_words(word_width);
+		}
 	}
 	// initialize keys; values are initialized as keys are entered
 	invalid_key.assign(*this, modulus);
@@ -84,19 +103,15 @@ void hashn::init(offset_type size_asked, const unsigned long bits_in, const offs
 }
 
 void hashn::init_from_file(const int fd) {
-	const std::string s(boilerplate());
-	char t[s.size()];
-	pfread(fd, t, s.size());
-	if (memcmp(t, s.c_str(), s.size()) != 0) {
-		fprintf(stderr, "Error: could not read hash from file: header mismatch\n");
-		exit(1);
-	}
+	read_boilerplate(fd);
 	pfread(fd, &modulus, sizeof(modulus));
 	pfread(fd, &collision_modulus, sizeof(collision_modulus));
+	probe.set_modulus(modulus);
 	pfread(fd, &used_elements, sizeof(used_elements));
 	pfread(fd, &alt_size, sizeof(alt_size));
 	pfread(fd, &bit_width, sizeof(bit_width));
 	word_width = (bit_width + 8 * sizeof(base_type) - 1) / (8 * sizeof(base_type));
+	value_map.set_words(word_width);
 	const offset_type n((modulus + 1) * word_width);
 	key_list = new base_type[n];
 	value_list = new small_value_type[modulus];
@@ -105,7 +120,10 @@ void hashn::init_from_file(const int fd) {
 		alt_map = NULL;
 	} else {
 		alt_list = new small_value_type[modulus * alt_size];
-		alt_map = new std::map<std::string, value_type>[alt_size];
+		alt_map = new hash_overflow[alt_size];
+		for (offset_type i(0); i != alt_size; ++i) {
+			alt_map[i].set_words(word_width);
+		}
 	}
 	pfread(fd, &value_list[0], sizeof(small_value_type) * modulus);
 	base_type *a(key_list);
@@ -124,12 +142,12 @@ void hashn::init_from_file(const int fd) {
 	pfread(fd, a, sizeof(base_type) * word_width);		// invalid_key
 	offset_type x;
 	pfread(fd, &x, sizeof(x));
-	char buf[sizeof(base_type) * word_width];
+	base_type buf[word_width];
 	for (; x != 0; --x) {
 		value_type j;
 		pfread(fd, buf, sizeof(buf));
 		pfread(fd, &j, sizeof(j));
-		value_map[buf] = j;
+		value_map.set(buf, j);
 	}
 	if (alt_size != 0) {
 		for (offset_type i(0), j(0); i != modulus; ++i) {
@@ -145,13 +163,13 @@ void hashn::init_from_file(const int fd) {
 		}
 		// alt map overflows
 		for (offset_type k(0); k != alt_size; ++k) {
-			std::map<std::string, value_type> &z = alt_map[k];
+			hash_overflow &z = alt_map[k];
 			pfread(fd, &x, sizeof(x));
 			for (; x != 0; --x) {
 				value_type j;
 				pfread(fd, buf, sizeof(buf));
 				pfread(fd, &j, sizeof(j));
-				z[buf] = j;
+				z.set(buf, j);
 			}
 		}
 	}
@@ -161,16 +179,16 @@ void hashn::init_from_file(const int fd) {
 
 hashn::offset_type hashn::find_empty_offset(const base_type * const z) const {
 	const base_type key_hash(hash(z));
-	offset_type i(key_hash % modulus);
+	offset_type i(probe.start(key_hash, modulus));
 	const base_type * const k(key_list + i * word_width);
 	if (invalid_key.equal(k)) {
 		return i;
 	} else if (equal(z, k)) {
 		return modulus;
 	}
-	const offset_type j(collision_modulus - key_hash % collision_modulus);
+	offset_type j(probe.step(key_hash, collision_modulus));
 	for (;;) {	// search over all elements
-		i = (i + j) % modulus;
+		probe.next(i, j, modulus);
 		const base_type * const l(key_list + i * word_width);
 		if (invalid_key.equal(l)) {
 			return i;
@@ -186,11 +204,11 @@ void hashn::rehash() {
 	base_type *k(key_list);
 	for (; i != modulus; ++i, k += word_width) {
 		if (!invalid_key.equal(k)) {
-			const offset_type j(hash(k) % modulus);
+			const offset_type j(probe.start(hash(k), modulus));
 			// swap if non-collision slot has a collision fill
 			if (i != j) {
 				base_type * const l(key_list + j * word_width);
-				if (invalid_key.equal(l) || hash(l) % modulus != j) {
+				if (invalid_key.equal(l) || probe.start(hash(l), modulus) != j) {
 					swap(l, k);
 					std::swap(value_list[j], value_list[i]);
 					--i;
@@ -227,11 +245,11 @@ void hashn::rehash_alt() {
 	base_type *k(key_list);
 	for (; i != modulus; ++i, k += word_width) {
 		if (!invalid_key.equal(k)) {
-			const offset_type j(hash(k) % modulus);
+			const offset_type j(probe.start(hash(k), modulus));
 			// swap if non-collision slot has a collision fill
 			if (i != j) {
 				base_type * const l(key_list + j * word_width);
-				if (invalid_key.equal(l) || hash(l) % modulus != j) {
+				if (invalid_key.equal(l) || probe.start(hash(l), modulus) != j) {
 					swap(l, k);
 					std::swap(value_list[j], value_list[i]);
 					offset_type x(j * alt_size);
@@ -326,16 +344,16 @@ hashn::offset_type hashn::insert_key(const offset_type i, base_type * const k, c
 
 hashn::offset_type hashn::insert_offset(const key_type_base &key) {
 	const base_type key_hash(key.hash());
-	offset_type i(key_hash % modulus);
+	offset_type i(probe.start(key_hash, modulus));
 	base_type * const k(key_list + i * word_width);
 	if (invalid_key.equal(k)) {	// insert
 		return insert_key(i, k, key);
 	} else if (key.equal(k)) {	// already present
 		return i;
 	}
-	const offset_type j(collision_modulus - key_hash % collision_modulus);
+	offset_type j(probe.step(key_hash, collision_modulus));
 	for (;;) {	// search over all elements
-		i = (i + j) % modulus;
+		probe.next(i, j, modulus);
 		base_type * const l(key_list + i * word_width);
 		if (invalid_key.equal(l)) {
 			return insert_key(i, l, key);
@@ -349,16 +367,16 @@ hashn::offset_type hashn::insert_offset(const key_type_base &key) {
 
 hashn::offset_type hashn::find_offset(const key_type_base &key) const {
 	const base_type key_hash(key.hash());
-	offset_type i(key_hash % modulus);
+	offset_type i(probe.start(key_hash, modulus));
 	const base_type * const k(key_list + i * word_width);
 	if (invalid_key.equal(k)) {
 		return modulus;
 	} else if (key.equal(k)) {
 		return i;
 	}
-	const offset_type j(collision_modulus - key_hash % collision_modulus);
+	offset_type j(probe.step(key_hash, collision_modulus));
 	for (;;) {	// search over all elements
-		i = (i + j) % modulus;
+		probe.next(i, j, modulus);
 		const base_type * const l(key_list + i * word_width);
 		if (invalid_key.equal(l)) {
 			return modulus;
@@ -378,7 +396,7 @@ bool hashn::increment(const key_type &key) {
 	if (value_list[i] != max_small_value) {
 		++value_list[i];
 	} else {
-		++value_map[key.string()];
+		value_map.add(key.data(), 1);
 	}
 	return 1;
 }
@@ -390,7 +408,6 @@ bool hashn::increment_alt(const key_type &key, const offset_type x) {
 	if (i == modulus) {	// insert failed
 		return 0;
 	}
-	const std::string key_str(key.string());
 	const offset_type start_j(i * alt_size);
 	const offset_type end_j(start_j + alt_size);
 	for (offset_type j(start_j), z(1); j != end_j; ++j, z <<= 1) {
@@ -398,7 +415,7 @@ bool hashn::increment_alt(const key_type &key, const offset_type x) {
 			if (alt_list[j] != max_small_value) {
 				++alt_list[j];
 			} else {
-				++alt_map[j - start_j][key_str];
+				alt_map[j - start_j].add(key.data(), 1);
 			}
 		}
 	}
@@ -414,13 +431,10 @@ bool hashn::assign(const key_type &key, const value_type x) {
 	}
 	if (x <= max_small_value) {
 		value_list[i] = x;
-		const std::map<std::string, value_type>::iterator a(value_map.find(key.string()));
-		if (a != value_map.end()) {
-			value_map.erase(a);
-		}
+		value_map.erase(key.data());
 	} else {
 		value_list[i] = max_small_value;
-		value_map[key.string()] = x - max_small_value;
+		value_map.set(key.data(), x - max_small_value);
 	}
 	return 1;
 }
@@ -434,13 +448,7 @@ hashn::value_type hashn::value(const key_type &key) const {
 	} else if (value_list[i] != max_small_value) {
 		return value_list[i];
 	} else {
-		// use find() to avoid inserting a value into value_map
-		const std::map<std::string, value_type>::const_iterator a(value_map.find(key.string()));
-		if (a == value_map.end()) {
-			return max_small_value;
-		} else {
-			return a->second + max_small_value;
-		}
+		return value_map.find(key.data()) + max_small_value;
 	}
 }
 
@@ -449,33 +457,19 @@ hashn::value_type hashn::value(const key_type &key, value_type x[]) const {
 	if (i == modulus) {	// key not found
 		return 0;
 	}
-	const std::string key_str(key.string());
 	offset_type j(0);
 	const offset_type alt_offset(i * alt_size);
 	for (; j != alt_size; ++j) {
 		if (alt_list[j + alt_offset] != max_small_value) {
 			x[j] = alt_list[j + alt_offset];
 		} else {
-			const std::map<std::string, value_type> &b(alt_map[j]);
-			// use find() to avoid inserting a value into value_map
-			const std::map<std::string, value_type>::const_iterator a(b.find(key_str));
-			if (a == b.end()) {
-				x[j] = max_small_value;
-			} else {
-				x[j] = a->second + max_small_value;
-			}
+			x[j] = alt_map[j].find(key.data()) + max_small_value;
 		}
 	}
 	if (value_list[i] != max_small_value) {
 		return value_list[i];
 	} else {
-		// use find() to avoid inserting a value into value_map
-		const std::map<std::string, value_type>::const_iterator a(value_map.find(key_str));
-		if (a == value_map.end()) {
-			return max_small_value;
-		} else {
-			return a->second + max_small_value;
-		}
+		return value_map.find(key.data()) + max_small_value;
 	}
 }
 
@@ -542,12 +536,7 @@ hashn::const_iterator::const_iterator(const hashn * const a, const offset_type i
 		if (list->value_list[offset] != max_small_value) {
 			value = list->value_list[offset];
 		} else {
-			const std::map<std::string, value_type>::const_iterator b(list->value_map.find(key.string()));
-			if (b == list->value_map.end()) {
-				value = max_small_value;
-			} else {
-				value = b->second + max_small_value;
-			}
+			value = list->value_map.find(key.data()) + max_small_value;
 		}
 	} else {
 		value = 0;
@@ -578,12 +567,7 @@ void hashn::const_iterator::increment() {
 			if (list->value_list[offset] != max_small_value) {
 				value = list->value_list[offset];
 			} else {
-				const std::map<std::string, value_type>::const_iterator a(list->value_map.find(key.string()));
-				if (a == list->value_map.end()) {
-					value = max_small_value;
-				} else {
-					value = a->second + max_small_value;
-				}
+				value = list->value_map.find(key.data()) + max_small_value;
 			}
 		} else {
 			value = 0;
@@ -633,73 +617,69 @@ void hashn::const_iterator::increment() {
 // extract list of alt_values associated with current offset
 
 void hashn::const_iterator::get_alt_values(value_type x[]) const {
-	const std::string key_str(key.string());
 	const offset_type alt_offset(offset * list->alt_size);
 	for (offset_type i(0); i != list->alt_size; ++i) {
 		if (list->alt_list[alt_offset + i] != max_small_value) {
 			x[i] = list->alt_list[alt_offset + i];
 		} else {
-			// use find() to avoid inserting a value into alt_map
-			const std::map<std::string, value_type>::const_iterator a(list->alt_map[i].find(key_str));
-			if (a == list->alt_map[i].end()) {
-				x[i] = max_small_value;
-			} else {
-				x[i] = a->second + max_small_value;
-			}
+			x[i] = list->alt_map[i].find(key.data()) + max_small_value;
 		}
 	}
 }
 
 void hashn::save(const int fd) const {
+	pfwrite_buffer out(fd);
 	const std::string s(boilerplate());
-	pfwrite(fd, s.c_str(), s.size());
-	pfwrite(fd, &modulus, sizeof(modulus));
-	pfwrite(fd, &collision_modulus, sizeof(collision_modulus));
-	pfwrite(fd, &used_elements, sizeof(used_elements));
-	pfwrite(fd, &alt_size, sizeof(alt_size));
-	pfwrite(fd, &bit_width, sizeof(bit_width));
+	out.write(s.c_str(), s.size());
+	out.write(&modulus, sizeof(modulus));
+	out.write(&collision_modulus, sizeof(collision_modulus));
+	out.write(&used_elements, sizeof(used_elements));
+	out.write(&alt_size, sizeof(alt_size));
+	out.write(&bit_width, sizeof(bit_width));
 	// normally, unused entries have uninitialized data, but here we
 	// store them with zero values so we can use them to mark entries
 	// in the other arrays that we don't bother to write to file
 	const small_value_type zero(0);
 	const base_type *j(key_list);
 	for (offset_type i(0); i != modulus; ++i, j += word_width) {
-		pfwrite(fd, invalid_key.equal(j) ? &zero : &value_list[i], sizeof(small_value_type));
+		out.write(invalid_key.equal(j) ? &zero : &value_list[i], sizeof(small_value_type));
 	}
 	j = key_list;
 	const base_type * const end_j(j + modulus * word_width);
 	for (; j != end_j; j += word_width) {
 		if (!invalid_key.equal(j)) {
-			pfwrite(fd, j, sizeof(base_type) * word_width);
+			out.write(j, sizeof(base_type) * word_width);
 		}
 	}
-	pfwrite(fd, j, sizeof(base_type) * word_width);		// invalid_key
+	out.write(j, sizeof(base_type) * word_width);		// invalid_key
 	offset_type x;
 	x = value_map.size();
-	pfwrite(fd, &x, sizeof(x));
-	std::map<std::string, value_type>::const_iterator a(value_map.begin());
-	const std::map<std::string, value_type>::const_iterator end_a(value_map.end());
-	for (; a != end_a; ++a) {
-		pfwrite(fd, a->first.c_str(), a->first.size());
-		pfwrite(fd, &a->second, sizeof(value_type));
+	out.write(&x, sizeof(x));
+	for (offset_type i(0); i != value_map.slots(); ++i) {
+		if (value_map.value(i) != 0) {
+			const value_type y(value_map.value(i));
+			out.write(value_map.key(i), sizeof(base_type) * word_width);
+			out.write(&y, sizeof(value_type));
+		}
 	}
 	if (alt_size != 0) {
 		j = key_list;
 		for (offset_type i(0); j != end_j; j += word_width, ++i) {
 			if (!invalid_key.equal(j)) {
-				pfwrite(fd, &alt_list[i * alt_size], sizeof(small_value_type) * alt_size);
+				out.write(&alt_list[i * alt_size], sizeof(small_value_type) * alt_size);
 			}
 		}
 		// alt map overflows
 		for (offset_type k(0); k != alt_size; ++k) {
-			std::map<std::string, value_type> &z = alt_map[k];
+			const hash_overflow &z = alt_map[k];
 			x = z.size();
-			pfwrite(fd, &x, sizeof(x));
-			std::map<std::string, value_type>::const_iterator b(z.begin());
-			const std::map<std::string, value_type>::const_iterator end_b(z.end());
-			for (; b != end_b; ++b) {
-				pfwrite(fd, b->first.c_str(), b->first.size());
-				pfwrite(fd, &b->second, sizeof(value_type));
+			out.write(&x, sizeof(x));
+			for (offset_type i(0); i != z.slots(); ++i) {
+				if (z.value(i) != 0) {
+					const value_type y(z.value(i));
+					out.write(z.key(i), sizeof(base_type) * word_width);
+					out.write(&y, sizeof(value_type));
+				}
 			}
 		}
 	}
@@ -868,22 +848,20 @@ void hashn::save_state(void) {
 		exit(1);
 	}
 	state_files.push_back(file);
+	pfwrite_buffer out(fd);
 	base_type *j(key_list);
 	const base_type * const end_j(j + modulus * word_width);
 	for (offset_type i(0); j != end_j; j += word_width, ++i) {
 		if (!invalid_key.equal(j)) {
-			pfwrite(fd, j, sizeof(base_type) * word_width);
+			out.write(j, sizeof(base_type) * word_width);
 			value_type x(value_list[i]);
 			if (x == max_small_value) {
-				const key_type_internal tmp_key(*this, j);
-				const std::map<std::string, value_type>::const_iterator a(value_map.find(tmp_key.string()));
-				if (a != value_map.end()) {
-					x += a->second;
-				}
+				x += value_map.find(j);
 			}
-			pfwrite(fd, &x, sizeof(value_type));
+			out.write(&x, sizeof(value_type));
 		}
 	}
+	out.flush();
 	close_fork(fd);
 }
 
@@ -931,10 +909,7 @@ bool hashn::get_next_entry(const int fd, sort_key &i, value_type &j, offset_type
 		i.k += word_width;
 		j = value_list[offset];
 		if (j == max_small_value) {
-			const std::map<std::string, value_type>::const_iterator a(value_map.find(key_type_base(word_width, i.k).string()));
-			if (a != value_map.end()) {
-				j += a->second;
-			}
+			j += value_map.find(i.k);
 		}
 	}
 	return 1;
@@ -1002,6 +977,7 @@ void hashn::print(const int flags) const {
 	if (flags & print_hash_header) {
 		std::cout << "modulus: " << modulus << "\n"
 			<< "collision modulus: " << collision_modulus << "\n"
+			<< "probe: " << hash_probe::name(probe.type()) << "\n"
 			<< "used elements: " << used_elements << "\n"
 			<< "bit width: " << bit_width << "\n"
 			<< "offset/value/key pairs:\n";
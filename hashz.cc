@@ -1,16 +1,66 @@
 #include "hashz.h"
+#include "itoa.h"	/* itoa() */
+#include "local_endian.h"	/* big_endian */
 #include "next_prime.h"	/* next_prime() */
-#include <gmp.h>	/* gmp_randclear(), gmp_randinit_default(), gmp_randstate_t, mpz_clear(), mpz_comp(), mpz_fdiv_ui(), mpz_get_str(), mpz_init2(), mpz_init_set(), mpz_mul_2exp(), mpz_realloc(), mpz_set(), mpz_setbit(), mpz_set_ui(), mpz_sizeinbase(), mpz_sub_ui(), mpz_urandomb() */
-#include <map>		/* map<> */
+#include "open_compressed.h"	/* pfgets(), pfread() */
+#include "write_fork.h"	/* pfwrite_buffer */
 #include <stdio.h>	/* fprintf(), stderr */
 #include <stdlib.h>	/* exit() */
+#include <string>	/* string */
+#include <vector>	/* vector<> */
 
-hashz::hashz(offset_type size_asked, unsigned long bits, small_value_type alt_size_in) {
+hashz::hashz() : used_elements(0), modulus(0), collision_modulus(0), bit_width(0), word_width(0), key_list(NULL), alt_size(0), value_list(NULL), alt_list(NULL), alt_map(NULL) { }
+
+hashz::~hashz() {
+	free_lists();
+}
+
+void hashz::free_lists() {
+	delete[] key_list;
+	key_list = NULL;
+	delete[] value_list;
+	value_list = NULL;
+	if (alt_list != NULL) {
+		small_value_type i;
+		for (i = 0; i != alt_size; ++i) {
+			delete[] alt_list[i];
+		}
+		delete[] alt_list;
+		alt_list = NULL;
+	}
+	delete[] alt_map;
+	alt_map = NULL;
+	value_map.clear();
+}
+
+/* allocate the arrays for the current modulus, bit_width, and alt_size */
+
+void hashz::allocate_lists() {
+	word_width = (bit_width + 8 * sizeof(base_type) - 1) / (8 * sizeof(base_type));
+	value_map.set_words(word_width);
+	key_list = new base_type[modulus * word_width];
+	value_list = new small_value_type[modulus];
+	if (alt_size != 0) {
+		alt_list = new small_value_type *[alt_size];
+		small_value_type i;
+		for (i = 0; i != alt_size; ++i) {
+			alt_list[i] = new small_value_type[modulus];
+		}
+		alt_map = new hash_overflow[alt_size];
+		for (i = 0; i != alt_size; ++i) {
+			alt_map[i].set_words(word_width);
+		}
+	}
+}
+
+void hashz::init(offset_type size_asked, unsigned long bits, small_value_type alt_size_in) {
 	if (alt_size_in > 8 * sizeof(offset_type)) {
 		fprintf(stderr, "Error: hash alt size too large: %d > %ld\n", alt_size_in, 8 * sizeof(offset_type));
 		exit(1);
 	}
+	free_lists();
 	alt_size = alt_size_in;
+	bit_width = bits;
 	used_elements = 0;
 	if (size_asked < 3) {	/* to avoid collision_modulus == modulus */
 		size_asked = 3;
@@ -21,141 +71,226 @@ hashz::hashz(offset_type size_asked, unsigned long bits, small_value_type alt_si
 	 * since modulus is prime, any value will do - I made it prime for fun
 	 */
 	collision_modulus = next_prime(size_asked / 2);
-	key_list = new key_type[modulus];
-	if (key_list == NULL) {
-		fprintf(stderr, "Error: unable to allocate hash key array\n");
-		exit(1);
+	allocate_lists();
+	clear();
+}
+
+/* description beginning of saved file */
+
+std::string hashz::boilerplate() const {
+	std::string s("hashz\n");
+	s += itoa(sizeof(base_type));
+	s += " bytes\n";
+#ifdef big_endian
+	s += "big endian\n";
+#else
+	s += "little endian\n";
+#endif
+	return s;
+}
+
+/*
+ * the file is the boilerplate, the sizes, the value array, a bit per entry
+ * marking the ones in use (as alt-only entries have zero values), then the
+ * keys and alt values of the used entries, and the overflows
+ */
+
+void hashz::init_from_file(const int fd) {
+	free_lists();
+	const std::string s(boilerplate());
+	std::string t, line;
+	for (int i = 0; i < 3; ++i) {
+		if (pfgets(fd, line) == -1) {
+			fprintf(stderr, "Error: could not read hash from file: short header\n");
+			exit(1);
+		}
+		t += line;
+		t += '\n';
 	}
-	value_list = new small_value_type[modulus];
-	if (value_list == NULL) {
-		fprintf(stderr, "Error: unable to allocate hash value array\n");
+	if (t != s) {
+		fprintf(stderr, "Error: could not read hash from file: header mismatch\n");
 		exit(1);
 	}
-	if (alt_size == 0) {
-		alt_list = NULL;
-		alt_map = NULL;
-	} else {
-		alt_list = new small_value_type *[alt_size];
-		if (alt_list == NULL) {
-			fprintf(stderr, "Error: unable to allocate hash alt list array\n");
-			exit(1);
+	pfread(fd, &modulus, sizeof(modulus));
+	pfread(fd, &collision_modulus, sizeof(collision_modulus));
+	pfread(fd, &used_elements, sizeof(used_elements));
+	pfread(fd, &alt_size, sizeof(alt_size));
+	pfread(fd, &bit_width, sizeof(bit_width));
+	allocate_lists();
+	pfread(fd, value_list, sizeof(small_value_type) * modulus);
+	std::vector<unsigned char> used((modulus + 7) / 8);
+	pfread(fd, &used[0], used.size());
+	offset_type i;
+	base_type *a = key_list;
+	for (i = 0; i != modulus; ++i, a += word_width) {
+		if (used[i / 8] & (1 << (i % 8))) {
+			pfread(fd, a, sizeof(base_type) * word_width);
+		} else {
+			for (size_t j = 0; j != word_width; ++j) {
+				a[j] = INVALID_KEY;
+			}
 		}
-		small_value_type i;
-		for (i = 0; i != alt_size; ++i) {
-			alt_list[i] = new small_value_type[modulus];
-			if (alt_list[i] == NULL) {
-				fprintf(stderr, "Error: unable to allocate hash alt list %d array\n", i);
-				exit(1);
+	}
+	base_type buf[word_width];
+	offset_type x;
+	pfread(fd, &x, sizeof(x));
+	for (; x != 0; --x) {
+		value_type j;
+		pfread(fd, buf, sizeof(buf));
+		pfread(fd, &j, sizeof(j));
+		value_map.set(buf, j);
+	}
+	small_value_type k;
+	for (k = 0; k != alt_size; ++k) {
+		for (i = 0; i != modulus; ++i) {
+			if (used[i / 8] & (1 << (i % 8))) {
+				pfread(fd, &alt_list[k][i], sizeof(small_value_type));
+			} else {
+				alt_list[k][i] = 0;
 			}
 		}
-		alt_map = new std::map<std::string, value_type>[alt_size];
-		if (alt_map == NULL) {
-			fprintf(stderr, "Error: unable to allocate hash alt map array\n");
-			exit(1);
+		pfread(fd, &x, sizeof(x));
+		for (; x != 0; --x) {
+			value_type j;
+			pfread(fd, buf, sizeof(buf));
+			pfread(fd, &j, sizeof(j));
+			alt_map[k].set(buf, j);
 		}
 	}
-	/* allocate space for key conversion */
-	mpz_init2(invalid_key, bits + 1);
-	mpz_set_ui(invalid_key, 1);
-	mpz_mul_2exp(invalid_key, invalid_key, bits);
-	mpz_sub_ui(invalid_key, invalid_key, 1);
-	key_cstr = new char[mpz_sizeinbase(invalid_key, 62) + 2];
-	/* initialize invalid_key - random with high bit set */
-	mpz_realloc2(invalid_key, bits);
-	gmp_randstate_t state;
-	gmp_randinit_default(state);
-	mpz_urandomb(invalid_key, state, bits);
-	gmp_randclear(state);
-	mpz_setbit(invalid_key, bits - 1);
-	mpz_setbit(invalid_key, 1);			/* non-palindrome */
-	/* initialize keys */
-	offset_type i;
-	for (i = 0; i != modulus; ++i) {
-		mpz_init_set(key_list[i], invalid_key);
-	}
 }
 
-hashz::~hashz() {
-	delete[] key_cstr;
-	mpz_clear(invalid_key);
+void hashz::save(const int fd) const {
+	pfwrite_buffer out(fd);
+	const std::string s(boilerplate());
+	out.write(s.c_str(), s.size());
+	out.write(&modulus, sizeof(modulus));
+	out.write(&collision_modulus, sizeof(collision_modulus));
+	out.write(&used_elements, sizeof(used_elements));
+	out.write(&alt_size, sizeof(alt_size));
+	out.write(&bit_width, sizeof(bit_width));
+	out.write(value_list, sizeof(small_value_type) * modulus);
+	std::vector<unsigned char> used((modulus + 7) / 8, 0);
 	offset_type i;
-	for (i = 0; i != modulus; ++i) {
-		mpz_clear(key_list[i]);
+	const base_type *a = key_list;
+	for (i = 0; i != modulus; ++i, a += word_width) {
+		if (!is_invalid(a)) {
+			used[i / 8] |= 1 << (i % 8);
+		}
 	}
-	delete[] key_list;
-	delete[] value_list;
-	if (alt_list != NULL) {
-		for (i = 0; i != alt_size; ++i) {
-			delete[] alt_list[i];
+	out.write(&used[0], used.size());
+	a = key_list;
+	for (i = 0; i != modulus; ++i, a += word_width) {
+		if (used[i / 8] & (1 << (i % 8))) {
+			out.write(a, sizeof(base_type) * word_width);
+		}
+	}
+	offset_type x = value_map.size();
+	out.write(&x, sizeof(x));
+	for (i = 0; i != value_map.slots(); ++i) {
+		if (value_map.value(i) != 0) {
+			const value_type y = value_map.value(i);
+			out.write(value_map.key(i), sizeof(base_type) * word_width);
+			out.write(&y, sizeof(y));
+		}
+	}
+	small_value_type k;
+	for (k = 0; k != alt_size; ++k) {
+		for (i = 0; i != modulus; ++i) {
+			if (used[i / 8] & (1 << (i % 8))) {
+				out.write(&alt_list[k][i], sizeof(small_value_type));
+			}
+		}
+		const hash_overflow &z = alt_map[k];
+		x = z.size();
+		out.write(&x, sizeof(x));
+		for (i = 0; i != z.slots(); ++i) {
+			if (z.value(i) != 0) {
+				const value_type y = z.value(i);
+				out.write(z.key(i), sizeof(base_type) * word_width);
+				out.write(&y, sizeof(y));
+			}
 		}
-		delete[] alt_list;
 	}
-	if (alt_map != NULL) {
-		delete[] alt_map;
+	if (out.flush() == -1) {
+		fprintf(stderr, "Error: could not save hash\n");
+		exit(1);
 	}
 }
 
-/* insert a key at a particular location */
+/* true if the entry holds INVALID_KEY (i.e., isn't in use) */
 
-hashz::offset_type hashz::insert_key(offset_type i, const key_type &key) {
-	if (used_elements + 1 == modulus) {	/* hash is full */
-		return modulus;
+bool hashz::is_invalid(const base_type * const k) const {
+	size_t i;
+	for (i = 0; i != word_width; ++i) {
+		if (k[i] != INVALID_KEY) {
+			return 0;
+		}
 	}
-	++used_elements;
-	mpz_set(key_list[i], key);
-	value_list[i] = 0;
-	offset_type j;
-	for (j = 0; j != alt_size; ++j) {
-		alt_list[j][i] = 0;
+	return 1;
+}
+
+/* true if the entry holds the key */
+
+template<class K>
+static bool key_equal(const K &key, const hashz::base_type * const k) {
+	size_t i;
+	for (i = 0; i != key.value().size(); ++i) {
+		if (k[i] != key.value()[i]) {
+			return 0;
+		}
 	}
-	return i;
+	return 1;
 }
 
 /*
  * find a key, or insert it if it doesn't exist; return modulus if hash is full
  */
 
-hashz::offset_type hashz::insert_offset(const key_type &key) {
-	offset_type i = mpz_fdiv_ui(key, modulus);
-	if (mpz_cmp(key_list[i], invalid_key) == 0) {
-		return insert_key(i, key);
-	} else if (mpz_cmp(key_list[i], key) == 0) {
-		return i;
-	}
-	offset_type j = collision_modulus - mpz_fdiv_ui(key, collision_modulus);
+template<class K>
+hashz::offset_type hashz::insert_offset(const K &key) {
+	const base_type key_hash = key.hash();
+	offset_type i = key_hash % modulus;
+	const offset_type j = collision_modulus - key_hash % collision_modulus;
 	for (;;) {	/* search over all elements */
-		i = (i + j) % modulus;
-		if (mpz_cmp(key_list[i], invalid_key) == 0) {
-			return insert_key(i, key);
-		} else if (mpz_cmp(key_list[i], key) == 0) {
+		base_type * const k = key_list + i * word_width;
+		if (key_equal(key, k)) {
+			return i;
+		} else if (k[0] == INVALID_KEY && is_invalid(k)) {
+			if (used_elements + 1 == modulus) {	/* hash is full */
+				return modulus;
+			}
+			++used_elements;
+			for (size_t n = 0; n != key.value().size(); ++n) {
+				k[n] = key.value()[n];
+			}
 			return i;
 		}
+		i = (i + j) % modulus;
 	}
 }
 
 /* find a key; return modulus as offset if not found */
 
-hashz::offset_type hashz::find_offset(const key_type &key) const {
-	offset_type i = mpz_fdiv_ui(key, modulus);
-	if (mpz_cmp(key_list[i], key) == 0) {
-		return i;
-	} else if (mpz_cmp(key_list[i], invalid_key) == 0) {
-		return modulus;
-	}
-	offset_type j = collision_modulus - mpz_fdiv_ui(key, collision_modulus);
+template<class K>
+hashz::offset_type hashz::find_offset(const K &key) const {
+	const base_type key_hash = key.hash();
+	offset_type i = key_hash % modulus;
+	const offset_type j = collision_modulus - key_hash % collision_modulus;
 	for (;;) {	/* search over all elements */
-		i = (i + j) % modulus;
-		if (mpz_cmp(key_list[i], key) == 0) {
+		const base_type * const k = key_list + i * word_width;
+		if (key_equal(key, k)) {
 			return i;
-		} else if (mpz_cmp(key_list[i], invalid_key) == 0) {
+		} else if (k[0] == INVALID_KEY && is_invalid(k)) {
 			return modulus;
 		}
+		i = (i + j) % modulus;
 	}
 }
 
 /* increment the count for a key */
 
-bool hashz::increment(const key_type &key) {
+template<class K>
+bool hashz::increment(const K &key) {
 	offset_type i = insert_offset(key);
 	if (i == modulus) {	/* insert failed */
 		return 0;
@@ -163,29 +298,27 @@ bool hashz::increment(const key_type &key) {
 	if (value_list[i] != max_small_value) {
 		++value_list[i];
 	} else {
-		mpz_get_str(key_cstr, 62, key);
-		++value_map[key_cstr];
+		value_map.add(&key.value()[0], 1);
 	}
 	return 1;
 }
 
 /* increment only the alt values, using x as a bit flag to mark which ones */
 
-bool hashz::increment_alt(const key_type &key, offset_type x) {
+template<class K>
+bool hashz::increment_alt(const K &key, offset_type x) {
 	offset_type i = insert_offset(key);
 	if (i == modulus) {	/* insert failed */
 		return 0;
 	}
 	offset_type z;
 	small_value_type j;
-	mpz_get_str(key_cstr, 62, key);
-	std::string key_str(key_cstr);
 	for (j = 0, z = 1; j != alt_size; ++j, z <<= 1) {
 		if (x & z) {
 			if (alt_list[j][i] != max_small_value) {
 				++alt_list[j][i];
 			} else {
-				++alt_map[j][key_str];
+				alt_map[j].add(&key.value()[0], 1);
 			}
 		}
 	}
@@ -194,55 +327,36 @@ bool hashz::increment_alt(const key_type &key, offset_type x) {
 
 /* return the value associated with a key */
 
-hashz::value_type hashz::value(const key_type &key) const {
+template<class K>
+hashz::value_type hashz::value(const K &key) const {
 	offset_type i = find_offset(key);
 	if (i == modulus) {	/* key not found */
 		return 0;
 	} else if (value_list[i] != max_small_value) {
 		return value_list[i];
 	} else {
-		mpz_get_str(key_cstr, 62, key);
-		/* use find() to avoid inserting a value into value_map */
-		std::map<std::string, value_type>::const_iterator a = value_map.find(key_cstr);
-		if (a == value_map.end()) {
-			return max_small_value;
-		} else {
-			return a->second + max_small_value;
-		}
+		return value_map.find(&key.value()[0]) + max_small_value;
 	}
 }
 
-hashz::value_type hashz::value(const key_type &key, value_type x[]) const {
+template<class K>
+hashz::value_type hashz::value(const K &key, value_type x[]) const {
 	offset_type i = find_offset(key);
 	if (i == modulus) {	/* key not found */
 		return 0;
 	}
-	mpz_get_str(key_cstr, 62, key);
-	std::string key_str(key_cstr);
 	small_value_type j;
 	for (j = 0; j != alt_size; ++j) {
 		if (alt_list[j][i] != max_small_value) {
 			x[j] = alt_list[j][i];
 		} else {
-			/* use find() to avoid inserting a value into value_map */
-			std::map<std::string, value_type>::const_iterator a = alt_map[j].find(key_str);
-			if (a == alt_map[j].end()) {
-				x[j] = max_small_value;
-			} else {
-				x[j] = a->second + max_small_value;
-			}
+			x[j] = alt_map[j].find(&key.value()[0]) + max_small_value;
 		}
 	}
 	if (value_list[i] != max_small_value) {
 		return value_list[i];
 	} else {
-		/* use find() to avoid inserting a value into value_map */
-		std::map<std::string, value_type>::const_iterator a = value_map.find(key_str);
-		if (a == value_map.end()) {
-			return max_small_value;
-		} else {
-			return a->second + max_small_value;
-		}
+		return value_map.find(&key.value()[0]) + max_small_value;
 	}
 }
 
@@ -250,14 +364,22 @@ hashz::value_type hashz::value(const key_type &key, value_type x[]) const {
 
 void hashz::clear() {
 	used_elements = 0;
-	/* initialize keys */
+	/* initialize keys; values are initialized as keys are entered */
 	offset_type i;
+	const offset_type n = modulus * word_width;
+	for (i = 0; i != n; ++i) {
+		key_list[i] = INVALID_KEY;
+	}
 	for (i = 0; i != modulus; ++i) {
-		mpz_set(key_list[i], invalid_key);
+		value_list[i] = 0;
 	}
-	value_map.clear();
-	for (i = 0; i != alt_size; ++i) {
-		alt_map[i].clear();
+	value_map.set_words(word_width);
+	small_value_type j;
+	for (j = 0; j != alt_size; ++j) {
+		for (i = 0; i != modulus; ++i) {
+			alt_list[j][i] = 0;
+		}
+		alt_map[j].set_words(word_width);
 	}
 }
 
@@ -267,7 +389,7 @@ hashz::const_iterator hashz::begin() const {
 	}
 	const_iterator a(this, 0);
 	/* advance to first valid value */
-	if (mpz_cmp(a.key, invalid_key) == 0) {
+	if (is_invalid(key_list)) {
 		++a;
 	}
 	return a;
@@ -277,53 +399,14 @@ hashz::const_iterator hashz::end() const {
 	return const_iterator(this, modulus);
 }
 
-hashz::const_iterator::const_iterator(const const_iterator &a) {
-	list = a.list;
-	offset = a.offset;
-	value = a.value;
-	if (list != NULL) {
-		mpz_init_set(key, a.key);
-	}
-}
-
-hashz::const_iterator::const_iterator(const hashz *b, offset_type i) {
-	list = b;
-	offset = i;
-	if (list == NULL) {
-		value = 0;
-	} else if (offset == list->modulus) {
-		value = 0;
-		mpz_init_set(key, list->invalid_key);
-	} else {
-		mpz_init_set(key, list->key_list[i]);
+hashz::const_iterator::const_iterator(const hashz *b, offset_type i) : list(b), offset(i), value(0) {
+	if (list != NULL && offset != list->modulus && !list->is_invalid(list->key_list + offset * list->word_width)) {
 		if (list->value_list[offset] != max_small_value) {
 			value = list->value_list[offset];
 		} else {
-			mpz_get_str(list->key_cstr, 62, key);
-			std::map<std::string, value_type>::const_iterator a = list->value_map.find(list->key_cstr);
-			if (a == list->value_map.end()) {
-				value = max_small_value;
-			} else {
-				value = a->second + max_small_value;
-			}
-		}
-	}
-}
-
-hashz::const_iterator &hashz::const_iterator::operator=(const const_iterator &a) {
-	if (list != NULL) {
-		if (a.list != NULL) {
-			mpz_set(key, a.key);
-		} else {
-			mpz_clear(key);
+			value = list->value_map.find(list->key_list + offset * list->word_width) + max_small_value;
 		}
-	} else if (a.list != NULL) {
-		mpz_init_set(key, a.key);
 	}
-	list = a.list;
-	offset = a.offset;
-	value = a.value;
-	return *this;
 }
 
 /* advance to next used element */
@@ -335,21 +418,15 @@ void hashz::const_iterator::increment() {
 	for (;;) {
 		++offset;
 		if (offset == list->modulus) {
-			mpz_set(key, list->invalid_key);
 			value = 0;
 			return;
-		} else if (mpz_cmp(list->key_list[offset], list->invalid_key) != 0) {
-			mpz_set(key, list->key_list[offset]);
+		}
+		const base_type * const k = list->key_list + offset * list->word_width;
+		if (!list->is_invalid(k)) {
 			if (list->value_list[offset] != max_small_value) {
 				value = list->value_list[offset];
 			} else {
-				mpz_get_str(list->key_cstr, 62, key);
-				std::map<std::string, value_type>::const_iterator a = list->value_map.find(list->key_cstr);
-				if (a == list->value_map.end()) {
-					value = max_small_value;
-				} else {
-					value = a->second + max_small_value;
-				}
+				value = list->value_map.find(k) + max_small_value;
 			}
 			return;
 		}
@@ -365,19 +442,31 @@ bool hashz::const_iterator::operator==(const const_iterator &a) const {
 /* extract list of alt_values associated with current offset */
 
 void hashz::const_iterator::get_alt_values(value_type x[]) const {
-	mpz_get_str(list->key_cstr, 62, key);
-	std::string key_str(list->key_cstr);
+	const base_type * const k = list->key_list + offset * list->word_width;
 	offset_type i;
 	for (i = 0; i != list->alt_size; ++i) {
 		if (list->alt_list[i][offset] != max_small_value) {
 			x[i] = list->alt_list[i][offset];
 		} else {
-			std::map<std::string, value_type>::const_iterator a = list->alt_map[i].find(key_str);
-			if (a == list->alt_map[i].end()) {
-				x[i] = max_small_value;
-			} else {
-				x[i] = a->second + max_small_value;
-			}
+			x[i] = list->alt_map[i].find(k) + max_small_value;
 		}
 	}
 }
+
+/*
+ * instantiate the templated calls for the dynamic (Words == 0) and the
+ * fixed width key types
+ */
+
+#define HASHZ_KEY_CALLS(W) \
+	template bool hashz::increment(const hashl_key_type<hashz::base_type, W> &); \
+	template bool hashz::increment_alt(const hashl_key_type<hashz::base_type, W> &, hashz::offset_type); \
+	template hashz::value_type hashz::value(const hashl_key_type<hashz::base_type, W> &) const; \
+	template hashz::value_type hashz::value(const hashl_key_type<hashz::base_type, W> &, hashz::value_type []) const;
+
+HASHZ_KEY_CALLS(0)
+HASHZ_KEY_CALLS(1)
+HASHZ_KEY_CALLS(2)
+HASHZ_KEY_CALLS(3)
+
+#undef HASHZ_KEY_CALLS
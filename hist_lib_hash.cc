@@ -4,7 +4,7 @@
 #include "pattern.h"	// Pattern
 #include "read.h"	// Read
 #include "time_used.h"	// elapsed_time(), start_time()
-#include <algorithm>	// swap()
+#include <algorithm>	// sort(), swap()
 #include <ctype.h>	// lowercase()
 #include <itoa.h>	// itoa()
 #include <list>		// list<>
@@ -14,6 +14,8 @@
 #include <stdlib.h>	// exit()
 #include <string>	// string
 #include <sys/types.h>	// size_t
+#include <utility>	// make_pair(), pair<>
+#include <vector>	// vector<>
 
 size_t opt_mer_length;	// this is actually mer length - 1,
 			// for convenience of calculations below
@@ -24,6 +26,8 @@ bool opt_reverse_mask(0);
 hash::value_type opt_repeat_threshold(20);
 hash::value_type opt_repeat_threshold_upper(-1);
 int opt_phred20_anchor(-1);
+size_t opt_mer_partition(0);
+size_t opt_mer_partitions(1);
 size_t opt_repeat_coverage(1);
 size_t opt_skip_size(0);
 std::map<std::string, bool> opt_exclude;
@@ -32,6 +36,13 @@ std::map<std::string, bool> opt_exclude;
 static hash::key_type bp_comp[4];
 static hash::key_type mer_mask;
 
+// which partition an n-mer is in; the key is mixed first so partitions
+// get similar numbers of n-mers, whatever the mer length
+
+static size_t mer_partition(const hash::key_type key) {
+	return ((key * 0x9e3779b97f4a7c15ULL) >> 32) % opt_mer_partitions;
+}
+
 // given the sequence, create the key and comped key for the first mer
 // length - 1 proper (i.e., ACGT) base pairs, returning the current
 // position in the sequence (or end, if there aren't at least mer length
@@ -254,7 +265,11 @@ bool add_sequence_mers(std::list<Read>::const_iterator a, const std::list<Read>:
 			}
 			key = ((key << 2) & mer_mask) | i;
 			comp_key = (comp_key >> 2) | bp_comp[i];
-			if (!mer_list.increment(key < comp_key ? key : comp_key)) {
+			const hash::key_type x(key < comp_key ? key : comp_key);
+			if (opt_mer_partitions > 1 && mer_partition(x) != opt_mer_partition) {
+				continue;
+			}
+			if (!mer_list.increment(x)) {
 				return 0;
 			}
 		}
@@ -298,9 +313,15 @@ void add_sequence_mers_index(std::list<Read>::const_iterator a, const std::list<
 	}
 }
 
-// returns the number of searched kmers in seq
-size_t count_read_hits(const std::string &seq, const KmerLookupInfo &kmers, std::map<hash_read_hits::read_type, int> &read_hits, const hash_read_hits::value_type kmer_max_hits) {
-	size_t total_kmers(0);
+// returns the number of searched kmers in seq; read_hits is set to each
+// read hit (in increasing order) with the number of kmers hitting it;
+// the read lists of the kmers are gathered first, then, if there are few
+// hits, they're sorted and counted in one flat array, otherwise they're
+// counted by read number, rather than counted a read at a time in a map
+size_t count_read_hits(const std::string &seq, const KmerLookupInfo &kmers, std::vector<std::pair<hash_read_hits::read_type, int> > &read_hits, const hash_read_hits::value_type kmer_max_hits) {
+	read_hits.clear();
+	std::vector<std::pair<const hash_read_hits::read_type *, const hash_read_hits::read_type *> > ranges;
+	size_t total_kmers(0), total_hits(0);
 	Read a("", seq);
 	hash::key_type key(0);
 	hash::key_type comp_key(0);
@@ -316,9 +337,41 @@ size_t count_read_hits(const std::string &seq, const KmerLookupInfo &kmers, std:
 		}
 		key = ((key << 2) & mer_mask) | i;
 		comp_key = (comp_key >> 2) | bp_comp[i];
-		kmers.kmer_hash.get_reads(key < comp_key ? key : comp_key, read_hits, kmer_max_hits);
+		const std::pair<const hash_read_hits::read_type *, const hash_read_hits::read_type *> x(kmers.kmer_hash.get_read_range(key < comp_key ? key : comp_key, kmer_max_hits));
+		if (x.first != x.second) {
+			ranges.push_back(x);
+			total_hits += x.second - x.first;
+		}
 		++total_kmers;
 	}
+	const size_t read_count(kmers.read_count());
+	if (total_hits < read_count / 16) {
+		std::vector<hash_read_hits::read_type> hits;
+		hits.reserve(total_hits);
+		for (size_t i(0); i != ranges.size(); ++i) {
+			hits.insert(hits.end(), ranges[i].first, ranges[i].second);
+		}
+		std::sort(hits.begin(), hits.end());
+		for (size_t i(0); i != hits.size(); ++i) {
+			if (read_hits.empty() || read_hits.back().first != hits[i]) {
+				read_hits.push_back(std::make_pair(hits[i], 1));
+			} else {
+				++read_hits.back().second;
+			}
+		}
+	} else {
+		std::vector<int> counts(read_count, 0);
+		for (size_t i(0); i != ranges.size(); ++i) {
+			for (const hash_read_hits::read_type *j(ranges[i].first); j != ranges[i].second; ++j) {
+				++counts[*j];
+			}
+		}
+		for (size_t i(0); i != read_count; ++i) {
+			if (counts[i]) {
+				read_hits.push_back(std::make_pair(hash_read_hits::read_type(i), counts[i]));
+			}
+		}
+	}
 	return total_kmers;
 }
 
@@ -19,6 +19,8 @@ hashn::value_type opt_repeat_threshold(20);
 hashn::value_type opt_repeat_threshold_upper(-1);
 int opt_phred20_anchor(-1);
 int opt_repeat_coverage(1);
+size_t opt_mer_partition(0);
+size_t opt_mer_partitions(1);
 size_t opt_skip_size(0);
 std::map<std::string, bool> opt_exclude;
 
@@ -26,6 +28,13 @@ std::map<std::string, bool> opt_exclude;
 static unsigned long mer_bits;
 static unsigned long mer_length;		// mer_length - 1
 
+// which partition an n-mer is in; the key is mixed first so partitions
+// get similar numbers of n-mers, whatever the mer length
+
+static size_t mer_partition(const hashn::key_type_base &key) {
+	return ((key.hash() * 0x9e3779b97f4a7c15ULL) >> 32) % opt_mer_partitions;
+}
+
 // given the sequence, create the key and comped key for the first mer
 // length - 1 proper (i.e., ACGT) base pairs, returning the current
 // position in the sequence (or end, if there aren't at least mer length
@@ -93,7 +102,11 @@ bool add_sequence_mers(std::list<Read>::const_iterator a, std::list<Read>::const
 			}
 			key.push_back(i);
 			comp_key.push_front(3 - i);
-			if (!mer_list.increment(key < comp_key ? key : comp_key)) {
+			const hashn::key_type &x(key < comp_key ? key : comp_key);
+			if (opt_mer_partitions > 1 && mer_partition(x) != opt_mer_partition) {
+				continue;
+			}
+			if (!mer_list.increment(x)) {
 				return 0;
 			}
 		}
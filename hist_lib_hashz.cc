@@ -1,16 +1,17 @@
+#include "hashl_key_type.h"	/* hashl_key_dispatch() */
 #include "hashz.h"	/* hashz */
 #include "hist_lib_hashz.h"
 #include "pattern.h"	/* Pattern */
 #include "read.h"	/* Read */
 #include "time_used.h"	/* elapsed_time(), start_time() */
 #include <ctype.h>	/* lowercase() */
-#include <gmp.h>	/* mpz_add(), mpz_add_ui(), mpz_clear(), mpz_clrbit(), mpz_cmp(), mpz_fdiv_q_2exp(), mpz_init2(), mpz_init_set(), mpz_mul_2exp(), mpz_realloc2(), mpz_setbit(), mpz_set_ui(), mpz_sizeinbase(), mpz_sub_ui(), mpz_tstbit() */
 #include <list>		/* list<> */
 #include <map>		/* map<> */
 #include <stdio.h>	/* fprintf(), stderr */
 #include <string>	/* string */
 #include <sys/types.h>	/* size_t */
 #include <ctime>	// time()
+#include <type_traits>	// remove_pointer<>
 
 Pattern opt_include;
 bool opt_feedback = 1;
@@ -22,27 +23,33 @@ int opt_repeat_coverage = 1;
 size_t opt_skip_size = 0;
 std::map<std::string, bool> opt_exclude;
 
-/* these four are constants calculated from the mer length */
-static hashz::key_type bp_comp[4];
+/* these three are constants calculated from the mer length */
 static unsigned long mer_bits;
 static unsigned long mer_length;		/* mer_length - 1 */
+static size_t mer_words;
 
-#define INCREMENT(key,comp_key,i) \
-	mpz_clrbit(key, mer_bits - 1); \
-	mpz_clrbit(key, mer_bits - 2); \
-	mpz_mul_2exp(key, key, 2); \
-	mpz_add_ui(key, key, i); \
-	mpz_fdiv_q_2exp(comp_key, comp_key, 2); \
-	mpz_add(comp_key, comp_key, bp_comp[i]);
+/*
+ * the key functions below are templated on the key type (K is one of the
+ * hashl_key_type<> variants), and the public ones pick the one for the
+ * mer length with hashl_key_dispatch()
+ */
+
+template<class K>
+static void increment_keys(K &key, K &comp_key, const int i) {
+	key.push_back(i);
+	comp_key.push_front(3 - i);
+}
 
 /*
  * given the sequence, create the key and comped key for the first mer
  * length - 1 proper (i.e., ACGT) base pairs, returning the current
  * position in the sequence (or end, if there aren't at least mer length
- * proper base pairs); assumes key and comp_key are already initialized
+ * proper base pairs); the keys don't need clearing, as the old base pairs
+ * are all shifted out by the time a full mer length has been added
  */
 
-static size_t preload_keys(const Read &a, size_t s, size_t end, hashz::key_type &key, hashz::key_type &comp_key) {
+template<class K>
+static size_t preload_keys(const Read &a, size_t s, size_t end, K &key, K &comp_key) {
 	a.next_good_sequence(s);
 	if (s == a.size()) {	/* no good characters left */
 		return end;
@@ -51,12 +58,10 @@ static size_t preload_keys(const Read &a, size_t s, size_t end, hashz::key_type
 	if (end2 > end) {		/* less than mer length sequence */
 		return end;
 	}
-	mpz_set_ui(key, 0);
-	mpz_set_ui(comp_key, 0);
 	for (; s != end2; ++s) {
 		int i = a.get_seq(s);
 		if (i != -1) {
-			INCREMENT(key, comp_key, i);
+			increment_keys(key, comp_key, i);
 		} else {	// non-base character - advance to
 				// the next proper base and start over
 			++s;
@@ -69,8 +74,6 @@ static size_t preload_keys(const Read &a, size_t s, size_t end, hashz::key_type
 				/* less than mer length sequence left */
 				return end;
 			}
-			mpz_set_ui(key, 0);
-			mpz_set_ui(comp_key, 0);
 			--s;
 		}
 	}
@@ -82,14 +85,9 @@ static size_t preload_keys(const Read &a, size_t s, size_t end, hashz::key_type
  * forward and comped versions of the sequence
  */
 
-bool add_sequence_mers(std::list<Read>::const_iterator a, std::list<Read>::const_iterator end_a, hashz &mer_list) {
-	if (opt_feedback) {
-		start_time();
-		fprintf(stderr, "%lu : %10lu entries used (%5.2f%%), %lu overflow\n", time(NULL), mer_list.size(), (double)100 * mer_list.size() / mer_list.capacity(), mer_list.overflow_size());
-	}
-	hashz::key_type key, comp_key;
-	mpz_init2(key, mer_bits);
-	mpz_init2(comp_key, mer_bits);
+template<class K>
+static bool add_mers(std::list<Read>::const_iterator a, std::list<Read>::const_iterator end_a, hashz &mer_list) {
+	K key(mer_bits, mer_words), comp_key(mer_bits, mer_words);
 	for (; a != end_a; ++a) {
 		/* print feedback every 10 minutes */
 		if (opt_feedback && elapsed_time() >= 600) {
@@ -112,28 +110,37 @@ bool add_sequence_mers(std::list<Read>::const_iterator a, std::list<Read>::const
 				--s;
 				continue;
 			}
-			INCREMENT(key, comp_key, i);
-			if (!mer_list.increment(mpz_cmp(key, comp_key) < 0 ? key : comp_key)) {
+			increment_keys(key, comp_key, i);
+			if (!mer_list.increment(key < comp_key ? key : comp_key)) {
 				return 0;
 			}
 		}
 	}
-	mpz_clear(key);
-	mpz_clear(comp_key);
-	if (opt_feedback) {
-		fprintf(stderr, "%lu : %10lu entries used (%5.2f%%), %lu overflow\n", time(NULL), mer_list.size(), (double)100 * mer_list.size() / mer_list.capacity(), mer_list.overflow_size());
-	}
 	return 1;
 }
 
-bool add_sequence_mers(std::list<Read>::const_iterator a, std::list<Read>::const_iterator end_a, hashz &mer_list, const std::map<std::string, hashz::offset_type> &opt_readnames_exclude) {
+bool add_sequence_mers(std::list<Read>::const_iterator a, std::list<Read>::const_iterator end_a, hashz &mer_list) {
 	if (opt_feedback) {
 		start_time();
 		fprintf(stderr, "%lu : %10lu entries used (%5.2f%%), %lu overflow\n", time(NULL), mer_list.size(), (double)100 * mer_list.size() / mer_list.capacity(), mer_list.overflow_size());
 	}
-	hashz::key_type key, comp_key;
-	mpz_init2(key, mer_bits);
-	mpz_init2(comp_key, mer_bits);
+	bool added;
+	hashl_key_dispatch<hashz::base_type>(mer_words, [&](auto key_ptr) {
+		typedef typename std::remove_pointer<decltype(key_ptr)>::type key_type;
+		added = add_mers<key_type>(a, end_a, mer_list);
+	});
+	if (!added) {
+		return 0;
+	}
+	if (opt_feedback) {
+		fprintf(stderr, "%lu : %10lu entries used (%5.2f%%), %lu overflow\n", time(NULL), mer_list.size(), (double)100 * mer_list.size() / mer_list.capacity(), mer_list.overflow_size());
+	}
+	return 1;
+}
+
+template<class K>
+static bool add_mers(std::list<Read>::const_iterator a, std::list<Read>::const_iterator end_a, hashz &mer_list, const std::map<std::string, hashz::offset_type> &opt_readnames_exclude) {
+	K key(mer_bits, mer_words), comp_key(mer_bits, mer_words);
 	for (; a != end_a; ++a) {
 		/* print feedback every 10 minutes */
 		if (opt_feedback && elapsed_time() >= 600) {
@@ -160,34 +167,36 @@ bool add_sequence_mers(std::list<Read>::const_iterator a, std::list<Read>::const
 				--s;
 				continue;
 			}
-			INCREMENT(key, comp_key, i);
+			increment_keys(key, comp_key, i);
 			if (x) {
-				if (!mer_list.increment_alt(mpz_cmp(key, comp_key) < 0 ? key : comp_key, x)) {
+				if (!mer_list.increment_alt(key < comp_key ? key : comp_key, x)) {
 					return 0;
 				}
-			} else if (!mer_list.increment(mpz_cmp(key, comp_key) < 0 ? key : comp_key)) {
+			} else if (!mer_list.increment(key < comp_key ? key : comp_key)) {
 				return 0;
 			}
 		}
 	}
-	mpz_clear(key);
-	mpz_clear(comp_key);
-	if (opt_feedback) {
-		fprintf(stderr, "%lu : %10lu entries used (%5.2f%%), %lu overflow\n", time(NULL), mer_list.size(), (double)100 * mer_list.size() / mer_list.capacity(), mer_list.overflow_size());
-	}
 	return 1;
 }
 
-/* convert key to sequence */
-
-std::string convert_key(const hashz::key_type &key) {
-	const char values[4] = { 'A', 'C', 'G', 'T' };
-	std::string sequence;
-	long i;
-	for (i = mer_bits - 1; i != -1; i -= 2) {
-		sequence += values[mpz_tstbit(key, i) * 2 + mpz_tstbit(key, i - 1)];
+bool add_sequence_mers(std::list<Read>::const_iterator a, std::list<Read>::const_iterator end_a, hashz &mer_list, const std::map<std::string, hashz::offset_type> &opt_readnames_exclude) {
+	if (opt_feedback) {
+		start_time();
+		fprintf(stderr, "%lu : %10lu entries used (%5.2f%%), %lu overflow\n", time(NULL), mer_list.size(), (double)100 * mer_list.size() / mer_list.capacity(), mer_list.overflow_size());
+	}
+	bool added;
+	hashl_key_dispatch<hashz::base_type>(mer_words, [&](auto key_ptr) {
+		typedef typename std::remove_pointer<decltype(key_ptr)>::type key_type;
+		added = add_mers<key_type>(a, end_a, mer_list, opt_readnames_exclude);
+	});
+	if (!added) {
+		return 0;
+	}
+	if (opt_feedback) {
+		fprintf(stderr, "%lu : %10lu entries used (%5.2f%%), %lu overflow\n", time(NULL), mer_list.size(), (double)100 * mer_list.size() / mer_list.capacity(), mer_list.overflow_size());
 	}
-	return sequence;
+	return 1;
 }
 
 /* initialize mer-related constants */
@@ -195,35 +204,15 @@ std::string convert_key(const hashz::key_type &key) {
 void init_mer_constants(unsigned long opt_mer_length) {
 	mer_length = opt_mer_length - 1;
 	mer_bits = opt_mer_length * 2;
-	mpz_init2(bp_comp[0], mer_bits);
-	mpz_init2(bp_comp[1], mer_bits);
-	mpz_init2(bp_comp[2], mer_bits);
-	mpz_init2(bp_comp[3], mer_bits);
-	mpz_set_ui(bp_comp[0], 3);
-	mpz_set_ui(bp_comp[1], 2);
-	mpz_set_ui(bp_comp[2], 1);
-	mpz_set_ui(bp_comp[3], 0);
-	mpz_mul_2exp(bp_comp[0], bp_comp[0], mer_bits - 2);
-	mpz_mul_2exp(bp_comp[1], bp_comp[1], mer_bits - 2);
-	mpz_mul_2exp(bp_comp[2], bp_comp[2], mer_bits - 2);
+	mer_words = (mer_bits + 8 * sizeof(hashz::base_type) - 1) / (8 * sizeof(hashz::base_type));
 }
 
 /* count number of kmers, repetitive kmers, and unique repetitive kmers */
 
-void count_kmers(const Read &a, const hashz &mer_list, size_t &kmers, size_t &r_kmers, size_t &ur_kmers) {
-	kmers = r_kmers = 0;
-	if (!opt_include.empty() && !opt_include.is_match(a.name())) {
-		return;
-	}
-	hashz::key_type key, comp_key;
-        mpz_init2(key, mer_bits + 1);
-        mpz_set_ui(key, 1);
-        mpz_mul_2exp(key, key, mer_bits);
-        mpz_sub_ui(key, key, 1);
-        char *key_cstr = new char[mpz_sizeinbase(key, 62) + 2];
-	mpz_realloc2(key, mer_bits);
-	mpz_init2(comp_key, mer_bits);
-	std::map<std::string, bool> r_kmers_list; /* list of repetitive kmers */
+template<class K>
+static void count_mers(const Read &a, const hashz &mer_list, size_t &kmers, size_t &r_kmers, size_t &ur_kmers) {
+	K key(mer_bits, mer_words), comp_key(mer_bits, mer_words);
+	std::map<K, bool> r_kmers_list; /* list of repetitive kmers */
 	size_t end = a.quality_stop;
 	/* set key with first n-mer - 1 bases */
 	size_t s = preload_keys(a, a.quality_start, end, key, comp_key);
@@ -234,21 +223,30 @@ void count_kmers(const Read &a, const hashz &mer_list, size_t &kmers, size_t &r_
 			--s;
 			continue;
 		}
-		INCREMENT(key, comp_key, i);
+		increment_keys(key, comp_key, i);
 		++kmers;
 		/* is this repetitive enough to count as a repeat? */
-		hashz::value_type x = mer_list.value(mpz_cmp(key, comp_key) < 0 ? key : comp_key);
+		const K &x_key = key < comp_key ? key : comp_key;
+		hashz::value_type x = mer_list.value(x_key);
 		if (opt_repeat_threshold <= x && x < opt_repeat_threshold_upper) {
 			++r_kmers;
-			mpz_get_str(key_cstr, 62, mpz_cmp(key, comp_key) < 0 ? key : comp_key);
-			r_kmers_list[key_cstr] = 1;
+			r_kmers_list[x_key] = 1;
 		}
 	}
-	mpz_clear(key);
-	mpz_clear(comp_key);
 	ur_kmers = r_kmers_list.size();
 }
 
+void count_kmers(const Read &a, const hashz &mer_list, size_t &kmers, size_t &r_kmers, size_t &ur_kmers) {
+	kmers = r_kmers = 0;
+	if (!opt_include.empty() && !opt_include.is_match(a.name())) {
+		return;
+	}
+	hashl_key_dispatch<hashz::base_type>(mer_words, [&](auto key_ptr) {
+		typedef typename std::remove_pointer<decltype(key_ptr)>::type key_type;
+		count_mers<key_type>(a, mer_list, kmers, r_kmers, ur_kmers);
+	});
+}
+
 /* check to see if position s should be masked */
 
 static void check_mask(size_t s, const std::list<int> &window, int total, std::string &mask) {
@@ -273,11 +271,10 @@ static void check_mask(size_t s, const std::list<int> &window, int total, std::s
 
 /* create mask for highly repetitive regions - 'X's are to be masked out */
 
+template<class K>
 static void create_mask(const Read &a, const hashz &mer_list, std::string &mask) {
 	mask.resize(a.size(), ' ');
-	hashz::key_type key, comp_key;
-	mpz_init2(key, mer_bits);
-	mpz_init2(comp_key, mer_bits);
+	K key(mer_bits, mer_words), comp_key(mer_bits, mer_words);
 	int total = 0;		/* number of repeats in current window */
 	std::list<int> window;
 	size_t end = a.quality_stop;
@@ -301,21 +298,19 @@ static void create_mask(const Read &a, const hashz &mer_list, std::string &mask)
 			--s;
 			continue;
 		}
-		INCREMENT(key, comp_key, i);
+		increment_keys(key, comp_key, i);
 		/* if window is full sized (mer length), pop first value */
 		if (window.size() == (size_t)(mer_length + 1)) {
 			total -= window.front();
 			window.pop_front();
 		}
 		/* is this repetitive enough to count as a repeat? */
-		hashz::value_type x = mer_list.value(mpz_cmp(key, comp_key) < 0 ? key : comp_key);
+		hashz::value_type x = mer_list.value(key < comp_key ? key : comp_key);
 		int j = (opt_repeat_threshold <= x && x < opt_repeat_threshold_upper) ? 1 : 0;
 		total += j;
 		window.push_back(j);
 		check_mask(s - mer_length, window, total, mask);
 	}
-	mpz_clear(key);
-	mpz_clear(comp_key);
 	/* fill out window for short sections */
 	window.insert(window.begin(), mer_length + 1 - window.size(), 0);
 	for (s -= mer_length; window.size() > 1; ++s) {
@@ -429,7 +424,10 @@ void screen_repeats(Read &a, const hashz &mer_list) {
 		return;
 	}
 	std::string mask;
-	create_mask(a, mer_list, mask);
+	hashl_key_dispatch<hashz::base_type>(mer_words, [&](auto key_ptr) {
+		typedef typename std::remove_pointer<decltype(key_ptr)>::type key_type;
+		create_mask<key_type>(a, mer_list, mask);
+	});
 	size_t phred20_start;
 	size_t phred20_stop;
 	if (opt_phred20_anchor == -1) {
@@ -475,12 +473,11 @@ static int check_unique(bool is_phred20, const std::list<int> &window, int total
  * total number of phred20's for comparison
  */
 
+template<class K>
 static unsigned long count_phreds(const Read &a, const hashz &mer_list, unsigned long *total_phreds_out) {
 	unsigned long total_phreds = 0;
 	unsigned long total_unique_phreds = 0;
-	hashz::key_type key, comp_key;
-	mpz_init2(key, mer_bits);
-	mpz_init2(comp_key, mer_bits);
+	K key(mer_bits, mer_words), comp_key(mer_bits, mer_words);
 	int total = 0;		/* number of repeats in current window */
 	std::list<int> window;
 	size_t end = a.quality_stop;
@@ -510,14 +507,14 @@ static unsigned long count_phreds(const Read &a, const hashz &mer_list, unsigned
 			--s;
 			continue;
 		}
-		INCREMENT(key, comp_key, i);
+		increment_keys(key, comp_key, i);
 		/* if window is full sized (mer length), pop first value */
 		if (window.size() == (size_t)(mer_length + 1)) {
 			total -= window.front();
 			window.pop_front();
 		}
 		/* is this repetitive enough to count as a repeat? */
-		hashz::value_type x = mer_list.value(mpz_cmp(key, comp_key) < 0 ? key : comp_key);
+		hashz::value_type x = mer_list.value(key < comp_key ? key : comp_key);
 		int j = (opt_repeat_threshold <= x && x < opt_repeat_threshold_upper) ? 1 : 0;
 		total += j;
 		window.push_back(j);
@@ -526,8 +523,6 @@ static unsigned long count_phreds(const Read &a, const hashz &mer_list, unsigned
 		}
 		total_unique_phreds += check_unique(a.is_high_quality(s), window, total, &state);
 	}
-	mpz_clear(key);
-	mpz_clear(comp_key);
 	for (s -= mer_length; window.size() > 1; ++s) {
 		total -= window.front();
 		window.pop_front();
@@ -553,29 +548,19 @@ static unsigned long count_phreds(const Read &a, const hashz &mer_list, unsigned
 unsigned long count_unique_phreds(const std::list<Read> &read_list, const hashz &mer_list, unsigned long *total_phreds_out) {
 	unsigned long total_phreds = 0;
 	unsigned long total_unique_phreds = 0;
-	std::list<Read>::const_iterator a = read_list.begin();
-	std::list<Read>::const_iterator end = read_list.end();
-	for (; a != end; ++a) {
-		unsigned long read_phreds;
-		total_unique_phreds += count_phreds(*a, mer_list, &read_phreds);
-		total_phreds += read_phreds;
-	}
+	hashl_key_dispatch<hashz::base_type>(mer_words, [&](auto key_ptr) {
+		typedef typename std::remove_pointer<decltype(key_ptr)>::type key_type;
+		std::list<Read>::const_iterator a = read_list.begin();
+		std::list<Read>::const_iterator end = read_list.end();
+		for (; a != end; ++a) {
+			unsigned long read_phreds;
+			total_unique_phreds += count_phreds<key_type>(*a, mer_list, &read_phreds);
+			total_phreds += read_phreds;
+		}
+	});
 	if (total_phreds_out != NULL) {
 		*total_phreds_out = total_phreds;
 	}
 	return total_unique_phreds;
 }
 
-/* assumes key_out is already initialized */
-void reverse_key(const hashz::key_type &key_in, hashz::key_type &key_out) {
-	mpz_set_ui(key_out, 0);
-	unsigned long i, j;
-	for (i = 0, j = mer_bits - 1; i != mer_bits; i += 2, j -= 2) {
-		if (!mpz_tstbit(key_in, i + 1)) {
-			mpz_setbit(key_out, j);
-		}
-		if (!mpz_tstbit(key_in, i)) {
-			mpz_setbit(key_out, j - 1);
-		}
-	}
-}
@@ -1,5 +1,6 @@
 #include "hash.h"	// hash
-#include "hist_lib_hash.h"	// add_sequence_mers(), add_sequence_mers_hp(), clear_mer_list(), convert_key(), convert_key_hp(), init_mer_constants(), opt_feedback, opt_include, opt_mer_length, opt_skip_size, print_final_input_feedback(), reverse_key()
+#include "hash_probe.h"	// hash_probe
+#include "hist_lib_hash.h"	// add_sequence_mers(), add_sequence_mers_hp(), clear_mer_list(), convert_key(), convert_key_hp(), init_mer_constants(), opt_feedback, opt_include, opt_mer_length, opt_mer_partition, opt_mer_partitions, opt_skip_size, print_final_input_feedback(), reverse_key()
 #include "open_compressed.h"	// close_compressed(), get_suffix(), open_compressed(), pfgets()
 #include "read.h"	// Read, init_read_comp(), opt_clip_quality, opt_clip_vector, opt_quality_cutoff
 #include "read_file.h"	// ReadFile, opt_strip_tracename
@@ -22,9 +23,11 @@ static bool opt_homopolymer;
 static bool opt_print_gc;
 static bool opt_track_dups;
 static bool opt_warnings;
+static hash_probe::probe_type opt_probe_type;
 static int opt_readnames_exclude;
 static size_t opt_batch_size;
 static size_t opt_nmers;
+static size_t opt_only_partition;
 static std::list<std::string> opt_histogram_restore;
 static std::map<std::string, hash::offset_type> opt_readnames;
 static std::string opt_save_file;
@@ -116,9 +119,7 @@ static unsigned long count_gc(hash::key_type key) {
 // print histogram of n-mer occurrences, potentially with gc percent at given
 // frequencies
 
-static void print_mer_histogram(FILE *fp_out, hash &mer_list) {
-	std::map<hash::value_type, unsigned long> counts;
-	std::map<hash::value_type, unsigned long> gc_counts;
+static void count_mer_histogram(hash &mer_list, std::map<hash::value_type, unsigned long> &counts, std::map<hash::value_type, unsigned long> &gc_counts) {
 	hash::const_iterator a(mer_list.begin());
 	const hash::const_iterator end_a(mer_list.end());
 	for (; a != end_a; ++a) {
@@ -134,6 +135,9 @@ static void print_mer_histogram(FILE *fp_out, hash &mer_list) {
 			}
 		//}
 	}
+}
+
+static void print_mer_histogram(FILE *fp_out, const std::map<hash::value_type, unsigned long> &counts, std::map<hash::value_type, unsigned long> &gc_counts) {
 	std::map<hash::value_type, unsigned long>::const_iterator c(counts.begin());
 	const std::map<hash::value_type, unsigned long>::const_iterator end_c(counts.end());
 	// don't include single occurrences in total
@@ -163,6 +167,13 @@ static void print_mer_histogram(FILE *fp_out, hash &mer_list) {
 	}
 }
 
+static void print_mer_histogram(FILE *fp_out, hash &mer_list) {
+	std::map<hash::value_type, unsigned long> counts;
+	std::map<hash::value_type, unsigned long> gc_counts;
+	count_mer_histogram(mer_list, counts, gc_counts);
+	print_mer_histogram(fp_out, counts, gc_counts);
+}
+
 static void print_mer_histogram_hp(FILE *fp_out, hash &mer_list) {
 	std::map<hash::value_type, unsigned long> counts;
 	std::map<int, unsigned long> counts_length;
@@ -323,7 +334,13 @@ static void print_usage() {
 		"    -L ## filename containing names of reads to compare with results\n"
 		"          (count is by given reads, frequency is by other reads)\n"
 		"    -m ## set mer length (1-32) [24]\n"
+		"    -N ## split n-mers into ## partitions, and count one partition at a time,\n"
+		"          rereading the input for each (-z is then the size of each partition)\n"
+		"    -n ## only count partition ## (1 to the -N value); the histograms of\n"
+		"          all the partitions add up to the full histogram\n"
 		"    -o ## print output to file instead of stdout\n"
+		"    -P ## hash table probing: prime, linear, or quadratic [prime]\n"
+		"          (linear and quadratic use power of two table sizes)\n"
 		"    -p ## don't touch reads not matching pattern (an extended regex)\n"
 		"    -q    turn off all warnings\n"
 		"    -s ## save histogram memory structure to file\n"
@@ -356,8 +373,11 @@ static FILE *get_opts(int argc, char **argv) {
 	opt_hash_clean = 0;
 	opt_homopolymer = 0;
 	opt_mer_length = 24;
+	opt_mer_partitions = 1;
 	opt_nmers = static_cast<size_t>(-1);
+	opt_only_partition = 0;
 	opt_print_gc = 0;
+	opt_probe_type = hash_probe::PRIME;
 	opt_quality_cutoff = 20;
 	opt_readnames_exclude = 0;
 	opt_skip_size = 0;
@@ -366,7 +386,7 @@ static FILE *get_opts(int argc, char **argv) {
 	opt_warnings = 1;
 	FILE *fp_out(0);
 	int c;
-	while ((c = getopt(argc, argv, "aB:cdf:ghHik:l:L:m:o:p:qs:S:tT:vVw:W:z:Z")) != EOF) {
+	while ((c = getopt(argc, argv, "aB:cdf:ghHik:l:L:m:N:n:o:P:p:qs:S:tT:vVw:W:z:Z")) != EOF) {
 		switch (c) {
 		    case 'a':
 			opt_aggregate = 1;
@@ -434,9 +454,31 @@ static FILE *get_opts(int argc, char **argv) {
 				print_usage();
 			}
 			break;
+		    case 'N':
+			c = atoi(optarg);
+			if (c < 1) {
+				fprintf(stderr, "Error: bad partition count %s\n", optarg);
+				print_usage();
+			}
+			opt_mer_partitions = c;
+			break;
+		    case 'n':
+			c = atoi(optarg);
+			if (c < 1) {
+				fprintf(stderr, "Error: bad partition %s\n", optarg);
+				print_usage();
+			}
+			opt_only_partition = c;
+			break;
 		    case 'o':
 			opt_output = optarg;
 			break;
+		    case 'P':
+			if (!hash_probe::parse_name(optarg, opt_probe_type)) {
+				fprintf(stderr, "Error: unknown probe type: %s\n", optarg);
+				exit(1);
+			}
+			break;
 		    case 'p':
 			opt_include.initialize(optarg, 0, REG_NOSUB | REG_EXTENDED);
 			break;
@@ -510,6 +552,17 @@ static FILE *get_opts(int argc, char **argv) {
 		fprintf(stderr, "Error: no files to process\n");
 		print_usage();
 	}
+	if (opt_only_partition != 0 && opt_mer_partitions < 2) {
+		fprintf(stderr, "Error: -n option requires -N option\n");
+		exit(1);
+	} else if (opt_only_partition > opt_mer_partitions) {
+		fprintf(stderr, "Error: -n value larger than -N value\n");
+		exit(1);
+	}
+	if (opt_mer_partitions > 1 && (opt_homopolymer || opt_readnames_exclude != 0 || !opt_histogram_restore.empty() || !opt_save_file.empty())) {
+		fprintf(stderr, "Error: cannot use -N option with -H, -l, -L, -S, or -s options\n");
+		exit(1);
+	}
 	if (opt_readnames_exclude != 0 && !opt_tmp_file_prefix.empty()) {
 		fprintf(stderr, "Error: cannot use -T option with either -l or -L options\n");
 		exit(1);
@@ -564,33 +617,42 @@ static void restore_histogram(hash &mer_list) {
 	}
 }
 
+// add the n-mers of a file to mer_list; returns 1 if it couldn't be read
+
+static int add_file_mers(const char * const filename, hash &mer_list) {
+	if (opt_feedback) {
+		fprintf(stderr, "Reading in %s\n", filename);
+	}
+	ReadFile file(filename, opt_batch_size, opt_track_dups);
+	if (file.seq_file.empty()) {
+		return 1;
+	}
+	size_t total_reads(0);
+	while (file.read_batch(opt_warnings) != -1) {
+		if (opt_homopolymer) {
+			if (!add_sequence_mers_hp(file.read_list.begin(), file.read_list.end(), mer_list, total_reads)) {
+				fprintf(stderr, "Error: n-mer list incomplete - give a larger -z value\n");
+			}
+		} else if (opt_readnames_exclude) {
+			if (!add_sequence_mers(file.read_list.begin(), file.read_list.end(), mer_list, opt_readnames, total_reads)) {
+				fprintf(stderr, "Error: n-mer list incomplete - give a larger -z value\n");
+			}
+		} else if (!add_sequence_mers(file.read_list.begin(), file.read_list.end(), mer_list, total_reads)) {
+			fprintf(stderr, "Error: n-mer list incomplete - give a larger -z value\n");
+		}
+		total_reads += file.read_list.size();
+	}
+	return 0;
+}
+
 static int create_histogram(const int argc, char ** const argv, FILE *fp_out, hash &mer_list) {
 	int err(0);
 	mer_list.init(opt_nmers, abs(opt_readnames_exclude));
 	for (; optind != argc; ++optind) {
-		if (opt_feedback) {
-			fprintf(stderr, "Reading in %s\n", argv[optind]);
-		}
-		ReadFile file(argv[optind], opt_batch_size, opt_track_dups);
-		if (file.seq_file.empty()) {
+		if (add_file_mers(argv[optind], mer_list)) {
 			++err;
 			continue;
 		}
-		size_t total_reads(0);
-		while (file.read_batch(opt_warnings) != -1) {
-			if (opt_homopolymer) {
-				if (!add_sequence_mers_hp(file.read_list.begin(), file.read_list.end(), mer_list, total_reads)) {
-					fprintf(stderr, "Error: n-mer list incomplete - give a larger -z value\n");
-				}
-			} else if (opt_readnames_exclude) {
-				if (!add_sequence_mers(file.read_list.begin(), file.read_list.end(), mer_list, opt_readnames, total_reads)) {
-					fprintf(stderr, "Error: n-mer list incomplete - give a larger -z value\n");
-				}
-			} else if (!add_sequence_mers(file.read_list.begin(), file.read_list.end(), mer_list, total_reads)) {
-				fprintf(stderr, "Error: n-mer list incomplete - give a larger -z value\n");
-			}
-			total_reads += file.read_list.size();
-		}
 		if (!opt_aggregate) {
 			if (opt_feedback) {
 				fprintf(stderr, "Printing histogram\n");
@@ -625,6 +687,70 @@ static int create_histogram(const int argc, char ** const argv, FILE *fp_out, ha
 	return err;
 }
 
+// count one partition of the n-mers at a time, rereading the input for
+// each; no n-mer is in more than one partition, so the histograms of the
+// partitions just add up, and the hash only has to hold one partition
+
+static int create_histogram_partitioned(const int argc, char ** const argv, FILE *fp_out, hash &mer_list) {
+	int err(0);
+	mer_list.init(opt_nmers);
+	const size_t first_partition(opt_only_partition ? opt_only_partition - 1 : 0);
+	const size_t end_partition(opt_only_partition ? opt_only_partition : opt_mer_partitions);
+	// without -a, each file gets its own histogram
+	for (int i(optind); i != argc;) {
+		const int end_i(opt_aggregate ? argc : i + 1);
+		bool unreadable(0);
+		std::map<hash::value_type, unsigned long> counts;
+		std::map<hash::value_type, unsigned long> gc_counts;
+		for (opt_mer_partition = first_partition; opt_mer_partition != end_partition; ++opt_mer_partition) {
+			if (opt_feedback) {
+				fprintf(stderr, "Counting partition %lu of %lu\n", opt_mer_partition + 1, opt_mer_partitions);
+			}
+			for (int j(i); j != end_i; ++j) {
+				// only count unreadable files once
+				if (add_file_mers(argv[j], mer_list) && opt_mer_partition == first_partition) {
+					++err;
+					unreadable = 1;
+				}
+			}
+			// the header waits for the file to be read, so that, as
+			// with create_histogram(), unreadable files are skipped
+			if (!opt_aggregate && opt_mer_partition == first_partition) {
+				if (unreadable) {
+					clear_mer_list(mer_list);
+					break;
+				}
+				fprintf(fp_out, "%s\n", argv[i]);
+				for (int k(strlen(argv[i])); k != 0; --k) {
+					putc('-', fp_out);
+				}
+				fprintf(fp_out, "\n");
+			}
+			if (opt_frequency_min == 0 && opt_frequency_max == 0) {
+				count_mer_histogram(mer_list, counts, gc_counts);
+			} else {
+				print_mer_frequency(fp_out, mer_list);
+			}
+			clear_mer_list(mer_list);
+		}
+		if (!opt_aggregate && unreadable) {
+			i = end_i;
+			continue;
+		}
+		if (opt_frequency_min == 0 && opt_frequency_max == 0) {
+			if (opt_feedback) {
+				fprintf(stderr, "Printing histogram\n");
+			}
+			print_mer_histogram(fp_out, counts, gc_counts);
+		}
+		if (end_i != argc) {
+			fprintf(fp_out, "\n");
+		}
+		i = end_i;
+	}
+	return err;
+}
+
 int main(int argc, char **argv) {
 	FILE *fp_out(get_opts(argc, argv));
 	if (opt_feedback) {
@@ -633,6 +759,7 @@ int main(int argc, char **argv) {
 	init_mer_constants();
 	int err(0);
 	hash mer_list;
+	mer_list.set_probe_type(opt_probe_type);
 	if (opt_hash_clean || !opt_tmp_file_prefix.empty()) {
 		// have to add one to opt_mer_length,
 		// as init_mer_constants() subtracts one
@@ -644,10 +771,13 @@ int main(int argc, char **argv) {
 	}
 	if (!opt_histogram_restore.empty()) {
 		restore_histogram(mer_list);
+	} else if (opt_mer_partitions > 1) {
+		err = create_histogram_partitioned(argc, argv, fp_out, mer_list);
 	} else {
 		err = create_histogram(argc, argv, fp_out, mer_list);
 	}
-	if (opt_aggregate) {
+	// partitions are printed as they're done
+	if (opt_aggregate && opt_mer_partitions == 1) {
 		if (opt_feedback) {
 			print_final_input_feedback(mer_list);
 			fprintf(stderr, "Printing histogram\n");
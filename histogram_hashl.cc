@@ -1,35 +1,46 @@
+#include "hash_probe.h"	// hash_probe
 #include "hashl.h"	// hashl
+#include "hashl_key_type.h"	// hashl_key_dispatch()
 #include "hashl_metadata.h"	// hashl_metadata
+#include "hashl_runs.h"	// hashl_runs
 #include "open_compressed.h"	// close_compressed(), get_suffix(), open_compressed(), pfgets()
 #include "time_used.h"	// elapsed_time(), start_time()
 #include "version.h"	// VERSION
 #include "write_fork.h"	// close_fork(), write_fork()
 #include <fstream>	// ofstream
+#include <functional>	// cref(), ref()
 #include <getopt.h>	// getopt(), optarg, optind
 #include <iomanip>	// fixed, setprecision()
 #include <iostream>	// cerr, cout, ostream
 #include <list>		// list<>
 #include <map>		// map<>
+#include <mutex>	// lock_guard<>, mutex
 #include <set>		// set<>
 #include <sstream>	// istringstream
 #include <stdint.h>	// uint64_t
 #include <stdlib.h>	// exit()
 #include <string.h>	// memcpy()
 #include <string>	// string
+#include <thread>	// thread
+#include <type_traits>	// remove_pointer<>
 #include <unordered_map>	// unordered_map<>
 #include <utility>	// make_pair(), pair<>
 #include <vector>	// vector<>
 
 static bool opt_feedback;
+static bool opt_mappable_save;
 static bool opt_print_gc;
 static double opt_load_lower_bound;
 static double opt_load_upper_bound;
+static hash_probe::probe_type opt_probe_type;
 static int opt_histogram_restore;
+static int opt_threads;
 static size_t opt_frequency_cutoff;
 static size_t opt_max_repeats;
 static size_t opt_mer_length;
 static size_t opt_nmers;
 static size_t opt_window_size;
+static std::string opt_runs_file;
 static std::string opt_save_file;
 
 static void save_memory(const hashl &mer_list) {
@@ -38,7 +49,19 @@ static void save_memory(const hashl &mer_list) {
 		std::cerr << "Error: could not save memory\n";
 		exit(1);
 	}
-	mer_list.save(fd);
+	mer_list.save(fd, opt_mappable_save);
+	close_fork(fd);
+}
+
+// sorted runs are never compressed, like indexes
+
+static void save_runs(const hashl &mer_list) {
+	const int fd(write_fork(std::list<std::string>(), opt_runs_file));
+	if (fd == -1) {
+		std::cerr << "Error: could not save runs\n";
+		exit(1);
+	}
+	hashl_runs::save(mer_list, fd, opt_threads);
 	close_fork(fd);
 }
 
@@ -55,12 +78,6 @@ static std::string convert_key(const hashl::key_type &key) {
 	return sequence;
 }
 
-static void reverse_key(const hashl::key_type &key_in, hashl::key_type &key_out) {
-	for (size_t i(0); i < opt_mer_length * 2; i += 2) {
-		key_out.push_back(3 - key_in.basepair(i));
-	}
-}
-
 void print_final_input_feedback(const hashl &mer_list) {
 	if (opt_feedback && mer_list.size() != 0) {
 		std::cerr << time(0) << ": " << mer_list.size() << " entries used (" << double(100) * mer_list.size() / mer_list.capacity() << ")\n";
@@ -77,7 +94,7 @@ static void print_mer_frequency(std::ostream &fp_out, const hashl &mer_list) {
 		if (*a >= opt_frequency_cutoff) {
 			a.key(key);
 			fp_out << convert_key(key) << ' ' << static_cast<unsigned int>(*a) << "\n";
-			reverse_key(key, comp_key);
+			comp_key.make_complement(key);
 			if (key != comp_key) {
 				fp_out << convert_key(comp_key) << ' ' << static_cast<unsigned int>(*a) << "\n";
 			}
@@ -177,6 +194,8 @@ static size_t get_value(const std::string s) {
 static void print_usage() {
 	std::cerr <<
 		"usage: histogram [options] file1 [file2] ...\n"
+		"    -A    save (-s) in the larger, memory-mappable format (use with an\n"
+		"          uncompressed file name)\n"
 		"    -g    print percent gc content at each frequency\n"
 		"    -h    print this information\n"
 		"    -i    turn off status updates\n"
@@ -184,9 +203,14 @@ static void print_usage() {
 		"    -L ## upper bound for hash fill fraction\n"
 		"    -m ## set mer length [24]\n"
 		"    -o ## print output to file instead of stdout\n"
+		"    -P ## hash table probing: prime, linear, or quadratic [prime]\n"
+		"          (linear and quadratic use power of two table sizes)\n"
+		"    -r ## save sorted runs of the n-mers to file (see merge_kmers_hashl)\n"
 		"    -R ## maximum number of repeats in window to still be \"unique\" [6]\n"
 		"    -s ## save histogram memory structure to file\n"
 		"    -S ## load histogram memory dump from given file\n"
+		"    -t ## number of counting threads [1] (data offsets stored for repeated\n"
+		"          n-mers may vary from run to run with more than one thread)\n"
 		"    -V    print version\n"
 		"    -w ## print frequency count instead of histogram, for all n-mers with\n"
 		"          a frequency of at least ## [0 (off)] (-1 => print nothing)\n"
@@ -209,11 +233,17 @@ static std::ostream &get_opts(int argc, char **argv) {
 	opt_print_gc = 0;
 	opt_load_lower_bound = 0;
 	opt_load_upper_bound = 1;
+	opt_mappable_save = 0;
 	opt_nmers = 0;
+	opt_probe_type = hash_probe::PRIME;
+	opt_threads = 1;
 	opt_window_size = 0;
 	int c;
-	while ((c = getopt(argc, argv, "ghil:L:m:o:R:s:S:Vw:W:z:")) != EOF) {
+	while ((c = getopt(argc, argv, "Aghil:L:m:o:P:r:R:s:S:t:Vw:W:z:")) != EOF) {
 		switch (c) {
+		    case 'A':
+			opt_mappable_save = 1;
+			break;
 		    case 'g':
 			opt_print_gc = 1;
 			break;
@@ -243,6 +273,19 @@ static std::ostream &get_opts(int argc, char **argv) {
 				exit(1);
 			}
 			break;
+		    case 'P':
+			if (!hash_probe::parse_name(optarg, opt_probe_type)) {
+				std::cerr << "Error: unknown probe type: " << optarg << "\n";
+				exit(1);
+			}
+			break;
+		    case 'r':
+			opt_runs_file = optarg;
+			if (!used_files.insert(optarg).second) {
+				std::cerr << "Error: duplicate file: " << optarg << "\n";
+				exit(1);
+			}
+			break;
 		    case 'R':
 			std::istringstream(optarg) >> opt_max_repeats;
 			break;
@@ -263,6 +306,13 @@ static std::ostream &get_opts(int argc, char **argv) {
 				exit(1);
 			}
 			break;
+		    case 't':
+			std::istringstream(optarg) >> opt_threads;
+			if (opt_threads < 1) {
+				std::cerr << "Error: -t requires positive value\n";
+				exit(1);
+			}
+			break;
 		    case 'V':
 			std::cerr << "histogram_hashl version " << VERSION <<
 #ifdef COMPRESS_READS
@@ -327,8 +377,8 @@ static void get_subread_sizes(const std::string &seq, hashl_metadata &metadata)
 	}
 }
 
-// read file and get total space needed for data and metadata
-static void get_read_sizes(hashl_metadata &metadata, const std::string &file) {
+// read file, collecting metadata and packing sequence as it goes
+static void read_file(hashl_metadata &metadata, const std::string &file) {
 	const int fd(open_compressed(file));
 	if (fd == -1) {
 		std::cerr << "Error: open: " << file << "\n";
@@ -347,6 +397,7 @@ static void get_read_sizes(hashl_metadata &metadata, const std::string &file) {
 				seq += line;
 			}
 			get_subread_sizes(seq, metadata);
+			metadata.add_read_data(seq);
 		} while (!line.empty());
 	} else if (line[0] == '@') {		// fastq file
 		do {
@@ -358,6 +409,7 @@ static void get_read_sizes(hashl_metadata &metadata, const std::string &file) {
 				exit(1);
 			}
 			get_subread_sizes(seq, metadata);
+			metadata.add_read_data(seq);
 			// skip quality header and quality
 			// (use seq as buffer because it'll be the same length as quality)
 			if (pfgets(fd, line) == -1 || pfgets(fd, seq) == -1) {
@@ -372,15 +424,66 @@ static void get_read_sizes(hashl_metadata &metadata, const std::string &file) {
 	close_compressed(fd);
 }
 
+// each thread reads in whole files, into a separate hashl_metadata per file
+
+static void read_files_thread(std::vector<hashl_metadata> &file_metadata, const std::vector<std::string> &file_list, size_t &next_file, std::mutex &mutex) {
+	for (;;) {
+		size_t i;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (next_file == file_list.size()) {
+				return;
+			}
+			i = next_file++;
+			if (opt_feedback) {
+				std::cerr << time(0) << ": Reading in " << file_list[i] << "\n";
+			}
+		}
+		file_metadata[i].start_data();
+		file_metadata[i].add_filename(file_list[i]);
+		read_file(file_metadata[i], file_list[i]);
+		file_metadata[i].finalize_file();
+	}
+}
+
+// the packed sequence for each file starts wherever the previous file's
+// ended, which isn't known until it's been read, so files are read
+// into their own buffers and then added, in order, to metadata
+
+static void read_files_threaded(hashl_metadata &metadata, const std::vector<std::string> &file_list) {
+	std::vector<hashl_metadata> file_metadata(file_list.size());
+	size_t next_file(0);
+	std::mutex mutex;
+	const int thread_count(opt_threads < int(file_list.size()) ? opt_threads : file_list.size());
+	std::thread threads[thread_count];
+	for (int i(0); i < thread_count; ++i) {
+		threads[i] = std::thread(read_files_thread, std::ref(file_metadata), std::cref(file_list), std::ref(next_file), std::ref(mutex));
+	}
+	for (int i(0); i < thread_count; ++i) {
+		threads[i].join();
+	}
+	for (auto &a : file_metadata) {
+		metadata.add_data(a);
+	}
+}
+
+// K is one of the hashl_key_type<> variants (see hashl_key_dispatch())
+
+template<class K>
 class CountState {
     public:
-	hashl::key_type key, comp_key;
+	K key, comp_key;
     private:
 	size_t j, k;
-	const std::vector<hashl::base_type> &data;
+	const hashl_vector<hashl::base_type> &data;
     public:
 	explicit CountState(const hashl &mer_list) : key(mer_list.bits(), mer_list.words()), comp_key(mer_list.bits(), mer_list.words()), j(0), k(sizeof(hashl::base_type) * 8 - 2), data(mer_list.get_data()) { }
 	~CountState() { }
+	// move to given basepair offset in data
+	void seek(const size_t i) {
+		j = 2 * i / (sizeof(hashl::base_type) * 8);
+		k = sizeof(hashl::base_type) * 8 - 2 - 2 * i % (sizeof(hashl::base_type) * 8);
+	}
 	void increment_keys() {
 		const hashl::base_type c = (data[j] >> k) & 3;
 		key.push_back(c);
@@ -394,8 +497,116 @@ class CountState {
 	}
 };
 
+// nmers waiting to be counted, so the hash lookups can be done a
+// block at a time (see hashl::increment_batch())
+
+template<class K>
+class CountBatch {
+    private:
+	std::vector<K> keys, comp_keys;
+	std::vector<size_t> offsets;
+	size_t n;
+    public:
+	explicit CountBatch(const hashl &mer_list) : keys(hashl::batch_size, K(mer_list.bits(), mer_list.words())), comp_keys(keys), offsets(hashl::batch_size), n(0) { }
+	~CountBatch() { }
+	// returns true if the batch is now full
+	bool add(const CountState<K> &x, const size_t offset) {
+		keys[n] = x.key;
+		comp_keys[n] = x.comp_key;
+		offsets[n] = offset;
+		return ++n == hashl::batch_size;
+	}
+	void flush(hashl &mer_list, const bool shared) {
+		if (n && !(shared ? mer_list.increment_atomic_batch(&keys[0], &comp_keys[0], &offsets[0], n) : mer_list.increment_batch(&keys[0], &comp_keys[0], &offsets[0], n))) {
+			std::cerr << "Error: ran out of space in hash\n";
+			exit(1);
+		}
+		n = 0;
+	}
+};
+
+// hands out batches of read ranges to the counting threads
+
+class RangeBatches {
+    private:
+	std::mutex mutex_;
+	std::vector<std::pair<size_t, size_t> > ranges_;	// basepair start, end
+	std::vector<size_t> batch_ends_;			// index into ranges_
+	size_t next_batch_;
+    public:
+	// if split_ranges, long ranges are broken up, overlapping by
+	// opt_mer_length - 1 so no nmers are lost or double counted
+	explicit RangeBatches(const std::vector<size_t> &read_ends, const bool split_ranges) : next_batch_(0) {
+		// big enough to make locking overhead irrelevant,
+		// small enough to keep all the threads busy to the end
+		const size_t batch_size = 1 << 20;
+		size_t start = 0, batch_length = 0;
+		for (const auto &read_end : read_ends) {
+			while (split_ranges && read_end - start > batch_size + opt_mer_length - 1) {
+				ranges_.push_back(std::make_pair(start, start + batch_size + opt_mer_length - 1));
+				batch_ends_.push_back(ranges_.size());
+				batch_length = 0;
+				start += batch_size;
+			}
+			ranges_.push_back(std::make_pair(start, read_end));
+			batch_length += read_end - start;
+			if (batch_length >= batch_size) {
+				batch_ends_.push_back(ranges_.size());
+				batch_length = 0;
+			}
+			start = read_end;
+		}
+		if (batch_ends_.empty() || batch_ends_.back() != ranges_.size()) {
+			batch_ends_.push_back(ranges_.size());
+		}
+	}
+	~RangeBatches() { }
+	// returns 0 when there's nothing left to do
+	bool get_next(size_t &start_out, size_t &end_out) {
+		std::lock_guard<std::mutex> lock(mutex_);
+		// print feedback every 10 minutes
+		if (opt_feedback && elapsed_time() >= 600) {
+			start_time();
+			std::cerr << time(0) << ": " << (next_batch_ ? batch_ends_[next_batch_ - 1] : 0) << " of " << ranges_.size() << " read ranges started\n";
+		}
+		if (next_batch_ == batch_ends_.size()) {
+			return 0;
+		}
+		start_out = next_batch_ ? batch_ends_[next_batch_ - 1] : 0;
+		end_out = batch_ends_[next_batch_++];
+		return 1;
+	}
+	const std::pair<size_t, size_t> &range(const size_t i) const {
+		return ranges_[i];
+	}
+};
+
+// count all nmers in the given range (basepair offsets into data);
+// shared is for when other threads are using mer_list at the same time
+
+template<class K>
+static void count_range(hashl &mer_list, CountState<K> &x, CountBatch<K> &batch, size_t i, const size_t read_end, const bool shared) {
+	x.seek(i);
+	const size_t end_i = i + opt_mer_length - 1;
+	// load keys with opt_mer_length - 1 basepairs
+	for (; i < end_i; ++i) {
+		x.increment_keys();
+	}
+	// run over all nmers, one basepair at a time
+	for (; i < read_end; ++i) {
+		x.increment_keys();
+		// increment with bit offset to start of nmer
+		if (batch.add(x, 2 * (i + 1 - opt_mer_length))) {
+			batch.flush(mer_list, shared);
+		}
+	}
+	batch.flush(mer_list, shared);
+}
+
+template<class K>
 static void count_nmers(hashl &mer_list, const std::vector<size_t> &read_ends) {
-	CountState x(mer_list);
+	CountState<K> x(mer_list);
+	CountBatch<K> batch(mer_list);
 	size_t i = 0, total_read_ranges = 0;
 	// iterate over all reads (nmers can't cross read range boundaries)
 	for (const auto &read_end : read_ends) {
@@ -404,20 +615,8 @@ static void count_nmers(hashl &mer_list, const std::vector<size_t> &read_ends) {
 			start_time();
 			std::cerr << time(0) << ": " << mer_list.size() << " entries used (" << double(100) * mer_list.size() / mer_list.capacity() << ") (" << total_read_ranges << " read ranges)\n";
 		}
-		const size_t end_i = i + opt_mer_length - 1;
-		// load keys with opt_mer_length - 1 basepairs
-		for (; i < end_i; ++i) {
-			x.increment_keys();
-		}
-		// run over all nmers, one basepair at a time
-		for (; i < read_end; ++i) {
-			x.increment_keys();
-			// increment with bit offset to start of nmer
-			if (!mer_list.increment(x.key, x.comp_key, 2 * (i + 1 - opt_mer_length))) {
-				std::cerr << "Error: ran out of space in hash\n";
-				exit(1);
-			}
-		}
+		count_range(mer_list, x, batch, i, read_end, 0);
+		i = read_end;
 		++total_read_ranges;
 	}
 }
@@ -437,13 +636,85 @@ static void count_nmers(hashl &mer_list, const std::vector<size_t> &read_ends) {
 // note: while a simpler hash may be quicker to hash, if it groups more
 // clumpy you lose out in the end by map<> taking longer
 
+template<class K>
+class window_key_hash {
+    public:
+	hashl::base_type operator()(const K &key) const noexcept {
+		return key.hash();
+	}
+};
+
+template<class K>
+using window_map = std::unordered_map<K, unsigned int, window_key_hash<K> >;
+
+template<class K>
+static void insert_window_mer(hashl &mer_list, const CountState<K> &x, const size_t offset, const size_t repeats, const size_t max_repeats, const bool shared) {
+	bool ok;
+	if (repeats > max_repeats) {
+		ok = shared ? mer_list.insert_invalid_atomic(x.key, x.comp_key, offset) : mer_list.insert_invalid(x.key, x.comp_key, offset);
+	} else {
+		ok = shared ? mer_list.insert_unique_atomic(x.key, x.comp_key, offset) : mer_list.insert_unique(x.key, x.comp_key, offset);
+	}
+	if (!ok) {
+		std::cerr << "Error: ran out of space in hash\n";
+		exit(1);
+	}
+}
+
+// window_mers is always left empty at the end of a range
+
+template<class K>
+static void count_range_window(hashl &mer_list, CountState<K> &x, window_map<K> &window_mers, size_t i, const size_t read_end, const size_t window_size, const size_t max_repeats, const bool shared) {
+	x.seek(i);
+	const size_t end_i = i + opt_mer_length - 1;
+	// load keys with opt_mer_length - 1 basepairs
+	for (; i < end_i; ++i) {
+		x.increment_keys();
+	}
+	CountState<K> x_window(x);
+	// load window_mers with window_size keys
+	const size_t original_i = i;
+	const size_t end_i2 = i + window_size < read_end ? i + window_size : read_end;
+	for (; i < end_i2; ++i) {
+		x.increment_keys();
+		++window_mers[x.key < x.comp_key ? x.key : x.comp_key];
+	}
+	// run over all nmers, one basepair at a time
+	for (; i < read_end; ++i) {
+		x_window.increment_keys();
+		const auto b = window_mers.find(x_window.key < x_window.comp_key ? x_window.key : x_window.comp_key);
+		if (b != window_mers.end()) {
+			// insert with bit offset to start of nmer
+			insert_window_mer(mer_list, x_window, 2 * (i - window_size + 1 - opt_mer_length), b->second, max_repeats, shared);
+			window_mers.erase(b);
+		}
+		x.increment_keys();
+		++window_mers[x.key < x.comp_key ? x.key : x.comp_key];
+	}
+	if (i > original_i + window_size) {
+		i -= window_size;
+	} else {
+		i = original_i;
+	}
+	// now drain window_keys
+	for (; i < read_end; ++i) {
+		x_window.increment_keys();
+		const auto b = window_mers.find(x_window.key < x_window.comp_key ? x_window.key : x_window.comp_key);
+		if (b != window_mers.end()) {
+			// insert with bit offset to start of nmer
+			insert_window_mer(mer_list, x_window, 2 * (i + 1 - opt_mer_length), b->second, max_repeats, shared);
+			window_mers.erase(b);
+		}
+	}
+}
+
+template<class K>
 static void count_nmers_window(hashl &mer_list, const std::vector<size_t> &read_ends, const size_t window_size, const size_t max_repeats) {
-	std::vector<hashl::base_type> data_copy(mer_list.get_data());
 	// window_mers needs at least window_size entries, but a bit more does help
 	size_t hash_size = 1;
 	for (; hash_size < window_size; hash_size <<= 1) { }
-	std::unordered_map<std::vector<hashl::base_type>, unsigned int, hashl_key_hash<hashl::base_type> > window_mers(hash_size << 1);
-	CountState x(mer_list);
+	window_map<K> window_mers(hash_size << 1);
+	CountState<K> x(mer_list);
 	size_t i = 0, total_read_ranges = 0;
 	// iterate over all reads (nmers can't cross read range boundaries)
 	for (const auto &read_end : read_ends) {
@@ -452,85 +723,70 @@ static void count_nmers_window(hashl &mer_list, const std::vector<size_t> &read_
 			start_time();
 			std::cerr << time(0) << ": " << mer_list.size() << " entries used (" << double(100) * mer_list.size() / mer_list.capacity() << ") (" << total_read_ranges << " read ranges)\n";
 		}
-		const size_t end_i = i + opt_mer_length - 1;
-		// load keys with opt_mer_length - 1 basepairs
+		count_range_window(mer_list, x, window_mers, i, read_end, window_size, max_repeats, 0);
+		i = read_end;
+		++total_read_ranges;
+	}
+}
+
+template<class K>
+static void count_nmers_thread(hashl &mer_list, RangeBatches &batches) {
+	CountState<K> x(mer_list);
+	CountBatch<K> batch(mer_list);
+	// window_mers needs at least window_size entries, but a bit more does help
+	size_t hash_size = 1;
+	for (; hash_size < opt_window_size; hash_size <<= 1) { }
+	window_map<K> window_mers(opt_window_size ? hash_size << 1 : 0);
+	size_t i, end_i;
+	while (batches.get_next(i, end_i)) {
 		for (; i < end_i; ++i) {
-			x.increment_keys();
-		}
-		CountState x_window(x);
-		// load window_mers with window_size keys
-		const size_t original_i = i;
-		const size_t end_i2 = i + window_size < read_end ? i + window_size : read_end;
-		for (; i < end_i2; ++i) {
-			x.increment_keys();
-			++window_mers[x.key < x.comp_key ? x.key.value() : x.comp_key.value()];
-		}
-		// run over all nmers, one basepair at a time
-		for (; i < read_end; ++i) {
-			x_window.increment_keys();
-			const auto b = window_mers.find(x_window.key < x_window.comp_key ? x_window.key.value() : x_window.comp_key.value());
-			if (b != window_mers.end()) {
-				if (b->second > max_repeats) {
-					if (!mer_list.insert_invalid(x_window.key, x_window.comp_key, 2 * (i - window_size + 1 - opt_mer_length))) {
-						std::cerr << "Error: ran out of space in hash\n";
-						exit(1);
-					}
-				} else {
-					// insert with bit offset to start of nmer
-					if (!mer_list.insert_unique(x_window.key, x_window.comp_key, 2 * (i - window_size + 1 - opt_mer_length))) {
-						std::cerr << "Error: ran out of space in hash\n";
-						exit(1);
-					}
-				}
-				window_mers.erase(b);
+			const std::pair<size_t, size_t> &range(batches.range(i));
+			if (opt_window_size) {
+				count_range_window(mer_list, x, window_mers, range.first, range.second, opt_window_size, opt_max_repeats, 1);
+			} else {
+				count_range(mer_list, x, batch, range.first, range.second, 1);
 			}
-			x.increment_keys();
-			++window_mers[x.key < x.comp_key ? x.key.value() : x.comp_key.value()];
 		}
-		if (i > original_i + window_size) {
-			i -= window_size;
-		} else {
-			i = original_i;
-		}
-		// now drain window_keys
-		for (; i < read_end; ++i) {
-			x_window.increment_keys();
-			const auto b = window_mers.find(x_window.key < x_window.comp_key ? x_window.key.value() : x_window.comp_key.value());
-			if (b != window_mers.end()) {
-				if (b->second > max_repeats) {
-					if (!mer_list.insert_invalid(x_window.key, x_window.comp_key, 2 * (i + 1 - opt_mer_length))) {
-						std::cerr << "Error: ran out of space in hash\n";
-						exit(1);
-					}
-				} else {
-					// insert with bit offset to start of nmer
-					if (!mer_list.insert_unique(x_window.key, x_window.comp_key, 2 * (i + 1 - opt_mer_length))) {
-						std::cerr << "Error: ran out of space in hash\n";
-						exit(1);
-					}
-				}
-				window_mers.erase(b);
-			}
-		}
-		++total_read_ranges;
+	}
+}
+
+// all threads insert into the one hash; as each read range is independent
+// (and all insertions are commutative) the resulting counts are the same
+// as for a single thread
+
+template<class K>
+static void count_nmers_threaded(hashl &mer_list, const std::vector<size_t> &read_ends) {
+	// can't split ranges when looking at windows, as that would
+	// change which nmers are seen as unique
+	RangeBatches batches(read_ends, !opt_window_size);
+	std::thread threads[opt_threads];
+	for (int i(0); i < opt_threads; ++i) {
+		threads[i] = std::thread(count_nmers_thread<K>, std::ref(mer_list), std::ref(batches));
+	}
+	for (int i(0); i < opt_threads; ++i) {
+		threads[i].join();
 	}
 }
 
 static void read_in_files(hashl &mer_list, const std::vector<std::string> &file_list) {
 	hashl_metadata metadata;
-	// prepare metadata for reading in the file
-	for (const auto &file : file_list) {
-		if (opt_feedback) {
-			std::cerr << time(0) << ": Getting read sizes for " << file << "\n";
+	// a single pass over each file gets both the metadata and the data
+	metadata.start_data();
+	if (opt_threads > 1 && file_list.size() > 1) {
+		read_files_threaded(metadata, file_list);
+	} else {
+		for (const auto &file : file_list) {
+			if (opt_feedback) {
+				std::cerr << time(0) << ": Reading in " << file << "\n";
+			}
+			metadata.add_filename(file);
+			read_file(metadata, file);
+			// mark end of file and clean up loose ends
+			metadata.finalize_file();
 		}
-		// prepare for getting read names and sizes
-		metadata.add_filename(file);
-		get_read_sizes(metadata, file);
-		// mark end of file and clean up loose ends
-		metadata.finalize_file();
 	}
 	std::vector<hashl::base_type> data;
-	metadata.read_data(data, opt_feedback);
+	metadata.finish_data(data);
 	if (opt_feedback) {
 		std::cerr << time(0) << ": Initializing n-mer hash\n";
 	}
@@ -545,11 +801,17 @@ static void read_in_files(hashl &mer_list, const std::vector<std::string> &file_
 		start_time();
 	}
 	const std::vector<size_t> read_ends(metadata.read_ends());
-	if (opt_window_size) {
-		count_nmers_window(mer_list, read_ends, opt_window_size, opt_max_repeats);
-	} else {
-		count_nmers(mer_list, read_ends);
-	}
+	// use a fixed width key type for short enough n-mers
+	hashl_key_dispatch<hashl::base_type>(mer_list.words(), [&](auto key_ptr) {
+		typedef typename std::remove_pointer<decltype(key_ptr)>::type key_type;
+		if (opt_threads > 1) {
+			count_nmers_threaded<key_type>(mer_list, read_ends);
+		} else if (opt_window_size) {
+			count_nmers_window<key_type>(mer_list, read_ends, opt_window_size, opt_max_repeats);
+		} else {
+			count_nmers<key_type>(mer_list, read_ends);
+		}
+	});
 	if (opt_feedback) {
 		print_final_input_feedback(mer_list);
 	}
@@ -571,11 +833,12 @@ int main(int argc, char **argv) {
 	std::ostream &fp_out(get_opts(argc, argv));
 	fp_out << std::fixed << std::setprecision(2);
 	hashl mer_list;
+	mer_list.set_probe_type(opt_probe_type);
 	if (opt_histogram_restore != -1) {
 		if (opt_feedback) {
 			std::cerr << time(0) << ": Initializing n-mer hash\n";
 		}
-		mer_list.init_from_file(opt_histogram_restore);
+		mer_list.init_from_file(opt_histogram_restore, hashl::load_map_copy_on_write);
 		close_compressed(opt_histogram_restore);
 		if (opt_feedback) {
 			print_final_input_feedback(mer_list);
@@ -596,5 +859,8 @@ int main(int argc, char **argv) {
 	if (!opt_save_file.empty()) {
 		save_memory(mer_list);
 	}
+	if (!opt_runs_file.empty()) {
+		save_runs(mer_list);
+	}
 	return 0;
 }
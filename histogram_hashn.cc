@@ -1,5 +1,6 @@
 #include "hashn.h"	// hashn
-#include "hist_lib_hashn.h"	// add_sequence_mers(), clear_mer_list(), convert_key(), init_mer_constants(), opt_feedback, opt_include, opt_skip_size, print_final_input_feedback(), reverse_key()
+#include "hash_probe.h"	// hash_probe
+#include "hist_lib_hashn.h"	// add_sequence_mers(), clear_mer_list(), convert_key(), init_mer_constants(), opt_feedback, opt_include, opt_mer_partition, opt_mer_partitions, opt_skip_size, print_final_input_feedback(), reverse_key()
 #include "open_compressed.h"	// close_compressed(), get_suffix(), open_compressed(), pfgets()
 #include "read.h"	// Read, opt_clip_quality, opt_clip_vector, opt_quality_cutoff
 #include "read_file.h"	// ReadFile, opt_strip_tracename
@@ -22,11 +23,13 @@ static bool opt_hash_clean;
 static bool opt_print_gc;
 static bool opt_track_dups;
 static bool opt_warnings;
+static hash_probe::probe_type opt_probe_type;
 static int opt_histogram_restore;
 static int opt_mer_length;
 static int opt_readnames_exclude;
 static size_t opt_batch_size;
 static size_t opt_nmers;
+static size_t opt_only_partition;
 static std::map<std::string, hashn::offset_type> opt_readnames;
 static std::string opt_save_file;
 static std::string opt_tmp_file_prefix;
@@ -90,9 +93,7 @@ static unsigned long count_gc(const hashn::key_type_base &key) {
 // print histogram of n-mer occurrences, potentially with gc percent at given
 // frequencies
 
-static void print_mer_histogram(hashn &mer_list) {
-	std::map<hashn::value_type, unsigned long> counts;
-	std::map<hashn::value_type, unsigned long> gc_counts;
+static void count_mer_histogram(hashn &mer_list, std::map<hashn::value_type, unsigned long> &counts, std::map<hashn::value_type, unsigned long> &gc_counts) {
 	//hashn::key_type comp_key(mer_list);
 	hashn::const_iterator a(mer_list.begin());
 	const hashn::const_iterator end_a(mer_list.end());
@@ -110,6 +111,9 @@ static void print_mer_histogram(hashn &mer_list) {
 			}
 		//}
 	}
+}
+
+static void print_mer_histogram(const std::map<hashn::value_type, unsigned long> &counts, std::map<hashn::value_type, unsigned long> &gc_counts) {
 	std::map<hashn::value_type, unsigned long>::const_iterator c(counts.begin());
 	const std::map<hashn::value_type, unsigned long>::const_iterator end_c(counts.end());
 	// don't include single occurrences in total
@@ -138,6 +142,13 @@ static void print_mer_histogram(hashn &mer_list) {
 	}
 }
 
+static void print_mer_histogram(hashn &mer_list) {
+	std::map<hashn::value_type, unsigned long> counts;
+	std::map<hashn::value_type, unsigned long> gc_counts;
+	count_mer_histogram(mer_list, counts, gc_counts);
+	print_mer_histogram(counts, gc_counts);
+}
+
 static void print_mer_histogram_sub(hashn &mer_list) {
 	std::map<hashn::value_type, unsigned long> counts[opt_readnames_exclude];
 	hashn::const_iterator a(mer_list.begin());
@@ -259,7 +270,13 @@ static void print_usage() {
 		"    -L ## filename containing names of reads to compare with results\n"
 		"          (count is by given reads, frequency is by other reads)\n"
 		"    -m ## set mer length [24]\n"
+		"    -N ## split n-mers into ## partitions, and count one partition at a time,\n"
+		"          rereading the input for each (-z is then the size of each partition)\n"
+		"    -n ## only count partition ## (1 to the -N value); the histograms of\n"
+		"          all the partitions add up to the full histogram\n"
 		"    -o ## print output to file instead of stdout\n"
+		"    -P ## hash table probing: prime, linear, or quadratic [prime]\n"
+		"          (linear and quadratic use power of two table sizes)\n"
 		"    -p ## don't touch reads not matching pattern (an extended regex)\n"
 		"    -q    turn off all warnings\n"
 		"    -s ## save histogram memory structure to file\n"
@@ -288,8 +305,11 @@ static void get_opts(int argc, char **argv) {
 	opt_hash_clean = 0;
 	opt_histogram_restore = -1;
 	opt_mer_length = 24;
+	opt_mer_partitions = 1;
 	opt_nmers = 200 * 1024 * 1024;
+	opt_only_partition = 0;
 	opt_print_gc = 0;
+	opt_probe_type = hash_probe::PRIME;
 	opt_quality_cutoff = 20;
 	opt_readnames_exclude = 0;
 	opt_skip_size = 0;
@@ -297,7 +317,7 @@ static void get_opts(int argc, char **argv) {
 	opt_track_dups = 0;
 	opt_warnings = 1;
 	int c;
-	while ((c = getopt(argc, argv, "aB:cdf:ghik:l:L:m:o:p:qs:S:tT:vVw:z:Z")) != EOF) {
+	while ((c = getopt(argc, argv, "aB:cdf:ghik:l:L:m:N:n:o:P:p:qs:S:tT:vVw:z:Z")) != EOF) {
 		switch (c) {
 		    case 'a':
 			opt_aggregate = 1;
@@ -362,9 +382,31 @@ static void get_opts(int argc, char **argv) {
 				print_usage();
 			}
 			break;
+		    case 'N':
+			c = atoi(optarg);
+			if (c < 1) {
+				fprintf(stderr, "Error: bad partition count %s\n", optarg);
+				print_usage();
+			}
+			opt_mer_partitions = c;
+			break;
+		    case 'n':
+			c = atoi(optarg);
+			if (c < 1) {
+				fprintf(stderr, "Error: bad partition %s\n", optarg);
+				print_usage();
+			}
+			opt_only_partition = c;
+			break;
 		    case 'o':
 			opt_output = optarg;
 			break;
+		    case 'P':
+			if (!hash_probe::parse_name(optarg, opt_probe_type)) {
+				fprintf(stderr, "Error: unknown probe type: %s\n", optarg);
+				exit(1);
+			}
+			break;
 		    case 'p':
 			opt_include.initialize(optarg, 0, REG_NOSUB | REG_EXTENDED);
 			break;
@@ -433,6 +475,17 @@ static void get_opts(int argc, char **argv) {
 		fprintf(stderr, "Error: no files to process\n");
 		print_usage();
 	}
+	if (opt_only_partition != 0 && opt_mer_partitions < 2) {
+		fprintf(stderr, "Error: -n option requires -N option\n");
+		exit(1);
+	} else if (opt_only_partition > opt_mer_partitions) {
+		fprintf(stderr, "Error: -n value larger than -N value\n");
+		exit(1);
+	}
+	if (opt_mer_partitions > 1 && (opt_readnames_exclude != 0 || opt_histogram_restore != -1 || !opt_save_file.empty())) {
+		fprintf(stderr, "Error: cannot use -N option with -l, -L, -S, or -s options\n");
+		exit(1);
+	}
 	if (opt_readnames_exclude != 0 && !opt_tmp_file_prefix.empty()) {
 		fprintf(stderr, "Error: cannot use -T option with either -l or -L options\n");
 		exit(1);
@@ -452,6 +505,94 @@ static void get_opts(int argc, char **argv) {
 	}
 }
 
+// add the n-mers of a file to mer_list; returns 1 if it couldn't be read
+
+static int add_file_mers(const char * const filename, hashn &mer_list) {
+	if (opt_feedback) {
+		fprintf(stderr, "Reading in %s\n", filename);
+	}
+	ReadFile file(filename, opt_batch_size, opt_track_dups);
+	if (file.seq_file.empty()) {
+		return 1;
+	}
+	size_t total_reads(0);
+	while (file.read_batch(opt_warnings) != -1) {
+		if (opt_readnames_exclude) {
+			if (!add_sequence_mers(file.read_list.begin(), file.read_list.end(), mer_list, opt_readnames, total_reads)) {
+				fprintf(stderr, "Error: n-mer list incomplete - give a larger -z value\n");
+			}
+		} else if (!add_sequence_mers(file.read_list.begin(), file.read_list.end(), mer_list, total_reads)) {
+			fprintf(stderr, "Error: n-mer list incomplete - give a larger -z value\n");
+		}
+		total_reads += file.read_list.size();
+	}
+	return 0;
+}
+
+// count one partition of the n-mers at a time, rereading the input for
+// each; no n-mer is in more than one partition, so the histograms of the
+// partitions just add up, and the hash only has to hold one partition
+
+static int create_histogram_partitioned(const int argc, char ** const argv, hashn &mer_list) {
+	int err(0);
+	mer_list.init(opt_nmers, opt_mer_length * 2);
+	const size_t first_partition(opt_only_partition ? opt_only_partition - 1 : 0);
+	const size_t end_partition(opt_only_partition ? opt_only_partition : opt_mer_partitions);
+	// without -a, each file gets its own histogram
+	for (int i(optind); i != argc;) {
+		const int end_i(opt_aggregate ? argc : i + 1);
+		bool unreadable(0);
+		std::map<hashn::value_type, unsigned long> counts;
+		std::map<hashn::value_type, unsigned long> gc_counts;
+		for (opt_mer_partition = first_partition; opt_mer_partition != end_partition; ++opt_mer_partition) {
+			if (opt_feedback) {
+				fprintf(stderr, "Counting partition %lu of %lu\n", opt_mer_partition + 1, opt_mer_partitions);
+			}
+			for (int j(i); j != end_i; ++j) {
+				// only count unreadable files once
+				if (add_file_mers(argv[j], mer_list) && opt_mer_partition == first_partition) {
+					++err;
+					unreadable = 1;
+				}
+			}
+			// the header waits for the file to be read, so that, as
+			// with a single pass, unreadable files are skipped
+			if (!opt_aggregate && opt_mer_partition == first_partition) {
+				if (unreadable) {
+					clear_mer_list(mer_list);
+					break;
+				}
+				fprintf(fp_out, "%s\n", argv[i]);
+				for (int k(strlen(argv[i])); k != 0; --k) {
+					putc('-', fp_out);
+				}
+				fprintf(fp_out, "\n");
+			}
+			if (opt_frequency_cutoff == 0) {
+				count_mer_histogram(mer_list, counts, gc_counts);
+			} else {
+				print_mer_frequency(mer_list);
+			}
+			clear_mer_list(mer_list);
+		}
+		if (!opt_aggregate && unreadable) {
+			i = end_i;
+			continue;
+		}
+		if (opt_frequency_cutoff == 0) {
+			if (opt_feedback) {
+				fprintf(stderr, "Printing histogram\n");
+			}
+			print_mer_histogram(counts, gc_counts);
+		}
+		if (end_i != argc) {
+			fprintf(fp_out, "\n");
+		}
+		i = end_i;
+	}
+	return err;
+}
+
 int main(int argc, char **argv) {
 	get_opts(argc, argv);
 	if (opt_feedback) {
@@ -460,6 +601,7 @@ int main(int argc, char **argv) {
 	init_mer_constants(opt_mer_length);
 	int err(0);
 	hashn mer_list;
+	mer_list.set_probe_type(opt_probe_type);
 	if (opt_hash_clean || !opt_tmp_file_prefix.empty()) {
 		// have to add one to opt_mer_length,
 		// as init_mer_constants() subtracts one
@@ -468,28 +610,15 @@ int main(int argc, char **argv) {
 	if (opt_histogram_restore != -1) {
 		mer_list.init_from_file(opt_histogram_restore);
 		close_compressed(opt_histogram_restore);
+	} else if (opt_mer_partitions > 1) {
+		err = create_histogram_partitioned(argc, argv, mer_list);
 	} else {
 		mer_list.init(opt_nmers, opt_mer_length * 2, abs(opt_readnames_exclude));
 		for (; optind != argc; ++optind) {
-			if (opt_feedback) {
-				fprintf(stderr, "Reading in %s\n", argv[optind]);
-			}
-			ReadFile file(argv[optind], opt_batch_size, opt_track_dups);
-			if (file.seq_file.empty()) {
+			if (add_file_mers(argv[optind], mer_list)) {
 				++err;
 				continue;
 			}
-			size_t total_reads(0);
-			while (file.read_batch(opt_warnings) != -1) {
-				if (opt_readnames_exclude) {
-					if (!add_sequence_mers(file.read_list.begin(), file.read_list.end(), mer_list, opt_readnames, total_reads)) {
-						fprintf(stderr, "Error: n-mer list incomplete - give a larger -z value\n");
-					}
-				} else if (!add_sequence_mers(file.read_list.begin(), file.read_list.end(), mer_list, total_reads)) {
-					fprintf(stderr, "Error: n-mer list incomplete - give a larger -z value\n");
-				}
-				total_reads += file.read_list.size();
-			}
 			if (!opt_aggregate) {
 				if (opt_feedback) {
 					fprintf(stderr, "Printing histogram\n");
@@ -516,7 +645,8 @@ int main(int argc, char **argv) {
 			}
 		}
 	}
-	if (opt_aggregate) {
+	// partitions are printed as they're done
+	if (opt_aggregate && opt_mer_partitions == 1) {
 		if (opt_feedback) {
 			print_final_input_feedback(mer_list);
 			fprintf(stderr, "Printing histogram\n");
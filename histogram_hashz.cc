@@ -1,12 +1,12 @@
 #include "hashz.h"	/* hashz */
-#include "hist_lib_hashz.h"	/* add_sequence_mers(), convert_key(), init_mer_constants(), opt_feedback, opt_include, opt_skip_size, reverse_key() */
-#include "open_compressed.h"	/* close_compressed(), open_compressed(), pfgets() */
+#include "hist_lib_hashz.h"	/* add_sequence_mers(), init_mer_constants(), opt_feedback, opt_include, opt_skip_size */
+#include "open_compressed.h"	/* close_compressed(), get_suffix(), open_compressed(), pfgets() */
 #include "read.h"	/* Read, opt_clip_quality, opt_clip_vector, opt_quality_cutoff */
 #include "read_lib.h"	/* opt_strip_tracename, read_sequence(), set_default_endpoints() */
 #include "strtostr.h"	/* strtostr() */
 #include "version.h"	/* VERSION */
+#include "write_fork.h"	/* close_fork(), write_fork() */
 #include <getopt.h>	// getopt(), optarg, optind
-#include <gmp.h>	/* mpz_clear(), mpz_cmp(), mpz_init2() */
 #include <list>		/* list<> */
 #include <map>		/* map<> */
 #include <regex.h>	/* REG_EXTENDED, REG_NOSUB */
@@ -20,29 +20,57 @@
 static FILE *fp_out = stdout;
 static bool opt_aggregate;
 static bool opt_warnings;
+static int opt_histogram_restore;
 static int opt_readnames_exclude;
 static size_t opt_nmers;
 static std::map<std::string, hashz::offset_type> opt_readnames;
+static std::string opt_save_file;
 static unsigned long opt_frequency_cutoff;
 static unsigned long opt_mer_length;
 
+static void save_memory(const hashz &mer_list) {
+	std::string suffix;
+	get_suffix(opt_save_file, suffix);
+	std::list<std::string> args;
+	if (suffix == ".gz") {
+		args.push_back("gzip");
+		args.push_back("-c");
+	} else if (suffix == ".bz2") {
+		args.push_back("bzip2");
+		args.push_back("-c");
+	} else if (suffix == ".Z") {
+		args.push_back("compress");
+		args.push_back("-c");
+	}
+	const int fd = write_fork(args, opt_save_file);
+	if (fd == -1) {
+		fprintf(stderr, "Error: could not save memory\n");
+		exit(1);
+	}
+	mer_list.save(fd);
+	close_fork(fd);
+}
+
 /* print n-mer occurence frequency */
 
 static void print_mer_frequency(const hashz &mer_list) {
-	hashz::key_type comp_key;
-	mpz_init2(comp_key, opt_mer_length * 2);
+	hashz::key_type key(mer_list.bits(), mer_list.words());
+	hashz::key_type comp_key(mer_list.bits(), mer_list.words());
+	std::string s;
 	hashz::const_iterator a = mer_list.begin();
 	hashz::const_iterator end = mer_list.end();
 	for (; a != end; ++a) {
 		if (a.value >= opt_frequency_cutoff) {
-			fprintf(fp_out, "%s %lu\n", convert_key(a.key).c_str(), a.value);
-			reverse_key(a.key, comp_key);
-			if (mpz_cmp(a.key, comp_key) != 0) {
-				fprintf(fp_out, "%s %lu\n", convert_key(comp_key).c_str(), a.value);
+			a.key(key);
+			key.get_sequence(s);
+			fprintf(fp_out, "%s %lu\n", s.c_str(), a.value);
+			comp_key.make_complement(key);
+			if (key != comp_key) {
+				comp_key.get_sequence(s);
+				fprintf(fp_out, "%s %lu\n", s.c_str(), a.value);
 			}
 		}
 	}
-	mpz_clear(comp_key);
 }
 
 /* print histogram of n-mer occurrences */
@@ -204,10 +232,12 @@ static void print_usage() {
 	fprintf(stderr, "               (histogram is given as count*frequency, rather than count)\n");
 	fprintf(stderr, "    -L ##      filename containing names of reads to compare with results\n");
 	fprintf(stderr, "               (count is by given reads, frequency is by other reads)\n");
-	fprintf(stderr, "    -m mer     set mer length (1-32, defaults to 24)\n");
+	fprintf(stderr, "    -m mer     set mer length (defaults to 24)\n");
 	fprintf(stderr, "    -o outputfile  print output to file instead of stdout\n");
 	fprintf(stderr, "    -p pattern don't touch reads not matching pattern (an extended regex)\n");
 	fprintf(stderr, "    -q         turn off all warnings\n");
+	fprintf(stderr, "    -s file    save histogram memory structure to file\n");
+	fprintf(stderr, "    -S file    load histogram memory dump from given file\n");
 	fprintf(stderr, "    -t         strip first part of trace id\n");
 	fprintf(stderr, "    -v         clip vector\n");
 	fprintf(stderr, "    -V         print version\n");
@@ -224,6 +254,7 @@ static void get_opts(int argc, char **argv) {
 	opt_clip_vector = 0;
 	opt_feedback = 1;
 	opt_frequency_cutoff = 0;
+	opt_histogram_restore = -1;
 	opt_mer_length = 24;
 	opt_nmers = 200 * 1024 * 1024;
 	opt_quality_cutoff = 20;
@@ -232,7 +263,7 @@ static void get_opts(int argc, char **argv) {
 	opt_strip_tracename = 0;
 	opt_warnings = 1;
 	int i, c;
-	while ((c = getopt(argc, argv, "acf:hik:l:L:m:o:p:qtvVw:z:")) != EOF) {
+	while ((c = getopt(argc, argv, "acf:hik:l:L:m:o:p:qs:S:tvVw:z:")) != EOF) {
 		switch (c) {
 		    case 'a':
 			opt_aggregate = 1;
@@ -293,6 +324,18 @@ static void get_opts(int argc, char **argv) {
 		    case 'q':
 			opt_warnings = 0;
 			break;
+		    case 's':
+			opt_save_file = optarg;
+			opt_aggregate = 1;		/* won't work without this */
+			break;
+		    case 'S':
+			opt_histogram_restore = open_compressed(optarg);
+			if (opt_histogram_restore == -1) {
+				fprintf(stderr, "Error: could not read histogram dump file\n");
+				print_usage();
+			}
+			opt_aggregate = 1;
+			break;
 		    case 't':
 			opt_strip_tracename = 1;
 			break;
@@ -326,7 +369,14 @@ static void get_opts(int argc, char **argv) {
 	if (opt_frequency_cutoff != 0 && opt_readnames_exclude) {
 		fprintf(stderr, "Warning: -w and -l/-L options conflict: ignoring -w option\n");
 	}
-	if (optind == argc) {
+	if (opt_histogram_restore != -1) {
+		if (opt_nmers != 200 * 1024 * 1024) {
+			fprintf(stderr, "Error: -S and -z options cannot both be specified\n");
+			exit(1);
+		} else if (optind != argc) {
+			fprintf(stderr, "Warning: fasta files being ignored, hash is being read from disk\n");
+		}
+	} else if (optind == argc) {
 		fprintf(stderr, "Error: no files to process\n");
 		print_usage();
 	}
@@ -349,7 +399,14 @@ int main(int argc, char **argv) {
 	}
 	init_mer_constants(opt_mer_length);
 	int err = 0;
-	hashz mer_list(opt_nmers, opt_mer_length * 2, abs(opt_readnames_exclude));
+	hashz mer_list;
+	if (opt_histogram_restore != -1) {
+		mer_list.init_from_file(opt_histogram_restore);
+		close_compressed(opt_histogram_restore);
+		optind = argc;
+	} else {
+		mer_list.init(opt_nmers, opt_mer_length * 2, abs(opt_readnames_exclude));
+	}
 	for (; optind != argc; ++optind) {
 		if (opt_feedback) {
 			fprintf(stderr, "Reading in %s\n", argv[optind]);
@@ -411,5 +468,8 @@ int main(int argc, char **argv) {
 	if (fp_out != stdout) {
 		fclose(fp_out);
 	}
+	if (!opt_save_file.empty()) {
+		save_memory(mer_list);
+	}
 	return err;
 }
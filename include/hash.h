@@ -3,18 +3,25 @@
 
 // This is a class designed to be a memory efficient storage for counting
 // n-mers; keys and values are stored in separate arrays to avoid
-// alignment issues; a map is used to handle the infrequent case of values
-// beyond the size of the small value type
+// alignment issues; a side table is used to handle the infrequent case of
+// values beyond the size of the small value type
 
 // The alt_list/alt_map arrays are available for storing extra information
 // associated with each element in an efficient manner.
 
+// With the TMP_FILE no_space_response, a full hash is swapped out for a
+// second, empty set of arrays, and counting carries on in those while a
+// background thread sorts the full set and writes it to a tmp file (so
+// the hash takes twice the memory once it first fills); iterating then
+// merges the tmp files and what's left in memory.
+
+#include "hash_overflow.h"	// hash_overflow
+#include "hash_probe.h"	// hash_probe
 #include <limits.h>	// UCHAR_MAX, ULONG_MAX
 #include <list>		// list<>
-#include <map>		// map<>
 #include <stdint.h>	// uint64_t
 #include <string>	// string
-#include <utility>	// pair<>
+#include <thread>	// thread
 
 // a non-palindrome random pattern with one of the two highest bits set,
 // and such that the complement is of lower value (so it only collides
@@ -38,20 +45,21 @@ class hash {
 	typedef size_t offset_type;
 	enum { max_small_value = UCHAR_MAX };
 	enum no_space_response_t { CLEAN_HASH = 1, TMP_FILE = 2 };
+	class spill_merge;	// for iterating over TMP_FILE runs
 
 	class const_iterator {	// only useful for pulling out data
 	    private:
 		const hash *list;
 		offset_type offset;
-		std::map<key_type, std::pair<value_type, int> > next_keys;
+		spill_merge *merge;	// owned by the hash
 	    public:
 		key_type key;
 		value_type value;
-		explicit const_iterator(void) : list(0), offset(0), key(INVALID_KEY), value(0) { }
+		explicit const_iterator(void) : list(0), offset(0), merge(0), key(INVALID_KEY), value(0) { }
 		// this can't be explicit
-		const_iterator(const const_iterator &__a) : list(__a.list), offset(__a.offset), next_keys(__a.next_keys), key(__a.key), value(__a.value) { }
+		const_iterator(const const_iterator &__a) : list(__a.list), offset(__a.offset), merge(__a.merge), key(__a.key), value(__a.value) { }
 		explicit const_iterator(const hash *, offset_type);
-		explicit const_iterator(const hash *, offset_type, const std::map<key_type, std::pair<value_type, int> > &);
+		explicit const_iterator(const hash *, spill_merge &);
 		~const_iterator(void) { }
 		const_iterator &operator=(const const_iterator &);
 		bool operator==(const const_iterator &__a) const {
@@ -81,19 +89,28 @@ class hash {
 	offset_type used_elements;
 	offset_type modulus;
 	offset_type collision_modulus;
+	hash_probe probe;
 	offset_type alt_size;
 	key_type *key_list;
 	small_value_type *value_list;
 	// alt_list is a two dimensional array (modulus * alt_size) declared
 	// as a single to maintain locality of values to reduce cache misses
 	small_value_type *alt_list;
-	std::map<key_type, value_type> value_map;	// for overflow
-	std::map<key_type, value_type> *alt_map;	// for alt overflows
+	hash_overflow value_map;			// for overflow
+	hash_overflow *alt_map;				// for alt overflows
     private:
 	std::string tmp_file_prefix;			// for TMP_FILE response
 	std::list<std::string> state_files;		// for TMP_FILE response
+	// the arrays being written out (or the next ones to use)
+	key_type *spill_key_list;			// for TMP_FILE response
+	small_value_type *spill_value_list;		// for TMP_FILE response
+	hash_overflow spill_value_map;			// for TMP_FILE response
+	std::thread *spill_thread;			// for TMP_FILE response
+	bool spill_failed;				// for TMP_FILE response
+	spill_merge *readback;				// for TMP_FILE response
     protected:
 	std::string boilerplate(void) const;
+	void read_boilerplate(int);
 	offset_type insert_offset(key_type);
     private:
 	offset_type find_empty_offset(key_type) const;
@@ -104,17 +121,17 @@ class hash {
 	offset_type find_offset(key_type) const;
 	bool add(key_type, value_type);
 	bool add_alt(key_type, value_type, const value_type []);
-	void shell_sort(offset_type, offset_type);
-	void calculate_offsets(offset_type, offset_type, offset_type *, int) const;
-	void radix_sort_internal(offset_type, offset_type, offset_type *, int);
-	void radix_sort(offset_type);
-	void save_state(void);
-	void squash_hash(void);
-	bool get_next_entry(int, key_type &, value_type &, offset_type &) const;
-	void prep_for_readback(offset_type &, std::map<key_type, std::pair<value_type, int> > &);
+	static void shell_sort(key_type *, small_value_type *, offset_type, offset_type);
+	static void calculate_offsets(const key_type *, offset_type, offset_type, offset_type *, int);
+	static void radix_sort_internal(key_type *, small_value_type *, offset_type, offset_type, offset_type *, int);
+	void radix_sort(key_type *, small_value_type *, offset_type) const;
+	void squash_hash(key_type *, small_value_type *, offset_type) const;
+	void start_spill(void);
+	void finish_spill(void);
+	void save_state(int, offset_type);
     public:
-	explicit hash(void) : can_overflow(1), no_space_response(0), max_key_size(sizeof(key_type) * 8), used_elements(0), modulus(0), collision_modulus(0), alt_size(0), key_list(0), value_list(0), alt_list(0), alt_map(0), tmp_file_prefix(""), state_files() { }
-	explicit hash(const offset_type size_in, const offset_type alt_size_in = 0) : can_overflow(1), no_space_response(0), max_key_size(sizeof(key_type) * 8), tmp_file_prefix("") {
+	explicit hash(void) : can_overflow(1), no_space_response(0), max_key_size(sizeof(key_type) * 8), used_elements(0), modulus(0), collision_modulus(0), alt_size(0), key_list(0), value_list(0), alt_list(0), alt_map(0), tmp_file_prefix(""), state_files(), spill_key_list(0), spill_value_list(0), spill_thread(0), spill_failed(0), readback(0) { }
+	explicit hash(const offset_type size_in, const offset_type alt_size_in = 0) : can_overflow(1), no_space_response(0), max_key_size(sizeof(key_type) * 8), tmp_file_prefix(""), spill_key_list(0), spill_value_list(0), spill_thread(0), spill_failed(0), readback(0) {
 		init(size_in, alt_size_in);
 	}
 	~hash(void);
@@ -166,6 +183,10 @@ class hash {
 		}
 	}
 	void set_no_space_response(int, const std::string & = "NONE");
+	// table geometry used by the next init()
+	void set_probe_type(const hash_probe::probe_type x) {
+		probe.set_type(x);
+	}
 	bool set_value(key_type, value_type);
 };
 
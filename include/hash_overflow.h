@@ -0,0 +1,160 @@
+#ifndef _HASH_OVERFLOW_H
+#define _HASH_OVERFLOW_H
+
+// Overflow storage for the n-mer hashes: the part of a count that doesn't
+// fit in a hash's small value array, keyed by the raw words of the n-mer.
+// It's an open addressed table (linear probing, kept at most half full),
+// so an overflow increment is a few word compares, rather than a tree
+// walk (and, for multi-word keys, building a string).
+//
+// A value of zero marks an empty slot - an overflow of zero is the same
+// as no overflow - so values are only ever added to, or set; setting a
+// value to zero removes it.
+
+#include <algorithm>	// copy(), swap()
+#include <stdint.h>	// uint64_t
+#include <sys/types.h>	// size_t
+#include <vector>	// vector<>
+
+class hash_overflow {
+    public:
+	typedef uint64_t base_type;
+	typedef size_t value_type;
+	typedef size_t size_type;
+    private:
+	size_type word_width;
+	size_type used;
+	std::vector<base_type> keys;	// word_width words per slot
+	std::vector<value_type> values;
+	size_type start(const base_type * const key) const {
+		base_type x(0);
+		for (size_type i(0); i != word_width; ++i) {
+			x = (x ^ key[i]) * 0x9e3779b97f4a7c15ULL;
+		}
+		return (x ^ (x >> 32)) & (values.size() - 1);
+	}
+	bool equal(const size_type i, const base_type * const key) const {
+		const base_type * const k(&keys[i * word_width]);
+		for (size_type j(0); j != word_width; ++j) {
+			if (k[j] != key[j]) {
+				return 0;
+			}
+		}
+		return 1;
+	}
+	// slot holding key, or the empty slot where it would go
+	size_type find_slot(const base_type * const key) const {
+		const size_type mask(values.size() - 1);
+		size_type i(start(key));
+		while (values[i] != 0 && !equal(i, key)) {
+			i = (i + 1) & mask;
+		}
+		return i;
+	}
+	void grow() {
+		std::vector<base_type> old_keys(values.empty() ? 64 * word_width : keys.size() * 2, 0);
+		std::vector<value_type> old_values(values.empty() ? 64 : values.size() * 2, 0);
+		keys.swap(old_keys);
+		values.swap(old_values);
+		for (size_type i(0); i != old_values.size(); ++i) {
+			if (old_values[i] != 0) {
+				const size_type j(find_slot(&old_keys[i * word_width]));
+				std::copy(&old_keys[i * word_width], &old_keys[(i + 1) * word_width], &keys[j * word_width]);
+				values[j] = old_values[i];
+			}
+		}
+	}
+	// the slot to put a (new) key in, growing the table if need be
+	size_type insert_slot(const base_type * const key) {
+		if (values.empty()) {
+			grow();
+		}
+		size_type i(find_slot(key));
+		if (values[i] == 0) {
+			if (2 * (used + 1) > values.size()) {
+				grow();
+				i = find_slot(key);
+			}
+			std::copy(key, key + word_width, &keys[i * word_width]);
+			++used;
+		}
+		return i;
+	}
+    public:
+	explicit hash_overflow(const size_type words = 1) : word_width(words), used(0) { }
+	~hash_overflow() { }
+	// number of words in a key; clears the table
+	void set_words(const size_type words) {
+		clear();
+		word_width = words;
+	}
+	size_type size() const {
+		return used;
+	}
+	bool empty() const {
+		return used == 0;
+	}
+	// returns zero if key isn't present
+	value_type find(const base_type * const key) const {
+		return values.empty() ? 0 : values[find_slot(key)];
+	}
+	void add(const base_type * const key, const value_type x) {
+		if (x != 0) {
+			values[insert_slot(key)] += x;
+		}
+	}
+	void set(const base_type * const key, const value_type x) {
+		if (x == 0) {
+			erase(key);
+		} else {
+			values[insert_slot(key)] = x;
+		}
+	}
+	void erase(const base_type * const key) {
+		if (values.empty()) {
+			return;
+		}
+		const size_type mask(values.size() - 1);
+		size_type i(find_slot(key));
+		if (values[i] == 0) {
+			return;
+		}
+		// shift later entries of the probe run back into the gap,
+		// unless they'd be moved before their starting slot
+		for (size_type j((i + 1) & mask); values[j] != 0; j = (j + 1) & mask) {
+			const size_type k(start(&keys[j * word_width]));
+			if (i <= j ? (i < k && k <= j) : (i < k || k <= j)) {
+				continue;
+			}
+			std::copy(&keys[j * word_width], &keys[(j + 1) * word_width], &keys[i * word_width]);
+			values[i] = values[j];
+			i = j;
+		}
+		values[i] = 0;
+		--used;
+	}
+	// unlike std::map<>::clear(), this also frees the memory
+	void clear() {
+		std::vector<base_type>().swap(keys);
+		std::vector<value_type>().swap(values);
+		used = 0;
+	}
+	void swap(hash_overflow &a) {
+		std::swap(word_width, a.word_width);
+		std::swap(used, a.used);
+		keys.swap(a.keys);
+		values.swap(a.values);
+	}
+	// for going through all entries: slots with a zero value are empty
+	size_type slots() const {
+		return values.size();
+	}
+	const base_type *key(const size_type i) const {
+		return &keys[i * word_width];
+	}
+	value_type value(const size_type i) const {
+		return values[i];
+	}
+};
+
+#endif // !_HASH_OVERFLOW_H
@@ -0,0 +1,122 @@
+#ifndef _HASH_PROBE_H
+#define _HASH_PROBE_H
+
+// Table geometry and probe sequence for the open addressed hashes (hash,
+// hashn, hashl).  The original geometry is a prime sized table with double
+// hashing, which costs a division for the starting offset and the step,
+// and another on every probe; the power of two geometries replace those
+// with a multiply-shift for the starting offset and a mask on each probe.
+//
+// The geometry is written to saved files as an optional header line, left
+// out for prime tables so their files are unchanged.
+
+#include "next_prime.h"	// next_prime()
+#include <stdint.h>	// uint64_t
+#include <string>	// string
+#include <sys/types.h>	// size_t
+
+class hash_probe {
+    public:
+	typedef size_t offset_type;
+	enum probe_type { PRIME = 0, LINEAR = 1, QUADRATIC = 2 };
+    private:
+	probe_type type_;
+	int shift;	// 64 - log2(modulus), for power of two tables
+    public:
+	explicit hash_probe() : type_(PRIME), shift(0) { }
+	~hash_probe() { }
+	probe_type type() const {
+		return type_;
+	}
+	// only takes effect at the next sizing of the table
+	void set_type(const probe_type x) {
+		type_ = x;
+	}
+	// set modulus and collision_modulus for a table of at least size_asked
+	void set_size(offset_type size_asked, offset_type &modulus, offset_type &collision_modulus) {
+		if (size_asked < 3) {	// to avoid collision_modulus == modulus
+			size_asked = 3;
+		}
+		if (type_ == PRIME) {
+			modulus = next_prime(size_asked);
+			// collision_modulus just needs to be relatively prime with modulus;
+			// since modulus is prime, any value will do - I made it prime for fun
+			collision_modulus = next_prime(size_asked / 2);
+		} else {
+			for (modulus = 4; modulus < size_asked; modulus <<= 1) { }
+			collision_modulus = 0;		// not used
+		}
+		set_modulus(modulus);
+	}
+	// for tables read in from a file
+	void set_modulus(const offset_type modulus) {
+		if (type_ != PRIME) {
+			shift = __builtin_clzl(modulus) + 1;
+		}
+	}
+	// starting offset
+	offset_type start(const uint64_t key_hash, const offset_type modulus) const {
+		if (type_ == PRIME) {
+			return key_hash % modulus;
+		} else {
+			// different multiplier from hashl::key_tag(), so tags
+			// still differ between keys with the same start
+			return (key_hash * 0xff51afd7ed558ccdULL) >> shift;
+		}
+	}
+	// first step size (for PRIME, the only step size)
+	offset_type step(const uint64_t key_hash, const offset_type collision_modulus) const {
+		return type_ == PRIME ? collision_modulus - key_hash % collision_modulus : 1;
+	}
+	// move i to the next offset in the probe sequence; all three
+	// sequences visit every offset before repeating
+	void next(offset_type &i, offset_type &j, const offset_type modulus) const {
+		switch (type_) {
+		    case PRIME:		// j < modulus, so no division needed
+			i += j;
+			if (i >= modulus) {
+				i -= modulus;
+			}
+			break;
+		    case LINEAR:
+			i = (i + 1) & (modulus - 1);
+			break;
+		    case QUADRATIC:	// triangular numbers
+			i = (i + j++) & (modulus - 1);
+			break;
+		}
+	}
+	// for saved file headers (empty for PRIME)
+	std::string header_line() const {
+		return type_ == PRIME ? "" : "probe " + name(type_) + "\n";
+	}
+	// returns true (and sets type) if line is a probe header line
+	bool parse_header_line(const std::string &line) {
+		return line.compare(0, 6, "probe ") == 0 && parse_name(line.substr(6), type_) && type_ != PRIME;
+	}
+	static std::string name(const probe_type x) {
+		switch (x) {
+		    case LINEAR:
+			return "linear";
+		    case QUADRATIC:
+			return "quadratic";
+		    default:
+			return "prime";
+		}
+	}
+	// returns false if s isn't a probe type name
+	static bool parse_name(const std::string &s, probe_type &x) {
+		if (s == "prime") {
+			x = PRIME;
+		} else if (s == "linear") {
+			x = LINEAR;
+		} else if (s == "quadratic") {
+			x = QUADRATIC;
+		} else {
+			return 0;
+		}
+		return 1;
+	}
+};
+
+#endif // !_HASH_PROBE_H
@@ -67,6 +67,10 @@ class hash_read_hits {
 	}
 	void add_read(key_type, read_type);
 	void get_reads(key_type, std::map<read_type, int> &, value_type) const;
+	// the reads for a kmer (in the order added, so in increasing order if
+	// reads are numbered as they're read in), or an empty range if the
+	// kmer isn't present or has more than max_hits reads
+	std::pair<const read_type *, const read_type *> get_read_range(key_type, value_type) const;
 	// the -1s are to allow for having to keep at least one INVALID_KEY
 	// in the array for lookup termination purposes
 	offset_type size(void) const {
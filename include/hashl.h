@@ -7,22 +7,32 @@
 //
 // key values are offsets into an internal array; a metadata blob is also stored
 
+#include "hash_probe.h"	// hash_probe
 #include "hashl_key_type.h"	// hashl_key_type<>
+#include "hashl_vector.h"	// hashl_vector<>
 #include <limits.h>	// UCHAR_MAX, ULONG_MAX
 #include <stdint.h>	// uint64_t
 #include <string>	// string
 #include <utility>	// pair<>
 #include <vector>	// vector<>
 
+class pfwrite_buffer;
+
 class hashl {
     public:	// type declarations
 	typedef unsigned char small_value_type;
+	typedef unsigned char tag_type;
 	typedef unsigned long hash_offset_type;
 	typedef uint64_t base_type;
 	typedef hashl_key_type<base_type> key_type;
 	typedef typename std::vector<base_type>::size_type size_type;
 	// invalid_value must be greater than max_small_value
 	enum { max_small_value = UCHAR_MAX - 1, invalid_value = UCHAR_MAX, invalid_key = ULONG_MAX };
+	// how many keys the _batch calls work on at a time (they take any number)
+	enum { batch_size = 32 };
+	// for init_from_file(); the map modes only apply to uncompressed
+	// version 3 files (see save()), others are read in regardless
+	enum { load_read = 0, load_map_read_only = 1, load_map_copy_on_write = 2 };
 
 	class iterator {
 	    private:
@@ -47,7 +57,8 @@ class hashl {
 		const hash_offset_type &offset() const {
 			return offset_;
 		}
-		void key(key_type &key) const {
+		template<class K>
+		void key(K &key) const {
 			key.copy_in(list.data, list.key_list[offset_]);
 		}
 		bool operator==(const iterator &__a) const {
@@ -96,7 +107,8 @@ class hashl {
 		const hash_offset_type &offset() const {
 			return offset_;
 		}
-		void key(key_type &key) const {
+		template<class K>
+		void key(K &key) const {
 			key.copy_in(list.data, list.key_list[offset_]);
 		}
 		bool operator==(const const_iterator &__a) const {
@@ -122,23 +134,49 @@ class hashl {
 	};
 
     protected:
-	std::vector<size_type> key_list;
-	std::vector<small_value_type> value_list;
-	std::vector<small_value_type> value_list_backup;	// only used for filtering
-	std::vector<base_type> data;
+	hashl_vector<size_type> key_list;
+	hashl_vector<small_value_type> value_list;
+	hashl_vector<small_value_type> value_list_backup;	// only used for filtering
+	// a few bits of each key's hash, so most mismatches on collisions can
+	// be skipped without having to pull the key out of data
+	hashl_vector<tag_type> tag_list;
+	hashl_vector<base_type> data;
 	std::vector<char> metadata;
 	hash_offset_type used_elements;
 	hash_offset_type modulus;
 	hash_offset_type collision_modulus;
 	size_type bit_width;
 	size_type word_width;
+	hash_probe probe;
     protected:
-	std::string boilerplate() const;
-	hash_offset_type find_offset(const key_type &key) const;
-	hash_offset_type find_offset(const key_type &key, const key_type &comp_key) const;
-	hash_offset_type insert_offset(const key_type &key, const key_type &comp_key, size_type);
+	// version 1 files have no version line in the boilerplate;
+	// version 2 added tag_list; version 3 stores every array whole and
+	// page aligned, so they can be mapped in place of being read
+	enum { file_version = 2, mappable_file_version = 3 };
+	std::string boilerplate(int version = file_version) const;
+	// never zero, so the atomic inserts can use zero to mean "not set yet"
+	static tag_type key_tag(const base_type key_hash) {
+		const tag_type x(key_hash * 0x9e3779b97f4a7c15ULL >> (sizeof(base_type) * 8 - sizeof(tag_type) * 8));
+		return x ? x : 1;
+	}
+	template<class K> hash_offset_type find_offset(const K &key) const;
+	template<class K> hash_offset_type find_offset(const K &key, const K &comp_key) const;
+	template<class K> hash_offset_type find_offset(const K &key, const K &comp_key, base_type key_hash) const;
+	template<class K> hash_offset_type insert_offset(const K &key, const K &comp_key, size_type);
+	template<class K> hash_offset_type insert_offset(const K &key, const K &comp_key, size_type, base_type key_hash);
+	template<class K> hash_offset_type insert_offset_atomic(const K &key, const K &comp_key, size_type);
+	template<class K> hash_offset_type insert_offset_atomic(const K &key, const K &comp_key, size_type, base_type key_hash);
+	template<class K> void prefetch_batch(const K *keys, const K *comp_keys, size_type n, base_type *key_hashes) const;
     private:
-	hash_offset_type insert_key(hash_offset_type, size_type);
+	hash_offset_type insert_key(hash_offset_type, size_type, tag_type);
+	void init_arrays_from_file(int fd, uint64_t file_offset, uint64_t data_size, int load_mode);
+	void save_arrays(pfwrite_buffer &, uint64_t file_offset) const;
+	template<class K>
+	static base_type canonical_hash(const K &key, const K &comp_key) {
+		return key < comp_key ? key.hash() : comp_key.hash();
+	}
+	// saturating increment, safe with other threads
+	static void increment_value_atomic(small_value_type &);
     public:
 	explicit hashl() : used_elements(0), modulus(0), collision_modulus(0), bit_width(0), word_width(0) { }
 	// size of hash, bit size of key_type, sequence data
@@ -148,17 +186,39 @@ class hashl {
 	~hashl() { }
 	// this trashes data_in by swapping it into the hash
 	void init(hash_offset_type size, size_type bits, std::vector<base_type> &data_in);
-	void init_from_file(int);
+	void init_from_file(int, int load_mode = load_read);
+	// table geometry used by the next init() or resize()
+	void set_probe_type(const hash_probe::probe_type x) {
+		probe.set_type(x);
+	}
+	// the calls taking keys accept key_type or any of the fixed width
+	// hashl_key_type<base_type, 1-3> (for the matching words())
+
 	// will not insert new key
-	void increment(const key_type &key, const key_type &comp_key);
+	template<class K> void increment(const K &key, const K &comp_key);
 	// will insert new key if missing, returns false if insertion failed
-	bool increment(const key_type &key, const key_type &comp_key, size_type);
+	template<class K> bool increment(const K &key, const K &comp_key, size_type);
 	// will insert new key if missing, or change an existing one to invalid
-	bool insert_unique(const key_type &key, const key_type &comp_key, size_type);
+	template<class K> bool insert_unique(const K &key, const K &comp_key, size_type);
 	// will insert a key with an invalid value, or convert existing value to invalid
-	bool insert_invalid(const key_type &key, const key_type &comp_key, size_type);
-	small_value_type value(const key_type &) const;
-	std::pair<size_type, small_value_type> entry(const key_type &) const;
+	template<class K> bool insert_invalid(const K &key, const K &comp_key, size_type);
+	// thread safe versions of the above three, for several threads sharing
+	// one hash; only valid on a hash with no removed keys (as empty
+	// entries must have zero values), and no other calls may be made
+	// while they're in use; the data offset stored for a repeated key
+	// is whichever thread got there first
+	template<class K> bool increment_atomic(const K &key, const K &comp_key, size_type);
+	template<class K> bool insert_unique_atomic(const K &key, const K &comp_key, size_type);
+	template<class K> bool insert_invalid_atomic(const K &key, const K &comp_key, size_type);
+	template<class K> small_value_type value(const K &) const;
+	template<class K> std::pair<size_type, small_value_type> entry(const K &) const;
+	// same as making the single key calls in order, but the hash slots
+	// for a block of keys are prefetched first, so the cache misses overlap
+	template<class K> void increment_batch(const K *keys, const K *comp_keys, size_type n);
+	template<class K> bool increment_batch(const K *keys, const K *comp_keys, const size_type *offsets, size_type n);
+	template<class K> bool increment_atomic_batch(const K *keys, const K *comp_keys, const size_type *offsets, size_type n);
+	// entries_out[i] = entry(keys[i])
+	template<class K> void find_batch(const K *keys, const K *comp_keys, size_type n, std::pair<size_type, small_value_type> *entries_out) const;
 	hash_offset_type size() const {
 		return used_elements;
 	}
@@ -186,20 +246,23 @@ class hashl {
 	iterator end() {
 		return iterator(*this, modulus);
 	}
-	const_iterator find(const key_type &key) const {
+	template<class K>
+	const_iterator find(const K &key) const {
 		return const_iterator(*this, find_offset(key));
 	}
-	const_iterator find(const key_type &key, const key_type &comp_key) const {
+	template<class K>
+	const_iterator find(const K &key, const K &comp_key) const {
 		return const_iterator(*this, find_offset(key, comp_key));
 	}
-	void save(int) const;
+	// mappable is the larger version 3 format (see init_from_file())
+	void save(int, bool mappable = 0) const;
 	void set_metadata(std::vector<char> &metadata_in) {
 		metadata.swap(metadata_in);
 	}
 	const std::vector<char> &get_metadata() const {
 		return metadata;
 	}
-	const std::vector<base_type> &get_data() const {
+	const hashl_vector<base_type> &get_data() const {
 		return data;
 	}
 	// start and length are in bits, not basepairs
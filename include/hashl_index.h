@@ -12,8 +12,23 @@
 // untouched on disk.
 //
 // key values are offsets into an internal array; a metadata blob is also stored
+//
+// The internal array (the packed sequence), the sorted list, and the
+// tables below are all mapped in from the file rather than read in, so
+// opening an index is quick, and processes using the same index share
+// its pages.
+//
+// For larger indexes, a table of where each kmer prefix (the first few
+// basepairs) starts in the sorted list is also stored, so a search only
+// has to cover the (much smaller) range of kmers sharing its prefix.
+// The first word of the first kmer on each page of the sorted list is
+// stored as well, making the list the leaves of a two level static
+// b-tree: the search through the (small) node keys picks out the page
+// the kmer has to be on, so a lookup usually touches only one page of
+// the list rather than one per step of the binary search.
 
 #include "hashl_key_type.h"	// hashl_key_type<>
+#include "hashl_vector.h"	// hashl_vector<>
 #include <stdint.h>	// uint64_t
 #include <string>	// string
 #include <vector>	// vector<>
@@ -61,12 +76,25 @@ class hashl_index {
 	// can't use std::span or std::array, as this has a variable size
 	const size_type *key_list;
 	size_type key_list_size, page_offset;
-	std::vector<base_type> data;
-	std::vector<char> metadata;
+	hashl_vector<base_type> data;	// mapped in, like key_list, except for old files
+	hashl_vector<char> metadata;	// also mapped in
 	size_type bit_width;
 	size_type word_width;
+	// prefix_table[x] is the first key_list entry with a prefix >= x
+	hashl_vector<size_type> prefix_table;	// mapped in as well
+	size_type prefix_bits;		// 0 if there's no prefix_table
+	// node_keys[i] is the first word of key_list[i * node_size]'s kmer
+	hashl_vector<base_type> node_keys;	// mapped in as well
+	size_type node_size;		// 0 if there are no node_keys
     protected:
-	static std::string boilerplate();	// static so it can be used from save()
+	enum { file_version = 2 };
+	static std::string boilerplate(int version = file_version);	// static so it can be used from save()
+	void read_tables(int fd, size_type offset, size_type padding_size);
+	static void read_word(int fd, size_type offset, size_type &);
+	static size_type data_prefix(const base_type *data, size_type offset, size_type bits);
+	size_type key_prefix(const key_type &) const;
+	size_type search(const key_type &) const;
+	void sequential_access(bool) const;
     public:
 	// can only be initialized from an uncompressed file
 	explicit hashl_index(int);
@@ -91,16 +119,55 @@ class hashl_index {
 	}
 	// returns -1 if not found
 	size_type position(const key_type &key) const;
-	const std::vector<char> &get_metadata() const {
+	// bulk version of search(): the n keys must be sorted (K is any
+	// hashl_key_type<base_type, Words>), and offsets[i] is set to the
+	// data offset of keys[i] (not its reverse complement), or -1; the
+	// index is swept through once, in order, instead of being searched
+	// from the top for each key
+	template<class K>
+	void positions(const K * const keys, const size_type n, size_type * const offsets) const {
+		for (size_type j = 0; j < n; ++j) {
+			offsets[j] = -1;
+		}
+		sequential_access(1);
+		size_type i = 0;	// every kmer before i is < the current key
+		for (size_type j = 0; j < n && i < key_list_size; ++j) {
+			const K &key = keys[j];
+			auto before = [&](const size_type x) {
+				return !key.less_than(data, key_list[x]) && !key.equal_to(data, key_list[x]);
+			};
+			if (before(i)) {
+				// gallop forward until past key, then binary search back
+				size_type low = i, high = i + 1;
+				for (size_type step = 2; high < key_list_size && before(high); step *= 2) {
+					low = high;
+					high = low + step;
+				}
+				if (high > key_list_size) {
+					high = key_list_size;
+				}
+				while (low + 1 < high) {
+					const size_type m = (low + high) / 2;
+					(before(m) ? low : high) = m;
+				}
+				i = high;
+			}
+			if (i < key_list_size && key.equal_to(data, key_list[i])) {
+				offsets[j] = key_list[i];
+			}
+		}
+		sequential_access(0);
+	}
+	const hashl_vector<char> &get_metadata() const {
 		return metadata;
 	}
-	const std::vector<base_type> &get_data() const {
+	const hashl_vector<base_type> &get_data() const {
 		return data;
 	}
 	// start and length are in bits, not basepairs
 	void get_sequence(size_type start, size_type length, std::string &) const;
 	void print() const;
-	static void save(const std::vector<size_type> &key_list_in, const std::vector<base_type> &data_in, const std::vector<char> &metadata_in, size_type bit_width_in, int fd_in);
+	static void save(const size_type *key_list_in, size_type key_list_size_in, const base_type *data_in, size_type data_size_in, const std::vector<char> &metadata_in, size_type bit_width_in, int fd_in);
 };
 
 #endif // !_HASHL_INDEX_H
@@ -1,6 +1,7 @@
 #ifndef _HASHL_KEY_TYPE_H
 #define _HASHL_KEY_TYPE_H
 
+#include <stddef.h>	// size_t
 #include <string>	// string
 #include <vector>	// vector<>
 
@@ -20,14 +21,49 @@ class hashl_key_hash {
 	}
 };
 
+// storage for the words of a key; Words > 0 gives a fixed size array, so
+// loops over the words have a constant bound and no heap is used;
+// Words == 0 is sized at run time
+
+template<typename base_type, size_t Words>
+class hashl_key_words {
+    private:
+	typedef typename std::vector<base_type>::size_type size_type;
+    private:
+	base_type w[Words];
+    public:
+	explicit hashl_key_words(size_type) : w() { }
+	~hashl_key_words() { }
+	static constexpr size_type size() {
+		return Words;
+	}
+	base_type &operator[](const size_type __i) {
+		return w[__i];
+	}
+	const base_type &operator[](const size_type __i) const {
+		return w[__i];
+	}
+};
+
 template<typename base_type>
+class hashl_key_words<base_type, 0> : public std::vector<base_type> {
+    public:
+	explicit hashl_key_words(const typename std::vector<base_type>::size_type __n) : std::vector<base_type>(__n, 0) { }
+	~hashl_key_words() { }
+};
+
+// Words is the number of base_type words in the key (0 for any number);
+// see hashl_key_dispatch() below for picking one at run time
+
+template<typename base_type, size_t Words = 0>
 class hashl_key_type {
     private:
 	typedef typename std::vector<base_type>::size_type size_type;
     private:
-	std::vector<base_type> k;		// stored in reverse - high word in [0]
+	hashl_key_words<base_type, Words> k;	// stored in reverse - high word in [0]
     public:
-	const std::vector<base_type> &value() const {
+	// for Words == 0, this is also a std::vector<base_type>
+	const hashl_key_words<base_type, Words> &value() const {
 		return k;
 	}
 	bool operator==(const hashl_key_type &__a) const {
@@ -41,18 +77,24 @@ class hashl_key_type {
 	bool operator!=(const hashl_key_type &__a) const {
 		return !(*this == __a);
 	}
+	// same as hashl_key_hash<>()(value())
 	base_type hash() const noexcept {
-		return hashl_key_hash<base_type>()(k);
+		base_type __x(k[0]);
+		for (size_type __i(1); __i < k.size(); ++__i) {
+			__x ^= k[__i];
+		}
+		return __x;
 	}
 	int basepair(const size_type __i) const {
 		const size_type __n(__i / (sizeof(base_type) * 8));
 		return (k[k.size() - 1 - __n] >> (__i - __n * sizeof(base_type) * 8)) & 3;
 	}
     private:
-	const size_type bit_shift;	// precalc for push_front
-	const base_type high_mask;	// precalc for push_back
+	// not const, so keys can be assigned (e.g., into a batch)
+	size_type bit_shift;		// precalc for push_front
+	base_type high_mask;		// precalc for push_back
     public:
-	explicit hashl_key_type(const size_type bits, const size_type words) : k(words, 0), bit_shift((bits - 2) % (sizeof(base_type) * 8)), high_mask(static_cast<base_type>(-1) >> (sizeof(base_type) * 8 - bits % (sizeof(base_type) * 8)) % (sizeof(base_type) * 8)) { }
+	explicit hashl_key_type(const size_type bits, const size_type words) : k(words), bit_shift((bits - 2) % (sizeof(base_type) * 8)), high_mask(static_cast<base_type>(-1) >> (sizeof(base_type) * 8 - bits % (sizeof(base_type) * 8)) % (sizeof(base_type) * 8)) { }
 	~hashl_key_type() { }
 	bool operator<(const hashl_key_type &__a) const {
 		for (size_type __i(0); __i != k.size(); ++__i) {
@@ -79,11 +121,32 @@ class hashl_key_type {
 		k[0] = (__x << bit_shift) | (k[0] >> 2);
 	}
 
-	// make reverse complement of given key (TODO: could probably be more efficient)
+    private:
+	// reverse the order of the basepairs in a word
+	static base_type reverse_basepairs(base_type x) {
+		for (size_type n(sizeof(base_type) * 4); n > 1; n /= 2) {
+			const base_type mask(static_cast<base_type>(-1) / ((static_cast<base_type>(1) << n) + 1));
+			x = ((x >> n) & mask) | ((x & mask) << n);
+		}
+		return x;
+	}
+    public:
+	// make reverse complement of given key (which must not be this key):
+	// complement and reverse each word in reverse word order, then shift
+	// out the unused high bits of key's high word, which end up at the
+	// bottom of our low word
 	void make_complement(const hashl_key_type &key) {
-		const size_type bit_width(bit_shift + 2 + (k.size() - 1) * sizeof(base_type) * 8);
-		for (size_type i(0); i < bit_width; i += 2) {
-			push_back(3 - key.basepair(i));
+		const size_type n(k.size() - 1);
+		for (size_type i(0); i <= n; ++i) {
+			k[i] = reverse_basepairs(~key.k[n - i]);
+		}
+		const size_type shift_right(sizeof(base_type) * 8 - 2 - bit_shift);
+		if (shift_right) {
+			const size_type shift_left(sizeof(base_type) * 8 - shift_right);
+			for (size_type i(n); i > 0; --i) {
+				k[i] = (k[i] >> shift_right) | (k[i - 1] << shift_left);
+			}
+			k[0] >>= shift_right;
 		}
 	}
 
@@ -97,8 +160,10 @@ class hashl_key_type {
 		}
 	}
 
-	// create key from bit offset into data
-	void copy_in(const std::vector<base_type> &data, const size_type offset) {
+	// create key from bit offset into data (D is any indexable array of
+	// base_type, e.g., std::vector<> or hashl_vector<>)
+	template<class D>
+	void copy_in(const D &data, const size_type offset) {
 		// start of sequence in data
 		const size_type i = offset / (sizeof(base_type) * 8);
 		// how many bits we have in the first word
@@ -128,7 +193,8 @@ class hashl_key_type {
 	}
 
 	// same as copy_in(), but with breakpoints and not saving the generated key
-	bool equal_to(const std::vector<base_type> &data, const size_type offset) const {
+	template<class D>
+	bool equal_to(const D &data, const size_type offset) const {
 		const size_type i = offset / (sizeof(base_type) * 8);
 		const base_type starting_bit = sizeof(base_type) * 8 - offset % (sizeof(base_type) * 8);
 		const base_type high_offset = bit_shift + 2;
@@ -168,7 +234,8 @@ class hashl_key_type {
 	}
 
 	// return if key < kmer at offset (mostly duplicates equal())
-	bool less_than(const std::vector<base_type> &data, const size_type offset) const {
+	template<class D>
+	bool less_than(const D &data, const size_type offset) const {
 		const size_type i = offset / (sizeof(base_type) * 8);
 		const base_type starting_bit = sizeof(base_type) * 8 - offset % (sizeof(base_type) * 8);
 		const base_type high_offset = bit_shift + 2;
@@ -208,4 +275,24 @@ class hashl_key_type {
 	}
 };
 
+// call f with a null pointer to the key type best suited to words; f can
+// then use the pointer's type to instantiate its templated inner loops
+
+template<typename base_type, typename F>
+void hashl_key_dispatch(const size_t words, F f) {
+	switch (words) {
+	    case 1:
+		f(static_cast<hashl_key_type<base_type, 1> *>(0));
+		break;
+	    case 2:
+		f(static_cast<hashl_key_type<base_type, 2> *>(0));
+		break;
+	    case 3:
+		f(static_cast<hashl_key_type<base_type, 3> *>(0));
+		break;
+	    default:
+		f(static_cast<hashl_key_type<base_type> *>(0));
+	}
+}
+
 #endif // !_HASHL_KEY_TYPE_H
@@ -21,7 +21,7 @@ class hashl_less {
     public:
 	bool operator()(const T &blob, const hash_offset_type &a, const hash_offset_type &b) const {
 		const size_type bit_width = blob.bits();
-		const std::vector<base_type> &data = blob.get_data();
+		const auto &data = blob.get_data();
 		const size_type a_i = a / (sizeof(base_type) * 8);
 		const unsigned int a_starting_bit = sizeof(base_type) * 8 - a % (sizeof(base_type) * 8);
 		const size_type b_i = b / (sizeof(base_type) * 8);
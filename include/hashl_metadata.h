@@ -2,9 +2,9 @@
 #define _HASHL_METADATA_H
 
 #include "hashl.h"	// hashl
-#include <map>		// map<>
+#include <string.h>	// memcpy()
 #include <string>	// string
-#include <utility>	// pair<>
+#include <utility>	// make_pair(), pair<>
 #include <vector>	// vector<>
 
 class hashl_metadata {
@@ -13,8 +13,33 @@ class hashl_metadata {
 	struct position {				// for doing position lookups
 		size_type file, read, read_start;
 	};
-    private:						// convenience variables for read_data()
-	std::vector<hashl::base_type> data;
+	// maps a data offset (in basepairs) to the position of the read range
+	// it's in; sorted arrays, rather than a map, to keep it small
+	class position_list {
+		friend class hashl_metadata_view;
+	    private:
+		// data offset of each range, plus the end of the last one
+		std::vector<size_type> starts;
+		std::vector<position> positions;
+	    public:
+		// also returns the data offsets of the range's start and end
+		const position &find(const size_type x, size_type &start, size_type &end) const {
+			// branch free binary search for the last start <= x
+			// (starts[0] is always 0)
+			const size_type *a = &starts[0];
+			for (size_type n = positions.size(); n > 1;) {
+				const size_type half = n / 2;
+				a = a[half] <= x ? a + half : a;
+				n -= half;
+			}
+			start = a[0];
+			end = a[1];
+			return positions[a - &starts[0]];
+		}
+	};
+    private:						// packing state for add_read_data()
+	std::vector<std::vector<hashl::base_type> > full_chunks;
+	std::vector<hashl::base_type> data;		// chunk being filled
 	size_type byte_offset;
 	int bit_offset;
     private:
@@ -23,22 +48,29 @@ class hashl_metadata {
 	// inclusive start, exclusive end		// ranges associated with each read (non-acgt basepairs create breaks in the read)
 	std::vector<std::vector<std::vector<std::pair<size_type, size_type> > > > read_ranges;
     public:
+	// marks a blob in the indexed layout (older blobs start with the
+	// file count, which can't be this)
+	static constexpr size_type indexed_layout = -1;
 	explicit hashl_metadata(void) { }
 	~hashl_metadata(void) { }
 	void add_filename(const std::string &file_name);	// add new file
 	void add_readname(const std::string &read_name);	// add new read for current file
 	void add_read_range(size_type, size_type);	// add new read range for current read
 	void finalize_file(void);			// remove last adds if empty
-	void read_data(std::vector<hashl::base_type> &data_out, bool feedback = 0);
+	void start_data(void);				// ready to pack sequence
+	void add_read_data(const std::string &seq);	// pack current read's ranges
+	void finish_data(std::vector<hashl::base_type> &data_out);
+	void add_data(hashl_metadata &);		// add() plus packed sequence
 	void pack(std::vector<char> &) const;		// create blob of our data
-	void unpack(const std::vector<char> &);		// fill our data from blob
-	void print(void) const;
+	void unpack(const char *, size_type);		// fill our data from blob
+	void unpack(const std::vector<char> &d) {
+		unpack(d.data(), d.size());
+	}
 	std::pair<size_type, size_type> total_reads(void) const;	// reads & read ranges
 	size_type max_kmers(size_type mer_length) const;
 	size_type sequence_length(void) const;
 	std::vector<size_type> read_ends(void) const;
 	void add(hashl_metadata &, size_type padding = 0);
-	void create_lookup_map(std::map<size_type, position> &) const;
 	void update_ranges(const std::vector<std::pair<size_type, size_type> > &);
 	size_type file_count(void) const {
 		return files.size();
@@ -53,8 +85,71 @@ class hashl_metadata {
 		return reads[i][j];
 	}
     private:
-	void read_file(size_type);
-	void get_subreads(const std::string &, const std::vector<std::pair<size_type, size_type> > &);
+	void next_word(void);
+	void append_bits(hashl::base_type, int);
+	void unpack_nested(const char *, size_type);
+};
+
+// read only access to a packed metadata blob, used where it is (it can be
+// mapped in from a file), rather than unpacked into per-file and per-read
+// lists; older blobs are converted to the indexed layout first
+
+class hashl_metadata_view {
+    public:
+	typedef hashl_metadata::size_type size_type;
+    private:
+	std::vector<char> converted;	// only used for older blobs
+	const char *blob;
+	size_type files, reads, ranges;
+	// positions (in words) of the arrays in blob
+	size_type file_reads_at, read_ranges_at, ranges_at, file_names_at, read_names_at;
+	const char *names;		// null terminated names
+	// the blob isn't necessarily aligned, so words are copied out
+	size_type word(const size_type i) const {
+		size_type x;
+		memcpy(&x, blob + i * sizeof(size_type), sizeof(x));
+		return x;
+	}
+	// index of first read of file i, and first range of read r (over all files)
+	size_type first_read(const size_type i) const {
+		return word(file_reads_at + i);
+	}
+	size_type first_range(const size_type r) const {
+		return word(read_ranges_at + r);
+	}
+    public:
+	explicit hashl_metadata_view(const char *, size_type);
+	template<class T>
+	explicit hashl_metadata_view(const T &d) : hashl_metadata_view(d.empty() ? 0 : &d[0], d.size()) { }
+	hashl_metadata_view(const hashl_metadata_view &) = delete;
+	~hashl_metadata_view(void) { }
+	hashl_metadata_view &operator=(const hashl_metadata_view &) = delete;
+	size_type file_count(void) const {
+		return files;
+	}
+	size_type read_count(const size_type i) const {
+		return first_read(i + 1) - first_read(i);
+	}
+	size_type range_count(const size_type i, const size_type j) const {
+		const size_type r = first_read(i) + j;
+		return first_range(r + 1) - first_range(r);
+	}
+	const char *file(const size_type i) const {
+		return names + word(file_names_at + i);
+	}
+	const char *read(const size_type i, const size_type j) const {
+		return names + word(read_names_at + first_read(i) + j);
+	}
+	// inclusive start, exclusive end
+	std::pair<size_type, size_type> range(const size_type i, const size_type j, const size_type k) const {
+		const size_type x = first_range(first_read(i) + j) + k;
+		return std::make_pair(word(ranges_at + 2 * x), word(ranges_at + 2 * x + 1));
+	}
+	std::pair<size_type, size_type> total_reads(void) const {	// reads & read ranges
+		return std::make_pair(reads, ranges);
+	}
+	void print(void) const;
+	void create_position_list(hashl_metadata::position_list &) const;
 };
 
 #endif // !_HASHL_METADATA_H
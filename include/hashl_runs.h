@@ -0,0 +1,75 @@
+#ifndef _HASHL_RUNS_H
+#define _HASHL_RUNS_H
+
+// A sorted run file holds the canonical kmers of a hashl (the lesser of
+// each kmer and its reverse complement) in increasing order, each with its
+// value.  Any number of them can be merged a kmer at a time, so combining
+// many hashes only needs one hash in memory at a time (to write out its
+// runs), and then just a read buffer per run file.
+//
+// After the header, each record is the kmer's words (high word first, as
+// in hashl_key_type) followed by a one byte value, without padding; the
+// end of the file is the end of the runs.
+
+#include "hashl.h"	// hashl
+#include "write_fork.h"	// pfwrite_buffer
+#include <string>	// string
+#include <vector>	// vector<>
+
+class hashl_runs {
+    public:
+	typedef hashl::base_type base_type;
+	typedef hashl::small_value_type small_value_type;
+	typedef hashl::size_type size_type;
+    private:
+	const int fd;
+	size_type bit_width, word_width, record_size;
+	std::vector<char> buffer;	// records read in, but not used yet
+	size_type buffer_start, buffer_end;
+	std::vector<base_type> key_;	// current kmer
+	small_value_type value_;
+	static std::string boilerplate();
+    public:
+	// reads the header from fd (which is left open)
+	explicit hashl_runs(int fd);
+	~hashl_runs() { }
+	// true if fd (not yet read from) is a run file
+	static bool is_runs(int fd);
+	size_type bits() const {
+		return bit_width;
+	}
+	size_type words() const {
+		return word_width;
+	}
+	// move to the next kmer; returns false at the end of the file
+	bool next();
+	const base_type *key() const {
+		return &key_[0];
+	}
+	small_value_type value() const {
+		return value_;
+	}
+	// write out the kmers of mer_list with non-zero values; mer_list is
+	// left as is, so it can still be saved or used afterwards
+	static void save(const hashl &mer_list, int fd, int threads = 1);
+
+	// writes a run file a record at a time, in kmer order
+	class writer {
+	    private:
+		pfwrite_buffer out;
+		const size_type word_width;
+	    public:
+		explicit writer(int fd, size_type bit_width);
+		~writer() { }
+		void add(const base_type * const key, const small_value_type value) {
+			out.write(key, sizeof(base_type) * word_width);
+			out.write(&value, sizeof(value));
+		}
+		// returns -1 if any write failed
+		ssize_t flush() {
+			return out.flush();
+		}
+	};
+};
+
+#endif // !_HASHL_RUNS_H
@@ -0,0 +1,170 @@
+#ifndef _HASHL_VECTOR_H
+#define _HASHL_VECTOR_H
+
+// array storage for hashl: either a regular in-memory vector, or a section
+// of a saved (version 3) hashl file mapped in with mmap(), so a large hash
+// can be used without reading it all in first - pages are only read from
+// disk as they're touched.
+//
+// A mapping is read only, or copy on write (changes stay private to the
+// process and never reach the file); anything that changes the size copies
+// a mapped array into memory first.
+
+#include <stdint.h>	// uint64_t, uintptr_t
+#include <sys/mman.h>	// MADV_DONTNEED, madvise(), MAP_FAILED, MAP_PRIVATE, mmap(), munmap(), PROT_READ, PROT_WRITE
+#include <sys/types.h>	// off_t, size_t
+#include <unistd.h>	// sysconf(), _SC_PAGE_SIZE
+#include <utility>	// swap()
+#include <vector>	// vector<>
+
+template<class T>
+class hashl_vector {
+    public:
+	typedef size_t size_type;
+	typedef T value_type;
+    private:
+	std::vector<T> vec_;
+	T *start_;		// &vec_[0], or into the mapping
+	size_type size_;
+	void *map_;		// start of mapping (page aligned), if any
+	size_t map_size_;
+	bool map_writable_;
+	void point_at_vec() {
+		start_ = vec_.empty() ? 0 : &vec_[0];
+		size_ = vec_.size();
+	}
+	void unmap() {
+		if (map_) {
+			munmap(map_, map_size_);
+			map_ = 0;
+			map_size_ = 0;
+		}
+	}
+	// copy a mapped array into memory, so it can be resized
+	void own() {
+		if (map_) {
+			std::vector<T>(start_, start_ + size_).swap(vec_);
+			unmap();
+			point_at_vec();
+		}
+	}
+    public:
+	explicit hashl_vector() : start_(0), size_(0), map_(0), map_size_(0), map_writable_(0) { }
+	explicit hashl_vector(const size_type n, const T &x) : vec_(n, x), map_(0), map_size_(0), map_writable_(0) {
+		point_at_vec();
+	}
+	// copies are always in memory
+	hashl_vector(const hashl_vector &a) : vec_(a.start_, a.start_ + a.size_), map_(0), map_size_(0), map_writable_(0) {
+		point_at_vec();
+	}
+	~hashl_vector() {
+		unmap();
+	}
+	hashl_vector &operator=(const hashl_vector &a) {
+		hashl_vector tmp(a);
+		swap(tmp);
+		return *this;
+	}
+	// map n elements at file_offset (which needn't be page aligned, but
+	// must be aligned for T); returns false (with errno set) on failure
+	bool map(const int fd, const uint64_t file_offset, const size_type n, const bool writable) {
+		clear();
+		if (n == 0) {
+			return 1;
+		}
+		const uint64_t page_offset(file_offset % sysconf(_SC_PAGE_SIZE));
+		map_size_ = n * sizeof(T) + page_offset;
+		map_ = mmap(0, map_size_, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_PRIVATE, fd, file_offset - page_offset);
+		if (map_ == MAP_FAILED) {
+			map_ = 0;	// prevent munmap() on destruction
+			map_size_ = 0;
+			return 0;
+		}
+		start_ = reinterpret_cast<T *>(static_cast<char *>(map_) + page_offset);
+		size_ = n;
+		map_writable_ = writable;
+		return 1;
+	}
+	bool mapped() const {
+		return map_ != 0;
+	}
+	bool writable() const {
+		return !map_ || map_writable_;
+	}
+	// give the memory for the whole pages within elements [from, to) back
+	// to the system, without changing the size; what was there is lost
+	// (it reads back as zero, or as the file contents for a mapping)
+	void release(const size_type from, const size_type to) {
+		const uintptr_t page(sysconf(_SC_PAGE_SIZE));
+		const uintptr_t x((reinterpret_cast<uintptr_t>(start_ + from) + page - 1) / page * page);
+		const uintptr_t y(reinterpret_cast<uintptr_t>(start_ + to) / page * page);
+		if (x < y) {
+			madvise(reinterpret_cast<void *>(x), y - x, MADV_DONTNEED);
+		}
+	}
+	// unlike std::vector<>::clear(), this also frees the memory
+	void clear() {
+		unmap();
+		std::vector<T>().swap(vec_);
+		point_at_vec();
+	}
+	void assign(const size_type n, const T &x) {
+		unmap();
+		vec_.assign(n, x);
+		point_at_vec();
+	}
+	void resize(const size_type n) {
+		own();
+		vec_.resize(n);
+		point_at_vec();
+	}
+	void reserve(const size_type n) {
+		own();
+		vec_.reserve(n);
+		point_at_vec();
+	}
+	void append(const T *first, const T *last) {
+		own();
+		vec_.insert(vec_.end(), first, last);
+		point_at_vec();
+	}
+	void swap(hashl_vector &a) {
+		vec_.swap(a.vec_);
+		std::swap(start_, a.start_);
+		std::swap(size_, a.size_);
+		std::swap(map_, a.map_);
+		std::swap(map_size_, a.map_size_);
+		std::swap(map_writable_, a.map_writable_);
+	}
+	void swap(std::vector<T> &a) {
+		own();
+		vec_.swap(a);
+		point_at_vec();
+	}
+	size_type size() const {
+		return size_;
+	}
+	bool empty() const {
+		return size_ == 0;
+	}
+	T &operator[](const size_type i) {
+		return start_[i];
+	}
+	const T &operator[](const size_type i) const {
+		return start_[i];
+	}
+	T *begin() {
+		return start_;
+	}
+	T *end() {
+		return start_ + size_;
+	}
+	const T *begin() const {
+		return start_;
+	}
+	const T *end() const {
+		return start_ + size_;
+	}
+};
+
+#endif // !_HASHL_VECTOR_H
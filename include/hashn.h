@@ -3,12 +3,14 @@
 
 // This is a class designed to be a memory efficient storage for counting
 // n-mers; keys and values are stored in separate arrays to avoid
-// alignment issues; a map is used to handle the infrequent case of values
-// beyond the size of the small value type
+// alignment issues; a side table is used to handle the infrequent case of
+// values beyond the size of the small value type
 //
 // The alt_list/alt_map arrays are available for storing extra information
 // associated with each element in an efficient manner.
 
+#include "hash_overflow.h"	// hash_overflow
+#include "hash_probe.h"	// hash_probe
 #include "refcount_array.h"	// refcount_array
 #include <algorithm>	// swap()
 #include <limits.h>	// UCHAR_MAX, ULONG_MAX
@@ -49,6 +51,9 @@ class hashn {
 		explicit key_type_base(void) { }
 		explicit key_type_base(size_t __i, base_type * const __j) : word_width(__i), k(__j) { }
 		~key_type_base(void) { }
+		const base_type *data(void) const {
+			return k;
+		}
 		void copy_out(base_type * const __x) const {
 			for (size_t __i(0); __i != word_width; ++__i) {
 				__x[__i] = k[__i];
@@ -218,6 +223,7 @@ class hashn {
 	offset_type used_elements;
 	offset_type modulus;
 	offset_type collision_modulus;
+	hash_probe probe;
 	size_t bit_width;			// only used by key_type
 	size_t word_width;
 	offset_type alt_size;
@@ -226,13 +232,14 @@ class hashn {
 	// alt_list is a two dimensional array (modulus * alt_size) declared
 	// as a single to maintain locality of values to reduce cache misses
 	small_value_type *alt_list;
-	std::map<std::string, value_type> value_map;	// for overflow
-	std::map<std::string, value_type> *alt_map;	// for alt overflows
+	hash_overflow value_map;			// for overflow
+	hash_overflow *alt_map;				// for alt overflows
     private:
 	std::string tmp_file_prefix;			// for TMP_FILE response
 	std::list<std::string> state_files;		// for TMP_FILE response
     protected:
 	std::string boilerplate(void) const;
+	void read_boilerplate(int);
 	offset_type find_offset(const key_type_base &) const;
 	offset_type insert_offset(const key_type_base &);
     private:
@@ -326,6 +333,10 @@ class hashn {
 	}
 	void save(int) const;
 	void set_no_space_response(int, const std::string & = "NONE");
+	// table geometry used by the next init()
+	void set_probe_type(const hash_probe::probe_type x) {
+		probe.set_type(x);
+	}
     public:
 	enum { print_hash_header = 1, print_hash_index = 2, print_data_offset = 4, print_value = 8, print_key = 16 };
 	void print(int flags = 31) const;
@@ -3,22 +3,47 @@
 
 /*
  * This is a class designed to be a memory efficient storage for counting
- * n-mers; keys and values are stored in separate arrays to avoid
- * alignment issues; a map is used to handle the infrequent case of values
- * beyond the size of the small value type
+ * n-mers of any length; keys and values are stored in separate arrays to
+ * avoid alignment issues; a side table is used to handle the infrequent
+ * case of values beyond the size of the small value type
+ *
+ * Keys are stored as fixed width arrays of words (high word first, as in
+ * hashl_key_type), and passed in as hashl_key_type<>s; the calls taking
+ * keys are templated on the key type, so the word loops for the usual
+ * n-mer lengths have a fixed bound (see hashl_key_dispatch() for picking
+ * the key type from the n-mer length at run time).
  *
  * The alt_list/alt_map arrays are available for storing extra information
  * associated with each element in an efficient manner.
  */
 
-#include <gmp.h>	/* mpz_clear(), mpz_t */
-#include <limits.h>	/* UCHAR_MAX */
-#include <map>		/* map<> */
+#include "hash_overflow.h"	/* hash_overflow */
+#include "hashl_key_type.h"	/* hashl_key_type<> */
+#include <limits.h>	/* UCHAR_MAX, ULONG_MAX */
+#include <stdint.h>	/* uint64_t */
 #include <string>	/* string */
+#include <sys/types.h>	/* size_t */
+
+/*
+ * a non-palindrome random pattern with one of the two highest bits set,
+ * and such that the complement is of lower value (so it only collides
+ * when using multiple of 32 mers, and then only for palindromic sequences
+ * leading with the key); the current pattern corresponds to
+ * TTAGCTGGGAAGGCTTATTGTGTCGTCGGATG
+ */
+
+/* choose size of constant by what will hold it */
+#if ULONG_MAX >= 0xffffffffffffffffULL
+#define INVALID_KEY 0xf27a829f3eedb68eUL
+#else
+#define INVALID_KEY 0xf27a829f3eedb68eULL
+#endif
 
 class hashz {
     public:	/* type declarations */
-	typedef mpz_t key_type;
+	typedef uint64_t base_type;
+	/* any width; the fixed width hashl_key_type<>s work as well */
+	typedef hashl_key_type<base_type> key_type;
 	typedef unsigned char small_value_type;
 	typedef unsigned long value_type;
 	typedef unsigned long offset_type;
@@ -29,17 +54,10 @@ class hashz {
 		const hashz *list;	/* hope *list doesn't move... */
 		offset_type offset;
 	    public:
-		key_type key;
 		value_type value;
 		const_iterator(void) : list(NULL), offset(0), value(0) { }
-		const_iterator(const const_iterator &);
 		const_iterator(const hashz *, offset_type);
-		~const_iterator(void) {
-			if (list != NULL) {
-				mpz_clear(key);
-			}
-		}
-		const_iterator &operator=(const const_iterator &);
+		~const_iterator(void) { }
 		bool operator==(const const_iterator &) const;
 		bool operator!=(const const_iterator &__a) const {
 			return !(*this == __a);
@@ -54,51 +72,60 @@ class hashz {
 			increment();
 			return __tmp;
 		}
+		/* key (of the hash's bit width) is undefined at end() */
+		template<class K>
+		void key(K &__k) const {
+			/* keys are stored right justified in their words */
+			__k.copy_in(list->key_list, (offset + 1) * list->word_width * sizeof(base_type) * 8 - list->bit_width);
+		}
 		void get_alt_values(value_type []) const;
 	};
 
     private:
-	/*
-	 * a non-palindrome random pattern with one of the two highest
-	 * bits set, and such that the complement is of lower value (so
-	 * it  doesn't collide if you only store the "smaller" key of
-	 * key/key-complement); if the given n-mer is found, the repeat
-	 * count for it will probably be low and it will be skipped by
-	 * the iterator;
-	 */
-	key_type invalid_key;
-	char *key_cstr;			/* dedicated space for key conversion */
 	offset_type used_elements;
 	offset_type modulus;
 	offset_type collision_modulus;
-	key_type *key_list;
+	unsigned long bit_width;
+	size_t word_width;
+	/* modulus * word_width; unused entries are INVALID_KEY repeated */
+	base_type *key_list;
 	small_value_type alt_size;
 	small_value_type *value_list;
-	std::map<std::string, value_type> value_map;	/* for overflow */
+	hash_overflow value_map;	/* for overflow */
 	small_value_type **alt_list;
-	std::map<std::string, value_type> *alt_map;	/* for alt overflows */
+	hash_overflow *alt_map;		/* for alt overflows */
     private:
-	offset_type insert_key(offset_type, const key_type &);
-	offset_type insert_offset(const key_type &);
-	offset_type find_offset(const key_type &) const;
+	void free_lists(void);
+	void allocate_lists(void);
+	std::string boilerplate(void) const;
+	bool is_invalid(const base_type *) const;
+	template<class K> offset_type insert_offset(const K &);
+	template<class K> offset_type find_offset(const K &) const;
     public:
-	/* size of hash, bit size of key_type, size of alt array */
-	explicit hashz(offset_type, unsigned long, small_value_type = 0);
+	hashz(void);
 	~hashz(void);
-	bool increment(const key_type &);
-	bool increment_alt(const key_type &, offset_type);
-	value_type value(const key_type &) const;
-	value_type value(const key_type &, value_type []) const;
+	/* size of hash, bit size of key_type, size of alt array */
+	void init(offset_type, unsigned long, small_value_type = 0);
+	/* replaces the current contents with a hash written by save() */
+	void init_from_file(int);
+	void save(int) const;
+	template<class K> bool increment(const K &);
+	template<class K> bool increment_alt(const K &, offset_type);
+	template<class K> value_type value(const K &) const;
+	template<class K> value_type value(const K &, value_type []) const;
 	const offset_type &size(void) const {
 		return used_elements;
 	}
 	const offset_type &capacity(void) const {
 		return modulus;
 	}
-	const key_type &get_invalid_key(void) const {
-		return invalid_key;
+	unsigned long bits(void) const {
+		return bit_width;
+	}
+	size_t words(void) const {
+		return word_width;
 	}
-	std::map<std::string, value_type>::size_type overflow_size(void) const {
+	hash_overflow::size_type overflow_size(void) const {
 		return value_map.size();
 	}
 	void clear(void);
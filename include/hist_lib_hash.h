@@ -7,6 +7,8 @@
 #include <map>		// map<>
 #include <string>	// string
 #include <sys/types.h>	// size_t
+#include <utility>	// pair<>
+#include <vector>	// vector<>
 
 class KmerLookupInfo;
 class Read;
@@ -19,6 +21,10 @@ extern hash::value_type opt_repeat_threshold;
 extern hash::value_type opt_repeat_threshold_upper;
 extern int opt_phred20_anchor;
 extern size_t opt_mer_length;
+// if opt_mer_partitions > 1, add_sequence_mers() (without read names) only
+// counts n-mers in partition opt_mer_partition (0 based)
+extern size_t opt_mer_partition;
+extern size_t opt_mer_partitions;
 extern size_t opt_repeat_coverage;
 extern size_t opt_skip_size;
 extern std::map<std::string, bool> opt_exclude;
@@ -33,7 +39,7 @@ extern bool add_sequence_mers(std::list<Read>::const_iterator, const std::list<R
 extern void add_sequence_mers_index(std::list<Read>::const_iterator, const std::list<Read>::const_iterator, KmerLookupInfo &, size_t, size_t);
 extern bool add_sequence_mers_hp(std::list<Read>::const_iterator, const std::list<Read>::const_iterator, hash &, size_t);
 extern bool add_sequence_mers(std::list<Read>::const_iterator, std::list<Read>::const_iterator, hash &, const std::map<std::string, hash::offset_type> &, size_t);
-extern size_t count_read_hits(const std::string &, const KmerLookupInfo &, std::map<hash_read_hits::read_type, int> &, hash_read_hits::value_type);
+extern size_t count_read_hits(const std::string &, const KmerLookupInfo &, std::vector<std::pair<hash_read_hits::read_type, int> > &, hash_read_hits::value_type);
 extern void count_kmers(const Read &, const hash &, size_t &, size_t &, size_t &);
 extern void screen_repeats(Read &, const hash &);
 extern unsigned long count_unique_phreds(const std::list<Read> &, const hash &, unsigned long * = NULL);
@@ -17,6 +17,10 @@ extern hashn::value_type opt_repeat_threshold;
 extern hashn::value_type opt_repeat_threshold_upper;
 extern int opt_phred20_anchor;
 extern int opt_repeat_coverage;
+// if opt_mer_partitions > 1, add_sequence_mers() (without read names) only
+// counts n-mers in partition opt_mer_partition (0 based)
+extern size_t opt_mer_partition;
+extern size_t opt_mer_partitions;
 extern size_t opt_skip_size;
 extern std::map<std::string, bool> opt_exclude;
 
@@ -2,6 +2,7 @@
 #define _WRITE_FORK_H
 
 #include <list>		// list<>
+#include <string.h>	// memcpy()
 #include <string>	// string
 #include <sys/stat.h>	// S_IRUSR, S_IWUSR, S_IRGRP, S_IWGRP, S_IROTH, S_IWOTH
 #include <sys/types.h>	// mode_t, size_t, ssize_t
@@ -17,4 +18,38 @@ extern ssize_t pfputc(int, char);
 extern ssize_t pfputs(int, const std::string &);
 extern ssize_t pfwrite(int, const void *, const size_t);
 
+// collects small writes into large blocks for pfwrite(), so saving a
+// table an entry at a time doesn't cost a system call per entry;
+// anything left is written out by flush() or the destructor
+
+class pfwrite_buffer {
+    private:
+	const int fd_;
+	char * const buf_;
+	const size_t size_;
+	size_t used_;
+	bool error_;
+	// not copyable (both copies would write out the same data)
+	pfwrite_buffer(const pfwrite_buffer &);
+	pfwrite_buffer &operator=(const pfwrite_buffer &);
+    public:
+	explicit pfwrite_buffer(int fd, size_t size = 1 << 20);
+	~pfwrite_buffer();
+	void write(const void * const ptr, const size_t size) {
+		if (used_ + size > size_) {
+			flush();
+			if (size > size_) {	// too big to buffer
+				if (pfwrite(fd_, ptr, size) == -1) {
+					error_ = 1;
+				}
+				return;
+			}
+		}
+		memcpy(buf_ + used_, ptr, size);
+		used_ += size;
+	}
+	// returns -1 if any write so far has failed
+	ssize_t flush(void);
+};
+
 #endif // !_WRITE_FORK_H
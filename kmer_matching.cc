@@ -19,6 +19,7 @@
 #include <string.h>	// memcpy(), strdup(), strlen(), strncmp()
 #include <string>	// string
 #include <unistd.h>	// STDIN_FILENO
+#include <utility>	// pair<>
 #include <vector>	// vector<>
 
 class LocalException : public std::exception {
@@ -60,7 +61,8 @@ class Selection {
 	hash_read_hits::value_type kmer_hit_max;
 	size_t search_kmers;	// number of kmers in search_sequence
 	std::string search_sequence;
-	std::map<hash_read_hits::read_type, int> read_hits;
+	// sorted by read
+	std::vector<std::pair<hash_read_hits::read_type, int> > read_hits;
 	// kmer_hit_max is unsigned, so -1 should be the max value
 	Selection() : match_value_min(0), kmer_hit_max(-1), search_kmers(0) { }
 	~Selection() { }
@@ -69,8 +71,8 @@ class Selection {
 		// (we also filter by match value cutoffs at this point)
 		// using list here for quick allocation and low memory usage
 		std::map<int, std::list<hash_read_hits::read_type> > list;
-		std::map<hash_read_hits::read_type, int>::const_iterator a(read_hits.begin());
-		const std::map<hash_read_hits::read_type, int>::const_iterator end_a(read_hits.end());
+		std::vector<std::pair<hash_read_hits::read_type, int> >::const_iterator a(read_hits.begin());
+		const std::vector<std::pair<hash_read_hits::read_type, int> >::const_iterator end_a(read_hits.end());
 		for (; a != end_a; ++a) {
 			if (a->second >= match_value_min * (normalize_by ? kmers.read_kmers(a->first) : search_kmers)) {
 				list[a->second].push_back(a->first);
@@ -100,8 +102,8 @@ class Selection {
 			return -1;
 		}
 		size_t total_written(0);
-		std::map<hash_read_hits::read_type, int>::const_iterator a(read_hits.begin());
-		const std::map<hash_read_hits::read_type, int>::const_iterator end_a(read_hits.end());
+		std::vector<std::pair<hash_read_hits::read_type, int> >::const_iterator a(read_hits.begin());
+		const std::vector<std::pair<hash_read_hits::read_type, int> >::const_iterator end_a(read_hits.end());
 		if (reads.empty()) {		// just write the read names
 			for (; a != end_a; ++a) {
 				if (a->second >= match_value_min) {
@@ -21,6 +21,7 @@ static bool opt_limit_printout;
 static bool opt_print_percent_masked;
 static bool opt_split;
 static bool opt_warnings;
+static int opt_histogram_restore;
 static int opt_mer_length;
 static size_t opt_nmers;
 static std::list<std::string> hist_files;
@@ -138,6 +139,7 @@ static void print_usage() {
 	fprintf(stderr, "    -p pattern    don't touch reads not matching pattern (an extended regex)\n");
 	fprintf(stderr, "    -q            turn off all warnings\n");
 	fprintf(stderr, "    -s suffix     suffix for individual files (defaults to .kmermasked)\n");
+	fprintf(stderr, "    -S file       load histogram memory dump from given file\n");
 	fprintf(stderr, "    -t threshold  number of repetitions for a n-mer to be highly repetitive\n");
 	fprintf(stderr, "                  (defaults to 20)\n");
 	fprintf(stderr, "    -T            strip first part of trace id\n");
@@ -158,6 +160,7 @@ static void get_opts(int argc, char **argv) {
 	opt_clip_quality = 0;
 	opt_clip_vector = 0;
 	opt_feedback = 1;
+	opt_histogram_restore = -1;
 	opt_limit_printout = 0;
 	opt_mask_lowercase = 0;
 	opt_mer_length = 24;
@@ -174,7 +177,7 @@ static void get_opts(int argc, char **argv) {
 	opt_suffix = ".kmermasked";
 	opt_warnings = 1;
 	int c, i;
-	while ((c = getopt(argc, argv, "a:cf:FgGhH:ik:l:Lm:p:qs:t:Tu:vVx:Xz:")) != EOF) {
+	while ((c = getopt(argc, argv, "a:cf:FgGhH:ik:l:Lm:p:qs:S:t:Tu:vVx:Xz:")) != EOF) {
 		switch (c) {
 		    case 'a':
 			opt_phred20_anchor = atoi(optarg);
@@ -246,6 +249,14 @@ static void get_opts(int argc, char **argv) {
 				print_usage();
 			}
 			break;
+		    case 'S':
+			opt_histogram_restore = open_compressed(optarg);
+			if (opt_histogram_restore == -1) {
+				fprintf(stderr, "Error: could not read histogram dump file\n");
+				print_usage();
+			}
+			opt_aggregate = 1;
+			break;
 		    case 't':
 			/* use an int here to catch negative values */
 			i = atoi(optarg);
@@ -305,6 +316,18 @@ static void get_opts(int argc, char **argv) {
 		fprintf(stderr, "Error: no files specified\n");
 		print_usage();
 	}
+	if (opt_histogram_restore != -1) {
+		if (opt_split) {
+			fprintf(stderr, "Error: -S and -G options cannot both be specified\n");
+			exit(1);
+		} else if (!hist_files.empty()) {
+			fprintf(stderr, "Error: -S and -H options cannot both be specified\n");
+			exit(1);
+		} else if (opt_nmers != 200 * 1024 * 1024) {
+			fprintf(stderr, "Error: -S and -z options cannot both be specified\n");
+			exit(1);
+		}
+	}
 	if (opt_split && opt_aggregate) {
 		if (hist_files.empty()) {
 			fprintf(stderr, "Error: -G and -g options cannot both be specified\n");
@@ -324,7 +347,7 @@ static void get_opts(int argc, char **argv) {
 			fprintf(stderr, "Warning: reducing repeat coverage to mer length\n");
 		}
 	}
-	if (hist_files.empty() && optind + 1 == argc) {
+	if (hist_files.empty() && optind + 1 == argc && opt_histogram_restore == -1) {
 		opt_aggregate = 0;
 	}
 }
@@ -339,7 +362,17 @@ int main(int argc, char **argv) {
 	int start = optind;
 		// if first read file is also used for histogram, only read once
 	int match_start = 0;
-	hashz mer_list(opt_nmers, opt_mer_length * 2);
+	hashz mer_list;
+	if (opt_histogram_restore != -1) {
+		mer_list.init_from_file(opt_histogram_restore);
+		close_compressed(opt_histogram_restore);
+		if (mer_list.bits() != static_cast<unsigned long>(opt_mer_length) * 2) {
+			fprintf(stderr, "Error: mer length does not match the histogram dump file\n");
+			return 1;
+		}
+	} else {
+		mer_list.init(opt_nmers, opt_mer_length * 2);
+	}
 	std::list<std::string>::const_iterator a = hist_files.begin();
 	std::list<std::string>::const_iterator end_a = hist_files.end();
 	for (; a != end_a; ++a) {
@@ -363,7 +396,7 @@ int main(int argc, char **argv) {
 			return 1;
 		}
 	}
-	if (hist_files.empty() || match_start) {
+	if ((hist_files.empty() && opt_histogram_restore == -1) || match_start) {
 		for (; optind < argc; ++optind) {
 			std::list<Read> read_list;
 			if (opt_feedback) {
@@ -0,0 +1,270 @@
+#include "hashl.h"	// hashl
+#include "hashl_runs.h"	// hashl_runs
+#include "open_compressed.h"	// close_compressed(), open_compressed()
+#include "version.h"	// VERSION
+#include "write_fork.h"	// close_fork(), write_fork()
+#include <algorithm>	// equal(), lexicographical_compare()
+#include <getopt.h>	// getopt(), optarg, optind
+#include <iostream>	// cerr, cout
+#include <list>		// list<>
+#include <queue>	// priority_queue<>
+#include <sstream>	// istringstream
+#include <stdlib.h>	// exit()
+#include <string>	// string
+#include <sys/stat.h>	// stat()
+#include <vector>	// vector<>
+
+// combine the kmers of any number of saved hashes - union, intersection,
+// difference, or the kmers shared by at most a given number of them - by
+// merging sorted runs of their kmers, so only one kmer per hash is in
+// memory at a time
+
+static bool opt_difference;
+static bool opt_intersection;
+static int opt_max_kmer_sharing;
+static int opt_threads;
+static std::string opt_output;
+
+static void print_usage() {
+	std::cerr << "usage: merge_kmers_hashl [options] <hash_or_runs1> [hash_or_runs2 [...] ]\n"
+		"    -d    difference: only keep kmers in the first file and none of the others\n"
+		"    -h    print this help\n"
+		"    -i    intersection: only keep kmers in every file\n"
+		"    -o ## save kmers as a sorted run file, instead of printing them\n"
+		"    -t ## number of threads for writing the sorted runs of hashes [1]\n"
+		"    -u ## only keep kmers found in at most ## files\n"
+		"          (negative values mean all but ##)\n"
+		"    -V    print version\n"
+		"Without -d, -i, or -u, all kmers are kept (the union).  Kmer values are\n"
+		"summed (invalid values stay invalid).  The sorted runs for a saved hash\n"
+		"are written to <hash>.runs, and used in place of the hash from then on,\n"
+		"as long as they're newer than it.\n";
+	exit(1);
+}
+
+static void get_opts(const int argc, char * const * const argv) {
+	opt_difference = 0;
+	opt_intersection = 0;
+	opt_max_kmer_sharing = 0;
+	opt_threads = 1;
+	int c;
+	while ((c = getopt(argc, argv, "dhio:t:u:V")) != EOF) {
+		switch (c) {
+		    case 'd':
+			opt_difference = 1;
+			break;
+		    case 'h':
+			print_usage();
+			break;
+		    case 'i':
+			opt_intersection = 1;
+			break;
+		    case 'o':
+			opt_output = optarg;
+			break;
+		    case 't':
+			std::istringstream(optarg) >> opt_threads;
+			if (opt_threads < 1) {
+				std::cerr << "Error: -t requires positive value\n";
+				exit(1);
+			}
+			break;
+		    case 'u':
+			std::istringstream(optarg) >> opt_max_kmer_sharing;
+			if (opt_max_kmer_sharing == 0) {
+				std::cerr << "Error: -u requires non-zero value\n";
+				exit(1);
+			}
+			break;
+		    case 'V':
+			std::cerr << "merge_kmers_hashl version " << VERSION << '\n';
+			exit(0);
+		    default:
+			std::cerr << "Error: unknown option " << char(c) << '\n';
+			print_usage();
+		}
+	}
+	if (opt_difference + opt_intersection + (opt_max_kmer_sharing != 0) > 1) {
+		std::cerr << "Error: only one of -d, -i, and -u may be given\n";
+		exit(1);
+	}
+	if (optind == argc) {
+		print_usage();
+	}
+	const int file_count(argc - optind);
+	if (opt_max_kmer_sharing < 0) {
+		opt_max_kmer_sharing += file_count;
+		if (opt_max_kmer_sharing < 1) {
+			opt_max_kmer_sharing = 1;
+		}
+	}
+}
+
+// returns an open fd for the runs of the given file: either the file
+// itself, or its saved runs, which are written first if need be
+
+static int open_runs(const std::string &file) {
+	int fd(open_compressed(file));
+	if (fd == -1) {
+		std::cerr << "Error: could not read " << file << '\n';
+		exit(1);
+	}
+	if (hashl_runs::is_runs(fd)) {
+		return fd;
+	}
+	const std::string runs_file(file + ".runs");
+	struct stat file_buf, runs_buf;
+	if (stat(file.c_str(), &file_buf) != 0 || stat(runs_file.c_str(), &runs_buf) != 0 || runs_buf.st_mtime < file_buf.st_mtime) {
+		hashl mer_list;
+		mer_list.init_from_file(fd, hashl::load_map_read_only);
+		close_compressed(fd);
+		// run files are never compressed
+		const int fd_out(write_fork(std::list<std::string>(), runs_file));
+		if (fd_out == -1) {
+			std::cerr << "Error: could not save runs " << runs_file << '\n';
+			exit(1);
+		}
+		hashl_runs::save(mer_list, fd_out, opt_threads);
+		close_fork(fd_out);
+	} else {
+		close_compressed(fd);
+	}
+	fd = open_compressed(runs_file);
+	if (fd == -1) {
+		std::cerr << "Error: could not read " << runs_file << '\n';
+		exit(1);
+	}
+	return fd;
+}
+
+static void print_kmer(const hashl_runs::base_type * const key, const hashl_runs::size_type bit_width, const hashl_runs::size_type word_width, const hashl_runs::small_value_type value) {
+	const char values[4] = { 'A', 'C', 'G', 'T' };
+	const hashl_runs::size_type word_bits(sizeof(hashl_runs::base_type) * 8);
+	std::string s;
+	// relies on wrap-around for termination
+	for (hashl_runs::size_type i(bit_width - 2); i < bit_width; i -= 2) {
+		const hashl_runs::size_type n(i / word_bits);
+		s += values[(key[word_width - 1 - n] >> (i - n * word_bits)) & 3];
+	}
+	std::cout << s << ' ' << int(value) << '\n';
+}
+
+// orders run files by their current kmers, lowest on top
+
+class runs_later {
+    private:
+	const std::vector<hashl_runs *> &runs;
+	const hashl_runs::size_type word_width;
+    public:
+	explicit runs_later(const std::vector<hashl_runs *> &runs_in, const hashl_runs::size_type word_width_in) : runs(runs_in), word_width(word_width_in) { }
+	bool operator()(const size_t i, const size_t j) const {
+		const hashl_runs::base_type * const a(runs[i]->key());
+		const hashl_runs::base_type * const b(runs[j]->key());
+		return std::lexicographical_compare(b, b + word_width, a, a + word_width);
+	}
+};
+
+// merge all the runs, keeping each kmer (and its summed value) depending
+// on which of the runs it was found in
+
+static void merge_runs(const std::vector<hashl_runs *> &runs) {
+	const hashl_runs::size_type bit_width(runs[0]->bits()), word_width(runs[0]->words());
+	hashl_runs::writer *out(0);
+	int fd_out(-1);
+	if (!opt_output.empty()) {
+		fd_out = write_fork(std::list<std::string>(), opt_output);
+		if (fd_out == -1) {
+			std::cerr << "Error: could not write to " << opt_output << '\n';
+			exit(1);
+		}
+		out = new hashl_runs::writer(fd_out, bit_width);
+	}
+	std::priority_queue<size_t, std::vector<size_t>, runs_later> heap(runs_later(runs, word_width));
+	bool first_done(0);
+	for (size_t i(0); i < runs.size(); ++i) {
+		if (runs[i]->next()) {
+			heap.push(i);
+		} else if (i == 0) {
+			first_done = 1;
+		}
+	}
+	std::vector<hashl_runs::base_type> key(word_width);
+	while (!heap.empty()) {
+		// once a run is used up, no later kmer can be in all runs, and once
+		// the first one is, no later kmer can be in it
+		if ((opt_intersection && heap.size() < runs.size()) || (opt_difference && first_done)) {
+			break;
+		}
+		std::copy(runs[heap.top()]->key(), runs[heap.top()]->key() + word_width, key.begin());
+		int found(0);
+		bool in_first(0);
+		unsigned int value(0);
+		while (!heap.empty() && std::equal(key.begin(), key.end(), runs[heap.top()]->key())) {
+			const size_t i(heap.top());
+			heap.pop();
+			++found;
+			if (i == 0) {
+				in_first = 1;
+			}
+			if (value != hashl::invalid_value) {
+				if (runs[i]->value() == hashl::invalid_value) {
+					value = hashl::invalid_value;
+				} else {
+					value += runs[i]->value();
+					if (value > hashl::max_small_value) {
+						value = hashl::max_small_value;
+					}
+				}
+			}
+			if (runs[i]->next()) {
+				heap.push(i);
+			} else if (i == 0) {
+				first_done = 1;
+			}
+		}
+		if (opt_difference) {
+			if (!in_first || found != 1) {
+				continue;
+			}
+		} else if (opt_intersection) {
+			if (found != int(runs.size())) {
+				continue;
+			}
+		} else if (opt_max_kmer_sharing && found > opt_max_kmer_sharing) {
+			continue;
+		}
+		if (out) {
+			out->add(&key[0], value);
+		} else {
+			print_kmer(&key[0], bit_width, word_width, value);
+		}
+	}
+	if (out) {
+		if (out->flush() == -1) {
+			std::cerr << "Error: could not write to " << opt_output << '\n';
+			exit(1);
+		}
+		delete out;
+		close_fork(fd_out);
+	}
+}
+
+int main(const int argc, char * const * const argv) {
+	get_opts(argc, argv);
+	std::vector<int> fds;
+	std::vector<hashl_runs *> runs;
+	for (int i(optind); i < argc; ++i) {
+		fds.push_back(open_runs(argv[i]));
+		runs.push_back(new hashl_runs(fds.back()));
+		if (runs.back()->bits() != runs[0]->bits()) {
+			std::cerr << "Error: kmer length mismatch: " << argv[i] << '\n';
+			return 1;
+		}
+	}
+	merge_runs(runs);
+	for (size_t i(0); i < runs.size(); ++i) {
+		delete runs[i];
+		close_compressed(fds[i]);
+	}
+	return 0;
+}
@@ -321,7 +321,7 @@ int open_compressed(const std::string &filename, bool force_uncompressed) {
 	std::string s(filename);
 	std::string suffix;
 	// see if file exists
-	if (!s.empty() && s.compare("-") != 0 && (force_uncompressed || find_suffix(s, suffix) == -1)) {
+	if (!s.empty() && s.compare("-") != 0 && (!force_uncompressed && find_suffix(s, suffix) == -1)) {
 		return -1;
 	}
 	if (!suffix.empty()) {
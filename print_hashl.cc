@@ -1,5 +1,5 @@
 #include "hashl.h"	// hashl
-#include "hashl_metadata.h"	// hashl_metadata
+#include "hashl_metadata.h"	// hashl_metadata_view
 #include "open_compressed.h"	// close_compressed(), open_compressed()
 #include <getopt.h>	// getopt(), optind
 #include <iostream>	// cerr, cout
@@ -64,11 +64,10 @@ int main(int argc, char **argv) {
 			return 1;
 	}
 	hashl x;
-	x.init_from_file(fd);
+	x.init_from_file(fd, hashl::load_map_read_only);
 	close_compressed(fd);
 	if (!opt_no_metadata) {
-		hashl_metadata md;
-		md.unpack(x.get_metadata());
+		const hashl_metadata_view md(x.get_metadata());
 		md.print();
 	}
 	if (opt_just_metadata) {
@@ -1,5 +1,5 @@
 #include "hashl_index.h"	// hashl_index
-#include "hashl_metadata.h"	// hashl_metadata
+#include "hashl_metadata.h"	// hashl_metadata_view
 #include "open_compressed.h"	// close_compressed(), open_compressed()
 #include <getopt.h>	// getopt(), optind
 #include <iostream>	// cerr, cout
@@ -44,8 +44,7 @@ int main(int argc, char **argv) {
 			return 1;
 	}
 	hashl_index x(fd);
-	hashl_metadata md;
-	md.unpack(x.get_metadata());
+	const hashl_metadata_view md(x.get_metadata());
 	md.print();
 	if (opt_just_metadata) {
 		close_compressed(fd);
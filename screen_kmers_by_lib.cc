@@ -1,4 +1,5 @@
 #include "hashl.h"	// hashl
+#include "hashl_key_type.h"	// hashl_key_dispatch()
 #include "hashl_metadata.h"	// hashl_metadata
 #include "open_compressed.h"	// close_compressed(), get_suffix(), open_compressed()
 #include "time_used.h"	// elapsed_time(), start_time()
@@ -15,6 +16,7 @@
 #include <string.h>	// strerror()
 #include <string>	// string
 #include <time.h>	// time()
+#include <type_traits>	// remove_pointer<>
 #include <vector>	// vector<>
 
 // take an existing hash, count hits against a library, and mark
@@ -24,6 +26,7 @@
 // library are removed from the output hash
 
 static bool opt_feedback;
+static bool opt_mappable_save;
 static bool opt_purge_hash;
 static bool opt_squash_hash;
 static int opt_library_counts;
@@ -36,6 +39,8 @@ static void print_usage() {
 	std::cerr << "usage: screen_kmers_by_lib reference_hash library.fastx [more_library.fastx [...] ]\n"
 		"          multiple library files are treated as one large file - to screen against\n"
 		"          multiple libraries, you have to run this program once per library\n"
+		"    -A    save in the larger, memory-mappable format (use with an\n"
+		"          uncompressed file name)\n"
 		"    -h    print this help\n"
 		"    -f ## min kmer frequency [1]\n"
 		"    -F ## max kmer frequency [" << static_cast<unsigned int>(hashl::max_small_value) << "]\n"
@@ -52,13 +57,17 @@ static void print_usage() {
 static void get_opts(const int argc, char * const * const argv) {
 	opt_feedback = 1;
 	opt_library_counts = 0;
+	opt_mappable_save = 0;
 	opt_max_kmer_frequency = hashl::max_small_value;
 	opt_min_kmer_frequency = 1;
 	opt_purge_hash = 0;
 	opt_squash_hash = 0;
 	int c;
-	while ((c = getopt(argc, argv, "hf:F:lo:pPqV")) != EOF) {
+	while ((c = getopt(argc, argv, "Ahf:F:lo:pPqV")) != EOF) {
 		switch (c) {
+		    case 'A':
+			opt_mappable_save = 1;
+			break;
 		    case 'h':
 			print_usage();
 			break;
@@ -121,7 +130,7 @@ static void save_hash(const hashl &mer_list, const std::string &filename) {
 		std::cerr << "Error: could not save hash " << filename << '\n';
 		exit(1);
 	}
-	mer_list.save(fd);
+	mer_list.save(fd, opt_mappable_save);
 	close_fork_wait(fd);
 	if (rename(tmp.c_str(), filename.c_str()) == -1) {
 		std::cerr << "Error: rename: " << tmp << ": " << filename << ": " << strerror(errno) << '\n';
@@ -149,25 +158,40 @@ static hashl::base_type convert_char(const char c) {
 	}
 }
 
-static void count_sequence_mers(hashl &reference_kmers, const std::string &seq, size_t i, const size_t end) {
-	hashl::key_type key(reference_kmers.bits(), reference_kmers.words()), comp_key(reference_kmers.bits(), reference_kmers.words());
+// K is one of the hashl_key_type<> variants (see hashl_key_dispatch());
+// keys and comp_keys are hashl::batch_size long, and are used to pass
+// the kmers to the hash a block at a time
+
+template<class K>
+static void count_sequence_mers(hashl &reference_kmers, const std::string &seq, size_t i, const size_t end, std::vector<K> &keys, std::vector<K> &comp_keys) {
+	K key(reference_kmers.bits(), reference_kmers.words()), comp_key(reference_kmers.bits(), reference_kmers.words());
 	const size_t preload_end(i + opt_mer_length - 1);
 	for (; i < preload_end; ++i) {
 		const hashl::base_type c(convert_char(seq[i]));
 		key.push_back(c);
 		comp_key.push_front(3 - c);
 	}
+	size_t n(0);
 	for (; i < end; ++i) {
 		const hashl::base_type c(convert_char(seq[i]));
 		key.push_back(c);
 		comp_key.push_front(3 - c);
-		reference_kmers.increment(key, comp_key);
+		keys[n] = key;
+		comp_keys[n] = comp_key;
+		if (++n == hashl::batch_size) {
+			reference_kmers.increment_batch(&keys[0], &comp_keys[0], n);
+			n = 0;
+		}
+	}
+	if (n) {
+		reference_kmers.increment_batch(&keys[0], &comp_keys[0], n);
 	}
 }
 
 // for each range of value basepairs (if at least opt_mer_length in length), count kmers
 
-static void process_sequence(hashl &reference_kmers, const std::string &seq) {
+template<class K>
+static void process_sequence(hashl &reference_kmers, const std::string &seq, std::vector<K> &keys, std::vector<K> &comp_keys) {
 	size_t i(seq.find_first_of("ACGTacgt", 0));
 	while (i != std::string::npos) {
 		size_t next(seq.find_first_not_of("ACGTacgt", i));
@@ -176,13 +200,14 @@ static void process_sequence(hashl &reference_kmers, const std::string &seq) {
 		}
 		// reads shorter than the mer length are skipped
 		if (next - i >= opt_mer_length) {
-			count_sequence_mers(reference_kmers, seq, i, next);
+			count_sequence_mers<K>(reference_kmers, seq, i, next, keys, comp_keys);
 		}
 		i = seq.find_first_of("ACGTacgt", next);
 	}
 }
 
 // get total match counts for reference kmers
+template<class K>
 static void process_library(hashl &reference_kmers, const std::string &library_file) {
 	const int fd(open_compressed(library_file));
 	if (fd == -1) {
@@ -193,6 +218,7 @@ static void process_library(hashl &reference_kmers, const std::string &library_f
 		std::cerr << time(0) << ": processing " << library_file << '\n';
 		start_time();
 	}
+	std::vector<K> keys(hashl::batch_size, K(reference_kmers.bits(), reference_kmers.words())), comp_keys(keys);
 	size_t read_count(0);
 	std::string line, seq;
 	if (pfgets(fd, line) == -1) {		// empty file
@@ -204,7 +230,7 @@ static void process_library(hashl &reference_kmers, const std::string &library_f
 			while (pfgets(fd, line) != -1 && line[0] != '>') {
 				seq += line;
 			}
-			process_sequence(reference_kmers, seq);
+			process_sequence<K>(reference_kmers, seq, keys, comp_keys);
 			++read_count;
 			if (opt_feedback && elapsed_time() >= 600) {
 				start_time();
@@ -217,7 +243,7 @@ static void process_library(hashl &reference_kmers, const std::string &library_f
 				std::cerr << "Error: truncated fastq file: " << library_file << '\n';
 				exit(1);
 			}
-			process_sequence(reference_kmers, seq);
+			process_sequence<K>(reference_kmers, seq, keys, comp_keys);
 			++read_count;
 			if (opt_feedback && elapsed_time() >= 600) {
 				start_time();
@@ -253,14 +279,18 @@ int main(const int argc, char * const * const argv) {
 	if (opt_feedback) {
 		std::cerr << time(0) << ": reading in reference hash\n";
 	}
-	reference_kmers.init_from_file(fd);
+	// the copy on write mapping means the original is untouched,
+	// even if it's the file being overwritten
+	reference_kmers.init_from_file(fd, hashl::load_map_copy_on_write);
 	close_compressed(fd);
 	// !opt_library_counts == keep original reference counts
 	reference_kmers.filtering_prep(!opt_library_counts);
 	opt_mer_length = reference_kmers.bits() / 2;
-	for (int i = optind + 1; i < argc; ++i) {
-		process_library(reference_kmers, argv[i]);
-	}
+	hashl_key_dispatch<hashl::base_type>(reference_kmers.words(), [&](auto key_ptr) {
+		for (int i = optind + 1; i < argc; ++i) {
+			process_library<typename std::remove_pointer<decltype(key_ptr)>::type>(reference_kmers, argv[i]);
+		}
+	});
 	reference_kmers.filtering_finish(opt_min_kmer_frequency, opt_max_kmer_frequency);
 	if (opt_purge_hash) {
 		if (opt_feedback) {
@@ -1,5 +1,5 @@
 #include "hashl.h"	// hashl
-#include "hashl_metadata.h"	// hashl_metadata
+#include "hashl_metadata.h"	// hashl_metadata_view
 #include "open_compressed.h"	// close_compressed(), get_suffix(), open_compressed()
 #include "version.h"	// VERSION
 #include "write_fork.h"	// close_fork(), write_fork()
@@ -7,6 +7,7 @@
 #include <iomanip>	// fixed, setprecision()
 #include <iostream>	// cerr, cout
 #include <list>		// list<>
+#include <map>		// map<>
 #include <sstream>	// istringstream
 #include <stdlib.h>	// exit()
 #include <string>	// string
@@ -16,6 +17,7 @@
 // go through a target's hash seeing which kmers match; multiple target
 // files are treated as one big target file
 
+static bool opt_mappable_save;
 static bool opt_print_histogram;
 static int opt_fastq_max_kmer_frequency;
 static int opt_fastq_min_kmer_frequency;
@@ -60,6 +62,8 @@ static size_t get_value(const std::string s) {
 
 static void print_usage() {
 	std::cerr << "usage: screen_kmers_by_ref [target_hash1 [target_hash2 ...]]\n"
+		"    -A    save hashes in the larger, memory-mappable format (use with\n"
+		"          uncompressed file names)\n"
 		"    -h    print this help\n"
 		"    -H    print histogram of combined reference\n"
 		"    -f ## fastq min kmer frequency\n"
@@ -85,14 +89,18 @@ static void get_opts(const int argc, char * const * const argv) {
 	opt_fastq_max_kmer_frequency = hashl::max_small_value;
 	opt_fastq_min_kmer_frequency = 0;
 	opt_hash_load = -1;
+	opt_mappable_save = 0;
 	opt_max_kmer_sharing = -1;
 	opt_nmers = 0;
 	opt_print_histogram = 0;
 	opt_reference_max_kmer_frequency = 1;
 	opt_reference_min_kmer_frequency = 0;
 	int c;
-	while ((c = getopt(argc, argv, "hHf:F:i:m:M:o:p:r:s:S:u:Vz:")) != EOF) {
+	while ((c = getopt(argc, argv, "AhHf:F:i:m:M:o:p:r:s:S:u:Vz:")) != EOF) {
 		switch (c) {
+		    case 'A':
+			opt_mappable_save = 1;
+			break;
 		    case 'h':
 			print_usage();
 			break;
@@ -162,7 +170,7 @@ static void save_hash(const hashl &mer_list, const std::string &filename) {
 		std::cerr << "Error: could not save hash " << filename << '\n';
 		exit(1);
 	}
-	mer_list.save(fd);
+	mer_list.save(fd, opt_mappable_save);
 	close_fork(fd);
 }
 
@@ -209,7 +217,7 @@ static bool load_and_combine_hashes(hashl &kmer_hash, const std::vector<std::str
 			std::cerr << "Error: could not read saved hash: " << file << '\n';
 			return 0;
 		}
-		tmp_hash.init_from_file(fd);
+		tmp_hash.init_from_file(fd, hashl::load_map_read_only);
 		close_compressed(fd);
 		if (&file == &files[0]) {	// set the bit width, possibly preallocate
 			std::vector<hashl::base_type> tmp_data;
@@ -282,10 +290,9 @@ int main(const int argc, char * const * const argv) {
 	get_opts(argc, argv);
 	hashl reference_kmers;
 	if (opt_hash_load != -1) {
-		reference_kmers.init_from_file(opt_hash_load);
+		reference_kmers.init_from_file(opt_hash_load, hashl::load_map_copy_on_write);
 		close_compressed(opt_hash_load);
-		hashl_metadata md;
-		md.unpack(reference_kmers.get_metadata());
+		const hashl_metadata_view md(reference_kmers.get_metadata());
 		if (opt_max_kmer_sharing < 0) {
 			opt_max_kmer_sharing += md.file_count();
 		}
@@ -245,3 +245,20 @@ ssize_t pfwrite(const int fd, const void * const ptr, const size_t size) {
 	}
 	return size;
 }
+
+pfwrite_buffer::pfwrite_buffer(const int fd, const size_t size) : fd_(fd), buf_(new char[size]), size_(size), used_(0), error_(0) { }
+
+pfwrite_buffer::~pfwrite_buffer() {
+	flush();
+	delete[] buf_;
+}
+
+ssize_t pfwrite_buffer::flush(void) {
+	if (used_ != 0) {
+		if (pfwrite(fd_, buf_, used_) == -1) {
+			error_ = 1;
+		}
+		used_ = 0;
+	}
+	return error_ ? -1 : 0;
+}